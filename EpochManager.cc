@@ -0,0 +1,227 @@
+#include "EpochManager.hh"
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+
+namespace
+{
+    // 退休对象至少攒到这么多个才尝试回收
+    constexpr std::size_t kReclaimThreshold = 64;
+    // 每次retire最多释放这么多个，比退休的快一点就不会越攒越多
+    // 原来攒够了一次全部释放，释放的是段的话一个要扫所有桶，碰上的那次插入要多等几十微秒
+    constexpr std::size_t kReclaimPerRetire = 2;
+    // 推进了epoch的线程在每条别的线程的链表里最多释放这么多个
+    constexpr std::size_t kReclaimOthersPerRecord = 8;
+
+    std::atomic<uint64_t> next_manager_id{1};
+
+    // 还没析构的EpochManager的id，线程本地缓存里析构了的树的项要靠它清掉，
+    // 线程退出时也要在这把锁里确认树还在，才能去动它的记录
+    // 故意不释放，静态对象析构之后才退出的线程也还能用
+    std::mutex &registry_lock()
+    {
+        static std::mutex *lock = new std::mutex;
+        return *lock;
+    }
+    std::unordered_set<uint64_t> &live_managers()
+    {
+        static std::unordered_set<uint64_t> *ids = new std::unordered_set<uint64_t>;
+        return *ids;
+    }
+}
+
+// 线程本地缓存：(树的id, 记录)，一般只有一两棵树，线性查找即可
+// 线程退出时把还没析构的树上的记录还回去，退休链表留在记录里，由别的线程回收
+struct EpochManager::RecordCache
+{
+    std::vector<std::pair<uint64_t, ThreadRecord *>> entries;
+
+    ~RecordCache()
+    {
+        std::lock_guard<std::mutex> lock(registry_lock());
+        for (const auto &entry : entries)
+        {
+            if (live_managers().count(entry.first) != 0)
+            {
+                entry.second->owned.store(false, std::memory_order_release);
+            }
+        }
+    }
+};
+
+EpochManager::Guard::Guard(EpochManager *manager) : record_(manager->local_record())
+{
+    if (record_->nesting++ == 0)
+    {
+        // 用exchange而不是store，保证之后读树上的指针不会被重排到登记epoch之前
+        record_->local_epoch.exchange(manager->global_epoch_.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+}
+
+EpochManager::Guard::~Guard()
+{
+    if (--record_->nesting == 0)
+    {
+        record_->local_epoch.store(0, std::memory_order_release);
+    }
+}
+
+EpochManager::EpochManager() : id_(next_manager_id.fetch_add(1, std::memory_order_relaxed))
+{
+    std::lock_guard<std::mutex> lock(registry_lock());
+    live_managers().insert(id_);
+}
+
+EpochManager::~EpochManager()
+{
+    {
+        // 从这之后退出的线程不会再碰这棵树的记录
+        std::lock_guard<std::mutex> lock(registry_lock());
+        live_managers().erase(id_);
+    }
+    ThreadRecord *record = records_.load(std::memory_order_acquire);
+    while (record != nullptr)
+    {
+        for (std::size_t i = record->retired_head; i < record->retired.size(); i++)
+        {
+            record->retired[i].deleter(record->retired[i].context, record->retired[i].ptr);
+        }
+        ThreadRecord *next = record->next;
+        delete record;
+        record = next;
+    }
+}
+
+EpochManager::ThreadRecord *EpochManager::local_record()
+{
+    static thread_local RecordCache cache;
+    for (const auto &entry : cache.entries)
+    {
+        if (entry.first == id_)
+        {
+            return entry.second;
+        }
+    }
+    {
+        // 缓存里的项不会被挤掉，挤掉的话再用这棵树时会注册第二条记录，原来那条的退休链表就没人回收了
+        // 第一次用这棵树时顺便清掉已经析构了的树，缓存的大小不超过还活着的树的个数
+        std::lock_guard<std::mutex> lock(registry_lock());
+        auto &entries = cache.entries;
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [](const std::pair<uint64_t, ThreadRecord *> &entry)
+                                     { return live_managers().count(entry.first) == 0; }),
+                      entries.end());
+    }
+    // 先接手退出了的线程留下的记录，没有的话再注册一条新的
+    ThreadRecord *record = nullptr;
+    for (ThreadRecord *free = records_.load(std::memory_order_acquire); free != nullptr; free = free->next)
+    {
+        bool owned = false;
+        if (!free->owned.load(std::memory_order_relaxed) && free->owned.compare_exchange_strong(owned, true, std::memory_order_acq_rel))
+        {
+            record = free;
+            break;
+        }
+    }
+    if (record == nullptr)
+    {
+        record = new ThreadRecord();
+        ThreadRecord *head = records_.load(std::memory_order_relaxed);
+        do
+        {
+            record->next = head;
+        } while (!records_.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+    }
+    cache.entries.emplace_back(id_, record);
+    return record;
+}
+
+void EpochManager::retire(void *ptr, void (*deleter)(void *, void *), void *context)
+{
+    ThreadRecord *record = local_record();
+    std::lock_guard<std::mutex> lock(record->retired_lock);
+    record->retired.push_back({ptr, deleter, context, global_epoch_.load(std::memory_order_seq_cst)});
+    if (record->pending() >= kReclaimThreshold)
+    {
+        reclaim(record, kReclaimPerRetire);
+    }
+}
+
+bool EpochManager::try_advance()
+{
+    uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+    for (ThreadRecord *record = records_.load(std::memory_order_acquire); record != nullptr; record = record->next)
+    {
+        uint64_t local = record->local_epoch.load(std::memory_order_seq_cst);
+        if (local != 0 && local != epoch)
+        {
+            return false; // 还有线程停在更早的epoch里
+        }
+    }
+    return global_epoch_.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+}
+
+void EpochManager::reclaim(ThreadRecord *record, std::size_t limit)
+{
+    uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+    if (record->retired[record->retired_head].epoch + 2 > epoch)
+    {
+        // 最早的那个都还不能释放，推进一下epoch，还有读者没离开的话等攒到两倍再试，避免每次retire都扫一遍线程记录
+        if (record->pending() < record->reclaim_at)
+        {
+            return;
+        }
+        if (try_advance())
+        {
+            reclaim_others(record);
+        }
+        epoch = global_epoch_.load(std::memory_order_seq_cst);
+        if (record->retired[record->retired_head].epoch + 2 > epoch)
+        {
+            record->reclaim_at = record->pending() * 2;
+            return;
+        }
+    }
+    record->reclaim_at = kReclaimThreshold;
+    release(record, epoch, limit);
+}
+
+void EpochManager::release(ThreadRecord *record, uint64_t epoch, std::size_t limit)
+{
+    // 退休时的epoch是从前往后递增的，碰到第一个还不能释放的就可以停了
+    std::vector<Retired> &retired = record->retired;
+    for (std::size_t freed = 0; freed < limit && record->retired_head < retired.size() && retired[record->retired_head].epoch + 2 <= epoch; freed++)
+    {
+        const Retired front = retired[record->retired_head++];
+        front.deleter(front.context, front.ptr);
+    }
+    // 头过了一半就把还没释放的挪到前面，每个对象平均只挪一次；全释放了直接清空，容量都留着
+    if (record->retired_head == retired.size())
+    {
+        retired.clear();
+        record->retired_head = 0;
+    }
+    else if (record->retired_head * 2 > retired.size())
+    {
+        retired.erase(retired.begin(), retired.begin() + record->retired_head);
+        record->retired_head = 0;
+    }
+}
+
+void EpochManager::reclaim_others(ThreadRecord *self)
+{
+    const uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+    for (ThreadRecord *record = records_.load(std::memory_order_acquire); record != nullptr; record = record->next)
+    {
+        if (record == self)
+        {
+            continue;
+        }
+        // 不等锁：那个线程正在retire的话它自己会回收
+        std::unique_lock<std::mutex> lock(record->retired_lock, std::try_to_lock);
+        if (lock.owns_lock())
+        {
+            release(record, epoch, kReclaimOthersPerRecord);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef EPOCH_MANAGER_H
+#define EPOCH_MANAGER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/***
+ * 基于epoch的内存回收(EBR)
+ * 读者不加锁，进入临界区时只把当前的全局epoch记到自己线程的记录里
+ * 写者把段、节点、键值对从树上摘下来之后不能马上delete，而是先retire挂到退休链表里
+ * 等所有还在临界区里的线程都已经看到更新的epoch之后(全局epoch比退休时至少大2)，才真正释放
+ * 每棵树一个EpochManager，线程第一次用到某棵树时注册一条线程记录，线程退出时把记录还回去，之后新来的线程接着用，
+ * 所以记录的条数不超过同时用过这棵树的线程数，记录到树析构时才释放
+ * 退休链表一般由自己的线程回收，推进了epoch的线程还会顺手回收别的线程链表里已经能释放的对象，
+ * 写者闲下来或者退出了，它攒下的对象也会被还在写的线程释放掉
+ */
+class EpochManager
+{
+private:
+    struct ThreadRecord;
+
+public:
+    // 临界区守卫，构造时进入，析构时离开，可以嵌套
+    class Guard
+    {
+    public:
+        explicit Guard(EpochManager *manager);
+        ~Guard();
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+    private:
+        ThreadRecord *record_;
+    };
+
+    EpochManager();
+    // 析构时不能再有线程处在临界区里，所有退休的对象都会在这里释放
+    ~EpochManager();
+    EpochManager(const EpochManager &) = delete;
+    EpochManager &operator=(const EpochManager &) = delete;
+
+    Guard pin() { return Guard(this); }
+    // ptr已经从树上摘下来了，等到没有读者能看到它时再调用deleter(context, ptr)释放
+    // context一般是对象所在的内存池
+    void retire(void *ptr, void (*deleter)(void *, void *), void *context);
+    template <typename T>
+    void retire(T *ptr)
+    {
+        retire(
+            ptr, [](void *, void *p)
+            { delete static_cast<T *>(p); },
+            nullptr);
+    }
+
+private:
+    struct Retired
+    {
+        void *ptr;
+        void (*deleter)(void *, void *);
+        void *context;
+        uint64_t epoch; // 退休时的全局epoch
+    };
+    struct ThreadRecord
+    {
+        std::atomic<uint64_t> local_epoch{0}; // 0表示不在临界区里
+        int nesting = 0;                      // 只有最外层的Guard会修改local_epoch
+        // 本线程退休的对象，按退休的先后排列，epoch也是从小到大的，[retired_head, size())是还没释放的
+        // 从头上释放只移动retired_head，过了一半再把后面的挪到前面，vector的容量一直留着，攒到过的最多个数以内retire不向堆要内存
+        std::vector<Retired> retired;
+        std::size_t retired_head = 0;
+        std::size_t pending() const { return retired.size() - retired_head; }
+        std::size_t reclaim_at = 64;          // 最早的对象还不能释放时，退休对象攒到这么多个再尝试推进epoch
+        std::mutex retired_lock;              // 保护retired、retired_head和reclaim_at，自己的线程之外只有推进epoch的线程会try_lock
+        std::atomic<bool> owned{true};        // 线程退出时置为false，之后注册的线程可以接着用这条记录
+        ThreadRecord *next = nullptr;
+    };
+    struct RecordCache;
+
+    // 获取当前线程在这棵树上的记录，第一次使用时接手一条没人用的记录或者注册一条新的
+    ThreadRecord *local_record();
+    // 所有在临界区里的线程都已经看到当前epoch时，全局epoch+1
+    bool try_advance();
+    // 从最早退休的开始，释放record里最多limit个已经没有读者能看到的对象，调用时要持有record->retired_lock
+    void reclaim(ThreadRecord *record, std::size_t limit);
+    // 释放record里最多limit个退休时的epoch+2<=epoch的对象，调用时要持有record->retired_lock
+    static void release(ThreadRecord *record, uint64_t epoch, std::size_t limit);
+    // 推进了epoch之后，回收别的线程链表里已经能释放的对象，拿不到锁的跳过
+    void reclaim_others(ThreadRecord *self);
+
+    const uint64_t id_; // 用来区分不同的EpochManager，地址会被复用所以不能用this
+    std::atomic<uint64_t> global_epoch_{1};
+    std::atomic<ThreadRecord *> records_{nullptr};
+};
+
+#endif // EPOCH_MANAGER_H
@@ -10,8 +10,15 @@
 #include <iostream>
 #include <optional>
 #include <variant>
+#include <algorithm>
+#include <numeric>
+#include <thread>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-uint8_t MERTNode::extract_subkey_segment(const std::string &key, int local_depth, int start)
+template <typename Config>
+uint8_t MERTNode<Config>::extract_subkey_segment(std::string_view key, int local_depth, int start) const
 {
     using ReturnType = uint8_t;
     // key只能是string类型
@@ -20,26 +27,53 @@ uint8_t MERTNode::extract_subkey_segment(const std::string &key, int local_depth
     {
         return static_cast<ReturnType>(0);
     }
-    // 取第start字符的最高位的 local_depth bits
+    // 取第start字符的段编码里最高的 local_depth bits
     uint8_t byte = static_cast<uint8_t>(key[start]); // 先取第start个字符
-    uint8_t lower_nibble = byte & 0x0F;              // 取后四位
-    uint8_t topBits = (lower_nibble >> (4 - local_depth)) & ((1 << local_depth) - 1);
+    uint8_t code = segment_code(byte);               // 按索引取法换成段编码
+    uint8_t topBits = code >> (8 - local_depth);
     return static_cast<ReturnType>(topBits);
 }
 
-uint8_t MERTNode::extract_subkey_bucket(const std::string &key, int num)
+template <typename Config>
+uint8_t MERTNode<Config>::extract_subkey_bucket(std::string_view key, int start) const
 {
     using ReturnType = uint8_t;
-    if (key.empty() || num == 0)
+    if (key.empty() || kBucketBits == 0)
     {
         return static_cast<ReturnType>(0);
     }
     uint8_t c = static_cast<uint8_t>(key[0]); // 先取第一个字符
-    uint8_t mask = (1 << num) - 1;
-    uint8_t result = c & mask;
+    uint8_t branch = start < key.size() ? static_cast<uint8_t>(key[start]) : 0;
+    constexpr uint8_t mask = static_cast<uint8_t>((1u << kBucketBits) - 1);
+    uint8_t result = IndexPolicy::bucket_byte(c, branch) & mask;
     return static_cast<ReturnType>(result);
 }
 
+template <typename Config>
+bool MERTNode<Config>::split_helps(const Bucket &bucket, uint8_t code, int start_pos) const
+{
+    // 段最多分到kMaxGlobalDepth位，这几位都一样的条目怎么分都在同一个段里
+    constexpr int shift = 8 - kMaxGlobalDepth;
+    for (const Bucket *bk = &bucket; bk != nullptr; bk = bk->overflow.load(std::memory_order_relaxed))
+    {
+        for (const auto &slot : bk->entries)
+        {
+            typename Bucket::EntryType entry = slot.load(std::memory_order_relaxed);
+            if (entry == 0)
+            {
+                continue;
+            }
+            // 子节点按它的分叉字节算，键值对按start_pos处的字节算
+            const uint8_t branch = Bucket::is_node(entry) ? Bucket::branch_of(entry) : static_cast<uint8_t>(Bucket::to_kv(entry)->first[start_pos]);
+            if ((segment_code(branch) >> shift) != (code >> shift))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 /***
  * 接下来要考虑一些变换节点的情况了
  * 首先键进入节点，查看该节点是否为空节点，
@@ -52,6 +86,7 @@ uint8_t MERTNode::extract_subkey_bucket(const std::string &key, int num)
  * 因为输入的key为uint64_t时是以十进制输入的，所以都会存入到索引为0000的段里
  * 造成段倾斜，把uint64_t转成string，再处理，但是因为转成string，它的ascii基本也是连续的，
  * 所以段的话就按照prefix后的第一个字节的后四位进行段的索引，然后prefix后的第一个字节的前四位作为进入桶后的排序索引
+ * (uint64_t的键现在可以用insert_u64/search_u64，按大端序直接存8个字节，不用再转成十进制字符串)
  *
  * 对于根节点，当在根节点中时，如果遇到了因为前缀完全不匹配而要添加新的节点的情况，这种情况只在根节点会出现
  * 因为当普通节点递增(指深度加深)
@@ -59,175 +94,178 @@ uint8_t MERTNode::extract_subkey_bucket(const std::string &key, int num)
  *
  ***/
 
-// 段分裂是一个段下的某个桶的键值对数量到达阈值且local_depth<global_Depth
+// 段分裂是一个段下的某个桶的键值对数量到达阈值且local_depth<kMaxGlobalDepth，local_depth已经等于global_depth的话先把目录翻倍
 // 然后要把桶里的数据给分散开来
 // 在一个段下的桶们，prefix后的第一个字节的后四位的前local_depth位相等
 // 而在一个段下的一个桶里的数据，除了上面的相等，它们的后8位也是相等的，桶索引和后八位有关
 // 数据在桶里索引和prefix后的第一个字节的前四位有关
-// 进行段分裂，首先获取对应的prefix下的锁，segment_index为要分裂的段的索引
-void MERTNode::split_segment(size_t segment_index, PrefixDirectory &directory, const uint16_t &global_depth)
+// 进行段分裂，首先获取对应的prefix下的锁，code为要分裂的段里的某个段编码
+template <typename Config>
+void MERTNode<Config>::split_segment(uint8_t code, PrefixDirectory &directory, int start_pos)
 {
-    // 因为段分裂是在insert情境下才会发生，所以这里只需要获得新段的锁即可
-    //  首先进行目录上锁
-    // std::unique_lock<std::shared_mutex> dir_lock(directory.prefix_lock);
+    // 段分裂要改写目录里的段指针，所以首先进行目录上锁
+    // 只挡住同一目录下的写者，读者不加锁，其他目录、其他节点也不受影响
+    std::unique_lock<WriterSharedMutex> dir_lock(directory.prefix_lock);
+    if (collapsed_)
+    {
+        return; // 本节点已经被合并回父节点了，调用者重新拿目录锁时会发现
+    }
 
-    // 获取要分裂的段
-    std::shared_ptr<Segment> old_segment = directory.segments[segment_index];
+    // 获取要分裂的段，持有目录写锁时目录不会再翻倍
+    DirectoryView view = directory.view();
+    Segment *old_segment = view.slot(code).load(std::memory_order_relaxed);
 
     if (!old_segment)
     {
         return;
     }
-    // 对原段上写锁，上锁的顺序是从上至下的：节点->目录->段->桶，这里对该前缀下的目录上锁即可，不影响其他目录
-    // std::unique_lock<std::shared_mutex> seg_lock(old_segment->seg_lock);
+    // 对原段上写锁，上锁的顺序是从上至下的：目录->段，持有目录写锁时其实已经没有别人持有段锁了
+    std::lock_guard<WriterMutex> seg_lock(old_segment->seg_lock);
 
-    if (old_segment->local_depth >= global_depth)
+    if (old_segment->local_depth >= kMaxGlobalDepth)
     {
         return;
-        // 当local_depth大于等于global_depth时(按理应该是只会等于)就会进行深度++，bucket放节点指针
+        // 目录已经翻倍到头了，调用者会生成子节点，bucket放节点指针
+    }
+    if (old_segment->local_depth == view.global_depth)
+    {
+        // 段已经只占一个目录项了，目录翻倍之后它占两项，再按新的一位分开
+        // 热的前缀在同一个节点里多分几位，不用马上多一层子节点
+        view = grow_directory(directory);
     }
     const uint8_t old_local_depth = old_segment->local_depth;
+    counters_->add(MERTCounter::SegmentSplit);
 
     // 创建两个新的段，local_depth+1
-    std::shared_ptr<MERTNode::Segment> new_segment0 = std::make_shared<MERTNode::Segment>();
-    std::shared_ptr<MERTNode::Segment> new_segment1 = std::make_shared<MERTNode::Segment>();
-
-    // 获取这两个段的锁
-    // std::unique_lock<std::shared_mutex> seg_lock0(new_segment0->seg_lock);
-    // std::unique_lock<std::shared_mutex> seg_lock1(new_segment1->seg_lock);
+    Segment *new_segment0 = arena_->create<Segment>();
+    Segment *new_segment1 = arena_->create<Segment>();
 
+    // 新段在替换进目录之前别的线程看不到，不需要上锁
     new_segment0->local_depth = old_local_depth + 1;
     new_segment1->local_depth = old_local_depth + 1;
 
-    int prefix_index_ = directory.prefix_index; // 从这个prefix后的第一个字节开始
+    // 此为该段的“实际下标”，即段编码的前old_local_depth位
+    const uint8_t old_segment_index = static_cast<uint8_t>(code >> (8 - old_local_depth));
 
-    // 此为该段的“实际下标”
-    uint8_t old_segment_index;
-
-    for (auto &old_bucket : old_segment->buckets)
+    for (std::size_t bucket_index = 0; bucket_index < kBucketCount; bucket_index++)
     {
-        // 这里要获取每个桶的锁
-        // std::unique_lock<std::shared_mutex> bucket_lock_(old_bucket.bucket_lock);
-        for (auto it = old_bucket.entries.begin(); it != old_bucket.entries.end(); it++)
+        // bucket的索引是不会变的，只是换了个段
+        // 键值对和子节点都只拷贝指针，读者在旧段里看到的还是同一份数据
+        for (Bucket *old_bucket = old_segment->buckets[bucket_index].load(std::memory_order_relaxed); old_bucket != nullptr;
+             old_bucket = old_bucket->overflow.load(std::memory_order_relaxed))
         {
-            // 因为桶有两种数据类型，所以先判断一下是键值对还是指针
-            // 如果桶里存放的是指针的话，先去查看该指针的第0个前缀字节，再根据该字节，再去重新分配到别的段里
-            if (*it)
+            for (int slot = 0; slot < Bucket::kCapacity; slot++)
             {
-                auto &entry = it->value();
-                if (std::holds_alternative<std::pair<std::string, std::string>>(entry))
+                // 因为桶有两种数据类型，所以先判断一下是键值对还是指针
+                // 如果桶里存放的是指针的话，先去查看该指针的第0个前缀字节，再根据该字节，再去重新分配到别的段里
+                typename Bucket::EntryType entry = old_bucket->entries[slot].load(std::memory_order_relaxed);
+                if (entry == 0)
+                {
+                    continue;
+                }
+                uint8_t new_segment_index = 0;
+                if (!Bucket::is_node(entry))
                 {
                     // 找到当前prefix的字节，段是从prefix后的第一个字节开始
                     // 段索引是该字节的后四位
-                    // 这里的bucket是直接取下标的，而不是重新计算
                     // 如果是键值对的话，获取键，该键是完整的键值对
-                    std::string key = std::get<std::pair<std::string, std::string>>(entry).first;
+                    const std::string &key = Bucket::to_kv(entry)->first;
                     // 这个是获取新的segment的index
-                    uint8_t new_segment_index = extract_subkey_segment(key, old_local_depth + 1, prefix_index_ + 1);
-                    old_segment_index = extract_subkey_segment(key, old_local_depth, prefix_index_ + 1); // 这里的old_segment_index按理来说是和下面的是一样的
-                    std::size_t new_bucket_index = std::distance(old_bucket.entries.begin(), it);        // bucket的索引是不会变的
-                    if (new_segment_index == old_segment_index * 2)
-                    {
-                        new_segment0->buckets[new_bucket_index].entries.push_back(entry);
-                    }
-                    else if (new_segment_index == old_segment_index * 2 + 1)
-                    {
-                        new_segment1->buckets[new_bucket_index].entries.push_back(entry);
-                    }
+                    new_segment_index = extract_subkey_segment(key, old_local_depth + 1, start_pos);
                 }
-                else if (std::holds_alternative<std::shared_ptr<MERTNode>>(entry))
+                else
                 {
-                    // 如果是指针的话，获取指针
-                    // 要获取一下独占锁，因为要更改node所在的位置
-                    std::shared_ptr<MERTNode> node = std::get<std::shared_ptr<MERTNode>>(entry);
-                    // std::unique_lock<std::shared_mutex> node_lock(node->node_lock_); // 给node上个写锁
-                    // 获取指针的第一个前缀
-                    MERTNode::PrefixDirectory &prefixDir = node->header.prefix[0];
-                    char firstPrefixByte = prefixDir.c;
+                    // 如果是指针的话，获取子节点的分叉字节(MERTNode的prefix[0]，或者紧凑节点的branch)
+                    // 它在节点挂到桶里之前就定了，之后不会再变，所以不需要锁子节点
+                    const char firstPrefixByte = static_cast<char>(Bucket::branch_of(entry));
                     // 获取字节后查看新的段索引
-                    std::string temp_str(1, firstPrefixByte);
-                    uint8_t new_segment_index = extract_subkey_segment(temp_str, old_local_depth + 1, 0);
-                    old_segment_index = extract_subkey_segment(temp_str, old_local_depth, 0);
-                    std::size_t new_bucket_index = std::distance(old_bucket.entries.begin(), it); // bucket的索引是不会变的
-                    if (new_segment_index == old_segment_index * 2)
-                    {
-                        new_segment0->buckets[new_bucket_index].entries.push_back(entry);
-                    }
-                    else if (new_segment_index == old_segment_index * 2 + 1)
-                    {
-                        new_segment1->buckets[new_bucket_index].entries.push_back(entry);
-                    }
+                    new_segment_index = extract_subkey_segment(std::string_view(&firstPrefixByte, 1), old_local_depth + 1, 0);
+                }
+                // 将key-value放入新的段中，指纹原样带过去
+                if (new_segment_index == old_segment_index * 2)
+                {
+                    put_entry(new_segment0, bucket_index, entry, old_bucket->fingerprint_at(slot));
+                }
+                else
+                {
+                    put_entry(new_segment1, bucket_index, entry, old_bucket->fingerprint_at(slot));
                 }
-                // 将key-value放入新的段中
             }
         }
         // 处理完old_segment的所有桶后，进行指针的更新
         // 更新的逻辑是，这里要先缩小再放大
         // 因为这里的逻辑是这十六个指针都是创建好的，之后的段分裂是更新段指针
-        // 这里是要从原来的段取出old_local_depth算得它的初始值，它分裂后按理是该初始值的两倍和两倍+1，但是要扩大到16的目录里，要算出它在16的目录里的最终值再放入
+        // 这里是要从原来的段取出old_local_depth算得它的初始值，它分裂后按理是该初始值的两倍和两倍+1，但是要扩大到整个目录里，要算出它在目录里的最终值再放入
     }
 
-    std::vector<int> resultZero;
-    std::vector<int> resultOne;
-    generate_new_segment_index(old_segment_index, old_local_depth, resultZero, resultOne);
-    for (int i = 0; i < resultZero.size(); i++)
+    // 目录里以old_segment_index*2开头的那些下标指向new_segment0，以old_segment_index*2+1开头的指向new_segment1
+    // 它们在目录里各是连续的一段，长度为2^(global_depth-old_local_depth-1)
+    const int span = view.size() >> (old_local_depth + 1);
+    const int first_zero = (old_segment_index * 2) * span;
+    for (int i = first_zero; i < first_zero + span; i++)
     {
-        directory.segments[resultZero[i]] = new_segment0;
+        view.slots[i].store(new_segment0, std::memory_order_release);
     }
-    for (int i = 0; i < resultOne.size(); i++)
+    for (int i = first_zero + span; i < first_zero + 2 * span; i++)
     {
-        directory.segments[resultOne[i]] = new_segment1;
+        view.slots[i].store(new_segment1, std::memory_order_release);
     } // 替换段指针即可
+    // 读者可能还在读旧段，交给EpochManager等读者都离开后再释放，这里只会释放段和桶，不会释放里面的数据
+    retire_segment(old_segment);
 }
 
-void MERTNode::generate_new_segment_index(int binaryNumber, int local_depth, std::vector<int> &resultZero, std::vector<int> &resultOne)
+template <typename Config>
+typename MERTNode<Config>::DirectoryView MERTNode<Config>::grow_directory(PrefixDirectory &directory)
 {
-    int diff = 3 - local_depth;
-
-    // 初始化temp_zero和temp_one
-    int temp_zero = binaryNumber << 1;
-    int temp_one = (binaryNumber << 1) + 1;
-
-    std::vector<int> currentZero{temp_zero};
-    std::vector<int> currentOne{temp_one};
-    // 进行3-local_depth循环
-    for (int i = 0; i < diff; i++)
+    const DirectoryView old_view = directory.view();
+    SegmentTable *table = create_table(arena_, old_view.global_depth + 1);
+    // 段编码多取一位，原来的第i项变成第2i和2i+1项，段和它的local_depth都不变，只是每个段占的目录项翻倍
+    for (int i = 0; i < old_view.size(); i++)
     {
-        std::vector<int> nextZero;
-        std::vector<int> nextOne;
-        // 对currentZero中的每个数添加0和1
-        for (int num : currentZero)
-        {
-            nextZero.push_back(num << 1);
-            nextZero.push_back((num << 1) + 1);
-        }
-        // 同理，对currentOne中的每个数添加0和1
-        for (int num : currentOne)
-        {
-            nextOne.push_back(num << 1);
-            nextOne.push_back((num << 1) + 1);
-        }
-        currentZero = nextZero;
-        currentOne = nextOne;
+        Segment *segment = old_view.slots[i].load(std::memory_order_relaxed);
+        table->slots[2 * i].store(segment, std::memory_order_relaxed);
+        table->slots[2 * i + 1].store(segment, std::memory_order_relaxed);
+    }
+    // 表填好之后再发布，读者可能还在读旧表(旧表里的段指针也都还有效)，交给EpochManager
+    SegmentTable *old_table = directory.table.exchange(table, std::memory_order_acq_rel);
+    if (old_table != nullptr)
+    {
+        retire_table(old_table);
     }
-    resultZero = currentZero;
-    resultOne = currentOne;
+    counters_->add(MERTCounter::DirectoryDoubling);
+    return DirectoryView{table->slots, table->global_depth};
 }
 
-// 二进制转十进制，这里的string是二进制的，而不是直接的string
-int MERTNode::binary_to_decimal(const std::string &binary_str)
+template <typename Config>
+void MERTNode<Config>::put_entry(Segment *segment, uint8_t bucket_index, typename Bucket::EntryType entry, uint8_t fingerprint)
 {
-    int decimal_value = 0;
-    int base = 1; // 2^0
-    for (int i = binary_str.length() - 1; i >= 0; i--)
+    Bucket *bucket = segment->buckets[bucket_index].load(std::memory_order_relaxed);
+    if (bucket == nullptr)
+    {
+        bucket = arena_->create<Bucket>();
+        bucket->put(0, entry, fingerprint);
+        segment->buckets[bucket_index].store(bucket, std::memory_order_release);
+        return;
+    }
+    while (true)
     {
-        if (binary_str[i] == '1')
+        int slot = bucket->first_free();
+        if (slot >= 0)
+        {
+            bucket->put(slot, entry, fingerprint);
+            return;
+        }
+        Bucket *next = bucket->overflow.load(std::memory_order_relaxed);
+        if (next == nullptr)
         {
-            decimal_value += base;
+            // 整条桶链都满了，挂一个溢出桶
+            next = arena_->create<Bucket>();
+            next->put(0, entry, fingerprint);
+            bucket->overflow.store(next, std::memory_order_release);
+            return;
         }
-        base *= 2;
+        bucket = next;
     }
-    return decimal_value;
 }
 
 /****
@@ -237,400 +275,3096 @@ int MERTNode::binary_to_decimal(const std::string &binary_str)
  * 这些key-value都存在最长公共前缀下的目录下
  *
  */
-void MERTNode::add_child_node(MERTNode *new_node, Bucket &bucket, int start_pos)
+template <typename Config>
+bool MERTNode<Config>::add_child_node(Bucket &bucket, int start_pos)
 {
-    // 这个new_node是新创建的节点
-    // std::unique_lock<std::shared_mutex> bucket_lock(bucket.bucket_lock);
-    std::vector<std::string> temp_key;
-    std::unordered_map<std::string, int> key2index;         // key和在原来的bucket的index的对应关系
-    std::unordered_map<std::string, std::string> key2value; // key和value的对应关系
-    for (auto it = bucket.entries.begin(); it != bucket.entries.end(); it++)
+    counters_->add(MERTCounter::ChildNodeCall);
+    // 只收集键值对的指针和它们的位置，不拷贝key和value，搬进子节点的键值对直接挂到子节点里
+    std::vector<KVPair *> kvs;
+    std::vector<std::string_view> keys;
+    std::vector<std::pair<Bucket *, int>> slots; // kvs[i]所在的桶和槽位
+    for (Bucket *bk = &bucket; bk != nullptr; bk = bk->overflow.load(std::memory_order_relaxed))
     {
-        if (it->has_value())
+        for (int slot = 0; slot < Bucket::kCapacity; slot++)
         {
-            auto &entry = it->value();
-            if (std::holds_alternative<std::pair<std::string, std::string>>(entry))
+            typename Bucket::EntryType entry = bk->entries[slot].load(std::memory_order_relaxed);
+            if (entry != 0 && !Bucket::is_node(entry))
             {
-                // 如果是键值对的话，把key放入到数组中
-                temp_key.push_back(std::get<std::pair<std::string, std::string>>(entry).first);
-                key2index[std::get<std::pair<std::string, std::string>>(entry).first] = std::distance(bucket.entries.begin(), it);
-                key2value[std::get<std::pair<std::string, std::string>>(entry).first] = std::get<std::pair<std::string, std::string>>(entry).second;
+                kvs.push_back(Bucket::to_kv(entry));
+                keys.push_back(kvs.back()->first);
+                slots.emplace_back(bk, slot);
             }
         }
     }
     // 获取得到的键数组的只要存在的最长前缀，从start_pos开始，因为前面的都是相同的
-    std::string common_prefix = longestCommonSubstringAmongTwo(temp_key, start_pos);
-    // 获取最长前缀的子串(上一个prefix之后的)，放入到longestCommonSubstringAmongTwo新节点的prefix中
-    // 然后再遍历字符串数组，如果完全匹配前缀的话就放入total_value,不是完全匹配的话就放入桶里
-    for (int i = 0; i < std::min(common_prefix.length(), static_cast<size_t>(6)); i++)
+    // common_prefix指向桶里某个键的内存，这些键值对在本函数返回之前都不会被释放
+    std::string_view common_prefix = longestCommonSubstringAmongTwo(keys, start_pos);
+    if (common_prefix.empty())
     {
-        new_node->header.prefix[i].c = common_prefix[i];
+        // 两两之间在start_pos处的字节都不相同，生成子节点也腾不出位置
+        return false;
     }
-    for (int i = 0; i < temp_key.size(); i++)
+    // start_pos处的字节和公共前缀的第一个字节相同的键都搬进子节点，其余的留在桶里
+    // 子节点的指纹就是这个字节
+    const uint8_t child_fingerprint = static_cast<uint8_t>(common_prefix[0]);
+    std::vector<int> moved;
+    std::vector<KVPair *> child_kvs;
+    for (int i = 0; i < kvs.size(); i++)
     {
-        bool not_this_node = false;
-        insert_to_new_node(new_node, temp_key[i], key2value[temp_key[i]], start_pos, not_this_node);
-        if (not_this_node)
+        if (static_cast<uint8_t>(keys[i][start_pos]) == child_fingerprint)
         {
-            // 说明是完全插入不进去下一层节点中，继续留在该bucket中
-            continue;
+            moved.push_back(i);
+            child_kvs.push_back(kvs[i]);
+        }
+    }
+    // 键不多的话先存成紧凑节点，键值对直接挂过去
+    // 多的话建MERTNode，读者可能还在读这些键值对，完全匹配在prefix上的键的value只能拷进total_value
+    std::vector<bool> adopted(child_kvs.size(), true);
+    typename Bucket::EntryType child;
+    if (child_kvs.size() <= kCompactCapacity)
+    {
+        std::vector<KVPair *> sorted(child_kvs);
+        std::sort(sorted.begin(), sorted.end(), [](const KVPair *a, const KVPair *b)
+                  { return a->first < b->first; });
+        CompactNode *compact = create_compact(arena_, child_fingerprint, static_cast<int>(sorted.size()));
+        for (std::size_t i = 0; i < sorted.size(); i++)
+        {
+            compact->entries()[i] = sorted[i];
+            compact->fingerprints[i] = Bucket::key_fingerprint(sorted[i]->first);
+        }
+        child = Bucket::from_compact(compact);
+    }
+    else
+    {
+        child = Bucket::from_node(build_child(child_kvs, start_pos, adopted));
+    }
+    // 先把新节点放到最后一个被移走的位置上，再把前面被移走的位置清空
+    // 读者是从前往后扫桶的，这样读者要么看到原来的键值对，要么一定能在后面看到新节点
+    // 读者用的是指纹和位图的快照，可能刚好错过，所以搬动前后都要改版本号，读者没找到时会重新找
+    // moved是按桶链里的位置收集的，本来就是从前往后的顺序
+    bucket.version.fetch_add(1, std::memory_order_acq_rel);
+    for (int j = static_cast<int>(moved.size()) - 1; j >= 0; j--)
+    {
+        Bucket *bk = slots[moved[j]].first;
+        int slot = slots[moved[j]].second;
+        if (j + 1 == static_cast<int>(moved.size()))
+        {
+            bk->put(slot, child, child_fingerprint);
         }
         else
         {
-            // 说明可以插入到下一层节点中，那先把这个bucket中该entry去除
-            bucket.entries[key2index[temp_key[i]]] = std::nullopt;
+            bk->erase(slot);
+        }
+        // 挂进子节点的键值对归子节点了，只有value被拷进total_value的那些才要回收
+        if (!adopted[j])
+        {
+            retire(child_kvs[j]);
         }
     }
+    bucket.version.fetch_add(1, std::memory_order_release);
+    return true;
 }
 
-void MERTNode::insert_to_new_node(MERTNode *new_node, const std::string &key, const std::string &value, int start_pos, bool &not_this_node)
+template <typename Config>
+MERTNode<Config> *MERTNode<Config>::build_child(const std::vector<KVPair *> &kvs, int start_pos, std::vector<bool> &adopted)
 {
-    // start_pos是下标
-    // std::unique_lock<std::shared_mutex> node_lock(new_node->node_lock_); // 先上锁吧
-    int key_index = start_pos;
-    // prefix和key匹配的长度
-    int prefix_index_ = 0;
-    // 求得前缀的有效长度
-    int prefix_index_len = 0;
-    // 首先查看一下这个node的prefix是多长
-    while (prefix_index_len < 6 && new_node->header.prefix[prefix_index_len].c != 0)
+    // 这个节点挂到桶里之前别的线程看不到
+    MERTNode *child = arena_->create<MERTNode>(epoch_, arena_, counters_, value_log_);
+    // 排好序之后，两两之间最长的公共前缀一定出现在相邻的两个键之间
+    std::vector<std::string_view> keys;
+    for (const KVPair *kv : kvs)
+    {
+        keys.push_back(kv->first);
+    }
+    std::sort(keys.begin(), keys.end());
+    std::string_view common_prefix;
+    for (std::size_t i = 1; i < keys.size(); i++)
+    {
+        std::string_view current = longestCommonSubstringBetweenTwo(keys[i - 1], keys[i], start_pos);
+        if (current.length() > common_prefix.length())
+        {
+            common_prefix = current;
+        }
+    }
+    // 最长公共前缀(上一个prefix之后的)整个放入新节点的prefix中，超出kPrefixLength的放到节点外，然后再把键值对逐个放进去
+    // 完全匹配前缀的放入total_value，不是完全匹配的放入对应目录的桶里
+    child->extend_prefix(common_prefix);
+    for (std::size_t i = 0; i < kvs.size(); i++)
+    {
+        bool not_this_node = false;
+        adopted[i] = insert_to_new_node(child, kvs[i], start_pos, not_this_node, false);
+    }
+    return child;
+}
+
+template <typename Config>
+bool MERTNode<Config>::insert_to_compact(Bucket &bucket, int slot, KVPair *kv, uint8_t fingerprint)
+{
+    CompactNode *compact = Bucket::to_compact(bucket.entries[slot].load(std::memory_order_relaxed));
+    const int index = compact->find(kv->first, fingerprint);
+    CompactNode *updated;
+    if (index >= 0)
+    {
+        // key已经在里面了，换成新的键值对
+        updated = create_compact(arena_, compact->branch, compact->count);
+        std::memcpy(updated->fingerprints, compact->fingerprints, sizeof(compact->fingerprints));
+        std::copy(compact->entries(), compact->entries() + compact->count, updated->entries());
+        updated->entries()[index] = kv;
+    }
+    else
+    {
+        if (compact->count >= kCompactCapacity)
+        {
+            return false;
+        }
+        const int pos = compact->lower_bound(kv->first);
+        updated = create_compact(arena_, compact->branch, compact->count + 1);
+        std::copy(compact->entries(), compact->entries() + pos, updated->entries());
+        std::copy(compact->fingerprints, compact->fingerprints + pos, updated->fingerprints);
+        updated->entries()[pos] = kv;
+        updated->fingerprints[pos] = fingerprint;
+        std::copy(compact->entries() + pos, compact->entries() + compact->count, updated->entries() + pos + 1);
+        std::copy(compact->fingerprints + pos, compact->fingerprints + compact->count, updated->fingerprints + pos + 1);
+    }
+    // 读者读到的要么是旧的紧凑节点，要么是新的，旧的连同被换掉的键值对都交给EpochManager
+    bucket.entries[slot].store(Bucket::from_compact(updated), std::memory_order_release);
+    if (index >= 0)
+    {
+        KVPair *old_kv = compact->entries()[index];
+        release_value(old_kv->second);
+        retire(old_kv);
+    }
+    retire_compact(compact);
+    return true;
+}
+
+/***
+ * 锁的顺序：调用方持有父节点段的写锁，build_child在这把锁下面又会拿新节点的节点锁、目录锁和段锁
+ * 别的路径都是先放掉父节点的锁再进入子节点，唯独这里是父节点->子节点嵌套的，不会死锁只是因为子节点还没挂到槽位上，
+ * 除了这个线程没人能拿到它的锁；挂上去之后不能再在父节点的段锁下拿子节点的锁
+ * 节点和段的内存会被内存池复用，TSan按地址认锁，会把复用前后的锁当成同一把，报出lock-order-inversion，是误报
+ */
+template <typename Config>
+MERTNode<Config> *MERTNode<Config>::promote_compact(Bucket &bucket, int slot, int start_pos)
+{
+    CompactNode *compact = Bucket::to_compact(bucket.entries[slot].load(std::memory_order_relaxed));
+    std::vector<KVPair *> kvs(compact->entries(), compact->entries() + compact->count);
+    std::vector<bool> adopted(kvs.size(), false);
+    MERTNode *child = build_child(kvs, start_pos, adopted);
+    // 新节点里已经有了所有的键，读者不管读到旧的紧凑节点还是新节点都能找到，不用改版本号
+    bucket.entries[slot].store(Bucket::from_node(child), std::memory_order_release);
+    for (std::size_t i = 0; i < kvs.size(); i++)
+    {
+        if (!adopted[i])
+        {
+            retire(kvs[i]);
+        }
+    }
+    retire_compact(compact);
+    counters_->add(MERTCounter::CompactPromotion);
+    return child;
+}
+
+template <typename Config>
+bool MERTNode<Config>::erase_from_compact(Segment *segment, uint8_t bucket_index, Bucket &bucket, int slot, std::string_view key, uint8_t fingerprint)
+{
+    CompactNode *compact = Bucket::to_compact(bucket.entries[slot].load(std::memory_order_relaxed));
+    const int index = compact->find(key, fingerprint);
+    if (index < 0)
     {
-        prefix_index_len++;
+        return false;
     }
-    // 然后查看key和prefix的最长匹配
-    while (key_index < key.length() && prefix_index_ < prefix_index_len && key[key_index] == new_node->header.prefix[prefix_index_].c)
+    const int remaining = compact->count - 1;
+    Bucket *head = segment->buckets[bucket_index].load(std::memory_order_relaxed);
+    std::size_t free_slots = 0;
+    for (Bucket *bk = head; bk != nullptr; bk = bk->overflow.load(std::memory_order_relaxed))
     {
-        key_index++;
-        prefix_index_++;
+        free_slots += __builtin_popcount(~bk->bitmap.load(std::memory_order_relaxed) & Bucket::kSlotMask);
     }
-    if (prefix_index_len == 0 && prefix_index_ == 0)
+    if (remaining <= kCollapseThreshold && static_cast<std::size_t>(remaining) <= free_slots + 1)
     {
-        // 空节点，把key从start_pos开始赋值给prefix
-        int will_len = std::min(key.length() - start_pos, static_cast<size_t>(6));
-        if (will_len == key.length() - start_pos)
+        // 剩下的键值对直接放回父桶，最后一个放不下的话放在紧凑节点的槽位上，否则清空这个槽位
+        // 和collapse_child一样前后改版本号，让没找到的读者重新找
+        head->version.fetch_add(1, std::memory_order_acq_rel);
+        int placed = 0;
+        for (int i = 0; i < compact->count; i++)
         {
-            // 能放得下prefix中，所以value直接放入total_value中
-            for (int i = start_pos; i < will_len + start_pos; i++)
+            if (i == index)
             {
-                new_node->header.prefix[i - start_pos].c = key[i];
+                continue;
             }
-            new_node->total_value[will_len - 1] = value;
-            return; // 已经存好了，所以直接return
+            KVPair *kv = compact->entries()[i];
+            placed++;
+            if (placed == remaining && free_slots < static_cast<std::size_t>(remaining))
+            {
+                bucket.put(slot, Bucket::from_kv(kv), compact->fingerprints[i]);
+            }
+            else
+            {
+                put_entry(segment, bucket_index, Bucket::from_kv(kv), compact->fingerprints[i]);
+            }
+        }
+        if (free_slots >= static_cast<std::size_t>(remaining))
+        {
+            bucket.erase(slot);
+        }
+        head->version.fetch_add(1, std::memory_order_release);
+        counters_->add(MERTCounter::ChildCollapse);
+    }
+    else
+    {
+        CompactNode *updated = create_compact(arena_, compact->branch, remaining);
+        std::copy(compact->entries(), compact->entries() + index, updated->entries());
+        std::copy(compact->fingerprints, compact->fingerprints + index, updated->fingerprints);
+        std::copy(compact->entries() + index + 1, compact->entries() + compact->count, updated->entries() + index);
+        std::copy(compact->fingerprints + index + 1, compact->fingerprints + compact->count, updated->fingerprints + index);
+        bucket.entries[slot].store(Bucket::from_compact(updated), std::memory_order_release);
+    }
+    // 读者可能还在读删掉的键值对和旧的紧凑节点，交给EpochManager
+    KVPair *erased = compact->entries()[index];
+    release_value(erased->second);
+    retire(erased);
+    retire_compact(compact);
+    return true;
+}
+
+template <typename Config>
+typename MERTNode<Config>::PrefixView MERTNode<Config>::prefix_view() const
+{
+    // 写者先发布tail再发布prefix_length，读到节点里已经满了的话，读到的tail至少是和这个长度配套的那一份
+    PrefixView prefix;
+    prefix.node = this;
+    prefix.length = header.prefix_length.load(std::memory_order_acquire);
+    if (prefix.length == kPrefixLength)
+    {
+        prefix.tail = header.tail.load(std::memory_order_acquire);
+        if (prefix.tail != nullptr)
+        {
+            prefix.length += prefix.tail->length;
+        }
+    }
+    return prefix;
+}
+
+namespace
+{
+#if defined(__SSE2__)
+    // 读data开始的count(不超过16)个字节，不满16个的先拷到栈上，不会读到key或者tail后面去
+    inline __m128i load_bytes(const char *data, int count)
+    {
+        if (count == 16)
+        {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
         }
-        else if (will_len < key.length() - start_pos)
+        char buffer[16] = {0};
+        std::memcpy(buffer, data, count);
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer));
+    }
+
+    // a和b的前count个字节里有几个是从头开始相同的：不相等的字节在掩码里是1，再把第count位也置1，最低的1就是答案
+    inline int common_length(__m128i a, __m128i b, int count)
+    {
+        const uint32_t differ = (~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) & 0xFFFF) | (1u << count);
+        return __builtin_ctz(differ);
+    }
+#endif
+
+    // a和b从头开始有几个字节相同，最多比较limit个，两边都至少有limit个字节可读
+    inline int common_length(const char *a, const char *b, int limit)
+    {
+        int matched = 0;
+#if defined(__SSE2__)
+        // 一次比较16个字节，整段都相同才接着比下一段
+        while (matched < limit)
         {
-            // 先把能放的放进去，即6个字节放进prefix中
-            for (int i = start_pos; i < start_pos + 6; i++)
+            const int count = std::min(16, limit - matched);
+            const int same = common_length(load_bytes(a + matched, count), load_bytes(b + matched, count), count);
+            matched += same;
+            if (same < count)
             {
-                new_node->header.prefix[i - start_pos].c = key[i];
+                break;
             }
-            // 这种prefix存不下的，所以要存放在最后一个prefix下的段桶里
-            // 这里start_pos+6是指prefix后的第一个字节，6是指它放在prefix[5]的目录中
-            insert_to_segment_bucket(new_node, key, value, start_pos + 6, 5);
-            return; // 插入结束
         }
+#else
+        while (matched < limit && a[matched] == b[matched])
+        {
+            matched++;
+        }
+#endif
+        return matched;
     }
-    else if (prefix_index_len != 0 && prefix_index_ == 0)
+}
+
+template <typename Config>
+int MERTNode<Config>::match_prefix(std::string_view key, int &key_index, PrefixView &prefix) const
+{
+    // 首先查看一下这个node的prefix是多长，写者是按顺序往后扩展prefix的，发布的长度之内的字节都已经写好了
+    prefix = prefix_view();
+    // 然后查看key和prefix的最长匹配，节点里的字节按字连续存放，节点外的是连续的字节
+    const char *rest = key.data() + key_index;
+    const int remaining = static_cast<int>(key.length() - key_index);
+    const int inline_limit = std::min({prefix.length, kPrefixLength, remaining});
+    int matched = 0;
+#if defined(__SSE2__)
+    // 两个字正好是一个128位寄存器，默认配置的prefix只有一个字，一条比较就出结果
+    for (int word = 0; matched < inline_limit; word += 2)
     {
-        // 这种是完全不匹配，需要新创建节点
-        not_this_node = true;
-        return;
+        const uint64_t low = header.prefix_words[word].load(std::memory_order_relaxed);
+        const uint64_t high = word + 1 < kPrefixWords ? header.prefix_words[word + 1].load(std::memory_order_relaxed) : 0;
+        const int count = std::min(16, inline_limit - matched);
+        const int same = common_length(load_bytes(rest + matched, count), _mm_set_epi64x(static_cast<long long>(high), static_cast<long long>(low)), count);
+        matched += same;
+        if (same < count)
+        {
+            break;
+        }
+    }
+#else
+    while (matched < inline_limit && rest[matched] == prefix_byte(matched))
+    {
+        matched++;
     }
-    else if (prefix_index_ != 0 && prefix_index_ < prefix_index_len && key_index <= key.length() - 1)
+#endif
+    if (matched == kPrefixLength && prefix.tail != nullptr)
     {
-        if (key_index == key.length() - 1)
+        const int limit = static_cast<int>(std::min<std::size_t>(prefix.tail->length, remaining - matched));
+        matched += common_length(rest + matched, prefix.tail->bytes(), limit);
+    }
+    key_index += matched;
+    return matched;
+}
+
+template <typename Config>
+void MERTNode<Config>::extend_prefix(std::string_view bytes)
+{
+    int length = header.prefix_length.load(std::memory_order_relaxed);
+    std::size_t used = 0;
+    for (; length < kPrefixLength && used < bytes.size(); length++, used++)
+    {
+        // 长度之后的字节都还是0，或上去就行，只有持有节点写锁的写者会改
+        std::atomic<uint64_t> &word = header.prefix_words[length / 8];
+        word.store(word.load(std::memory_order_relaxed) | uint64_t(static_cast<uint8_t>(bytes[used])) << (8 * (length % 8)), std::memory_order_relaxed);
+    }
+    if (used < bytes.size())
+    {
+        // 节点里放满了，剩下的接到节点外，旧的那份可能还有读者在读，拷一份加长的换上去
+        PrefixTail *old_tail = header.tail.load(std::memory_order_relaxed);
+        const uint32_t old_length = old_tail == nullptr ? 0 : old_tail->length;
+        const uint32_t level_count = old_tail == nullptr ? 0 : old_tail->level_count;
+        PrefixTail *tail = create_tail(arena_, old_length + static_cast<uint32_t>(bytes.size() - used), level_count);
+        if (old_tail != nullptr)
         {
-            // 完全匹配，直接赋值
-            new_node->total_value[prefix_index_ - 1] = value;
-            return;
+            std::copy(old_tail->levels(), old_tail->levels() + level_count, tail->levels());
+            std::memcpy(tail->bytes(), old_tail->bytes(), old_length);
         }
-        else if (key_index < key.length() - 1)
+        std::memcpy(tail->bytes() + old_length, bytes.data() + used, bytes.size() - used);
+        header.tail.store(tail, std::memory_order_release);
+        if (old_tail != nullptr)
         {
-            // 不完全匹配，放入桶里
-            insert_to_segment_bucket(new_node, key, value, key_index , prefix_index_);
-            return;
+            retire_tail(old_tail);
         }
     }
-    else if (prefix_index_ != 0 && prefix_index_ == prefix_index_len && key_index <= key.length() - 1)
+    header.prefix_length.store(static_cast<uint8_t>(length), std::memory_order_release);
+}
+
+template <typename Config>
+typename MERTNode<Config>::PrefixLevel *MERTNode<Config>::add_level(int level)
+{
+    PrefixTail *old_tail = header.tail.load(std::memory_order_relaxed);
+    if (PrefixLevel *found = old_tail->find(level))
     {
+        return found;
+    }
+    // 和扩展prefix一样拷一份，按位置插进去，已经分配的PrefixLevel新旧两份共用
+    PrefixLevel *added = arena_->create<PrefixLevel>(level);
+    PrefixTail *tail = create_tail(arena_, old_tail->length, old_tail->level_count + 1);
+    const typename PrefixTail::LevelRef *first = old_tail->levels();
+    const typename PrefixTail::LevelRef *last = first + old_tail->level_count;
+    const typename PrefixTail::LevelRef *position = std::lower_bound(first, last, level, [](const typename PrefixTail::LevelRef &ref, int value)
+                                                                     { return static_cast<int>(ref.position) < value; });
+    typename PrefixTail::LevelRef *out = std::copy(first, position, tail->levels());
+    *out++ = typename PrefixTail::LevelRef{static_cast<uint32_t>(level), added};
+    std::copy(position, last, out);
+    std::memcpy(tail->bytes(), old_tail->bytes(), old_tail->length);
+    header.tail.store(tail, std::memory_order_release);
+    retire_tail(old_tail);
+    return added;
+}
+
+template <typename Config>
+typename MERTNode<Config>::PrefixDirectory &MERTNode<Config>::directory_for_write(int level)
+{
+    return level < kPrefixLength ? header.prefix[level] : add_level(level)->directory;
+}
+
+template <typename Config>
+std::atomic<std::string *> &MERTNode<Config>::total_value_for_write(int level)
+{
+    return level < kPrefixLength ? total_value[level] : add_level(level)->total_value;
+}
 
-        if (key_index == key.length() - 1)
+template <typename Config>
+bool MERTNode<Config>::insert_to_new_node(MERTNode *new_node, KVPair *kv, int start_pos, bool &not_this_node, bool movable)
+{
+    // start_pos是下标
+    // 先拿节点的读锁比较prefix，只有要扩展prefix或者写total_value时才换成写锁
+    // 进入目录时已经放掉了节点锁，如果要进入子节点，就从子节点继续往下走
+    // 走到的子节点可能被erase合并回了父节点，这时要从new_node重新开始
+    const std::string_view key = kv->first;
+    MERTNode *node = new_node;
+    const int root_pos = start_pos;
+    while (node != nullptr)
+    {
+        int key_index = start_pos;
+        // prefix和key匹配的长度
+        int prefix_index_ = 0;
+        // 匹配时读到的prefix
+        PrefixView prefix;
+        {
+            std::shared_lock<WriterSharedMutex> node_lock(node->node_lock_);
+            if (node->collapsed_)
+            {
+                node = new_node;
+                start_pos = root_pos;
+                continue;
+            }
+            prefix_index_ = node->match_prefix(key, key_index, prefix);
+        }
+        if (prefix.length != 0 && prefix_index_ == 0)
         {
-            new_node->total_value[prefix_index_ - 1] = value;
-            return; // 直接放入total_value
+            // 这种是完全不匹配，需要新创建节点
+            not_this_node = true;
+            return false;
         }
-        else if (key_index < key.length() - 1)
+        if (key_index == key.length() || prefix_index_ == prefix.length || prefix.directory(prefix_index_ - 1) == nullptr)
         {
-            // 再看prefix能不能继续放，能的话就放，不能的话就进入桶
-            if (prefix_index_ == 6)
+            // 要写total_value、扩展prefix或者在节点外的位置上分配目录，换成写锁后重新匹配一次，因为别的线程可能已经扩展了prefix
+            std::unique_lock<WriterSharedMutex> node_lock(node->node_lock_);
+            if (node->collapsed_)
             {
-                // 说明不能放了。需要放入桶中
-                // 这个也是放入prefix[5]的桶里
-                insert_to_segment_bucket(new_node, key, value, key_index , 5);
-                return;
+                node = new_node;
+                start_pos = root_pos;
+                continue;
             }
-            else if (prefix_index_ < 6)
+            key_index = start_pos;
+            prefix_index_ = node->match_prefix(key, key_index, prefix);
+            if (prefix_index_ == prefix.length && key_index < key.length())
             {
-                // 能放的话就继续放
-                int maybe_len = std::min(key.length() - key_index, static_cast<size_t>(6 - prefix_index_));
-                for (int i = prefix_index_; i < maybe_len; i++)
-                {
-                    new_node->header.prefix[i].c = key[key_index];
-                    key_index++;
-                }
-                // 然后继续判断
-                if (key_index == key.length() - 1)
-                {
-                    new_node->total_value[prefix_index_ - 1] = value;
-                    return; // 直接放入total_value
-                }
-                else if (key_index < key.length() - 1)
+                // 空节点，或者key匹配完了整个prefix但还有剩余，就把key剩下的部分都接到prefix后面(节点里放不下的放到节点外)
+                // 此时prefix最后一个字节的目录里一定还是空的，因为之前这样的key都会先接到prefix后面
+                node->extend_prefix(key.substr(key_index));
+                prefix_index_ += static_cast<int>(key.length()) - key_index;
+                key_index = static_cast<int>(key.length());
+            }
+            if (key_index == key.length())
+            {
+                // 完全匹配到prefix[prefix_index_ - 1]，直接放入total_value，旧值可能还有读者在读，交给EpochManager
+                std::string *new_value = movable ? arena_->create<std::string>(std::move(kv->second)) : arena_->create<std::string>(kv->second);
+                std::string *old_value = node->total_value_for_write(prefix_index_ - 1).exchange(new_value, std::memory_order_acq_rel);
+                if (old_value != nullptr)
                 {
-                    // 进入桶
-                    // 说明key很长，继续放入prefix[5]的桶里
-                    insert_to_segment_bucket(new_node, key, value, key_index, 5);
+                    release_value(*old_value);
+                    retire(old_value);
                 }
+                return false;
             }
+            // 节点外的这个位置第一次有键分叉，先分配它的目录
+            node->directory_for_write(prefix_index_ - 1);
+        }
+        // key比匹配到的prefix更长，是在prefix没匹配完的地方分叉了
+        // 放入prefix[prefix_index_ - 1]的段桶里，段索引取的是key_index这个字节
+        MERTNode *next = insert_to_segment_bucket(node, kv, key_index, prefix_index_ - 1);
+        if (next == nullptr)
+        {
+            return true;
         }
+        if (next == node)
+        {
+            node = new_node;
+            start_pos = root_pos;
+            continue;
+        }
+        node = next;
+        // 子节点的prefix从key_index开始
+        start_pos = key_index;
     }
+    return false; // 走不到这里，insert_to_segment_bucket返回的子节点不会为空
 }
 
-void MERTNode::insert_to_segment_bucket(MERTNode *this_node, const std::string &key, const std::string &value, int start_pos, int directory_index)
+template <typename Config>
+MERTNode<Config> *MERTNode<Config>::insert_to_segment_bucket(MERTNode *this_node, KVPair *kv, int start_pos, int directory_index)
 {
     /***
      * 进入段桶的逻辑是，根据，prefix后的第一个字节的前local_depth位,
      * 先查看local_depth是否为0，如果是0的话就分裂为2，如果不是的话就从1开始
-     * 找段索引的逻辑是，直接获取4位的local_depth的值,然后获取segment的指针
+     * 找段索引的逻辑是，先算出8位的段编码，按目录当前的global_depth取前几位,然后获取segment的指针
+     * 写者上锁的顺序是 目录->段，先持有目录的读锁拿到段，再持有段锁修改桶
+     * 对读者可见的修改都是原子地写一个槽位或者替换一个指针
      */
-    uint8_t segment_index = extract_subkey_segment(key, 4, start_pos);
-    uint8_t segment_local_depth = this_node->header.prefix[directory_index].segments[segment_index]->local_depth;
-    uint8_t bucket_index = extract_subkey_bucket(key, 8);
+    const std::string_view key = kv->first;
+    PrefixDirectory &directory = this_node->directory_at(directory_index);
+    const uint8_t code = extract_subkey_segment(key, 8, start_pos);
+    uint8_t bucket_index = extract_subkey_bucket(key, start_pos);
+    const uint8_t fingerprint = Bucket::key_fingerprint(key);
 
-    if (segment_local_depth == 0)
+    while (true)
     {
-        std::shared_ptr<MERTNode::Segment> new_segment = std::make_shared<MERTNode::Segment>();
-        // 说明是第一个插入该node的(0~7目录或8~15目录)key-value，查看后四位local_depth的第一位是0还是1
-        // 0的话0-7设为该segment指针，1的话8-15设为该segment指针
-        uint8_t first_num = extract_subkey_segment(key, 1, start_pos);
-        // 后8位为桶索引
-        new_segment->buckets[bucket_index].entries.push_back(std::make_pair(key, value));
-        if (first_num == 0)
+        std::shared_lock<WriterSharedMutex> dir_lock(directory.prefix_lock);
+        if (this_node->collapsed_)
         {
-            // 因为这里是第一个，所以直接push_back即可
-            // 0~7都需要插入该segment
-            for (int i = 0; i < 8; i++)
-            {
-                this_node->header.prefix[directory_index].segments[i] = new_segment;
-                this_node->header.prefix[directory_index].segments[i]->local_depth += 1; // 记得这里要+1啊
-            }
+            return this_node;
         }
-        else if (first_num == 1)
+        // 持有目录读锁时目录不会翻倍
+        Segment *segment = directory.view().slot(code).load(std::memory_order_acquire);
+        uint8_t segment_local_depth = segment->local_depth;
+
+        if (segment_local_depth == 0)
         {
-            // 8~15都需要插入该segment
-            for (int i = 8; i < 16; i++)
+            // 要改写目录里的段指针，换成目录写锁，换锁期间别的线程可能已经建好了段，所以要重新判断
+            dir_lock.unlock();
+            std::unique_lock<WriterSharedMutex> dir_write_lock(directory.prefix_lock);
+            const DirectoryView view = directory.view();
+            if (this_node->collapsed_ || view.slot(code).load(std::memory_order_relaxed)->local_depth != 0)
+            {
+                continue;
+            }
+            Segment *new_segment = arena_->create<Segment>();
+            // 说明是第一个插入该node的(前一半目录或后一半目录)key-value，查看段索引的第一位是0还是1
+            // 0的话前一半设为该segment指针，1的话后一半设为该segment指针
+            uint8_t first_num = extract_subkey_segment(key, 1, start_pos);
+            new_segment->local_depth = 1;
+            // 后8位为桶索引，因为这里是第一个，所以直接放进去即可
+            put_entry(new_segment, bucket_index, Bucket::from_kv(kv), fingerprint);
+            // 原来指向的是共享的空段，它永远不会被释放，所以直接替换即可
+            const int half = view.size() / 2;
+            for (int i = first_num * half; i < first_num * half + half; i++)
             {
-                this_node->header.prefix[directory_index].segments[i] = new_segment;
-                this_node->header.prefix[directory_index].segments[i]->local_depth += 1;
+                view.slots[i].store(new_segment, std::memory_order_release);
             }
+            return nullptr;
         }
-    }
-    else
-    {
+
         // 如果local_depth不为0的话，就要查看该segment下的桶是否已满
         // 逻辑是查看该segment下的桶是否已满，如果已满的话就要段分裂，如果段分裂都还是满的话需要继续add_new_node
         // 插入的逻辑是查看是否有bucket存放的是节点，如果是节点查看会不会更加匹配，如果会的话就继续存入这个节点里
         // 如果不会的话就存放在空的entry中
-        int first_empty_index = -1;
-        auto &entries = this_node->header.prefix[directory_index].segments[segment_index]->buckets[bucket_index].entries;
-        for (auto it = entries.begin(); it != entries.end(); ++it)
+        std::unique_lock<WriterMutex> seg_lock(segment->seg_lock);
+        Bucket *bucket = segment->buckets[bucket_index].load(std::memory_order_relaxed);
+        if (bucket == nullptr)
         {
-            if (it->has_value())
+            // 这个桶还没分配过，直接放进去
+            put_entry(segment, bucket_index, Bucket::from_kv(kv), fingerprint);
+            return nullptr;
+        }
+        // 子节点和键值对分开比较指纹：子节点比的是start_pos处的字节，键值对比的是key的指纹
+        // 持有段锁时指纹和槽位是一致的，候选里只需要再比较一次完整的key
+        Bucket *free_bucket = nullptr;
+        int free_slot = -1;
+        for (Bucket *bk = bucket; bk != nullptr; bk = bk->overflow.load(std::memory_order_relaxed))
+        {
+            uint32_t nodes = bk->match(static_cast<uint8_t>(key[start_pos]), true);
+            if (nodes != 0)
             {
-                auto &entry = it->value();
-                if (std::holds_alternative<std::shared_ptr<MERTNode>>(entry))
+                const int slot = __builtin_ctz(nodes);
+                typename Bucket::EntryType entry = bk->entries[slot].load(std::memory_order_relaxed);
+                if (!Bucket::is_compact(entry))
                 {
-                    // 如果是节点的话先看看这个节点能不能插入
-                    bool not_this_node = false;
-                    auto nodePtr = std::get<std::shared_ptr<MERTNode>>(entry).get();
-                    insert_to_new_node(nodePtr, key, value, start_pos, not_this_node);
-                    if (not_this_node)
-                    {
-                        continue;
-                    }
-                    else
-                    {
-                        return; // 说明插入到下一层节点了
-                    }
+                    // 放锁之后子节点可能被collapse_child合并回来并退休，裸指针还能用只是因为调用方持有epoch守卫，
+                    // 内存要等守卫离开后才回收；进入子节点后在节点锁、目录锁里都会检查collapsed_，
+                    // 被合并了就从insert_to_new_node的起点重新走，所以调用方不能去掉守卫
+                    return Bucket::to_node(entry); // 说明要插入到下一层节点了
                 }
-                else if (std::holds_alternative<std::pair<std::string, std::string>>(entry))
+                // 紧凑节点就在段锁下改，满了的话升级成MERTNode，再进入新节点插入
+                if (this_node->insert_to_compact(*bk, slot, kv, fingerprint))
                 {
-                    // 说明这里已经有键值对了，查看这个这个key-value是否key相同，如果相同的话直接替换value即可
-                    if (std::get<std::pair<std::string, std::string>>(entry).first == key)
-                    {
-                        std::get<std::pair<std::string, std::string>>(entry).second = value;
-                        return;
-                    }
-                    else
-                    {
-                        continue;
-                    }
+                    return nullptr;
                 }
+                return this_node->promote_compact(*bk, slot, start_pos);
             }
-            else
+            for (uint32_t kvs = bk->match(fingerprint, false); kvs != 0; kvs &= kvs - 1)
+            {
+                std::atomic<typename Bucket::EntryType> &slot = bk->entries[__builtin_ctz(kvs)];
+                typename Bucket::EntryType entry = slot.load(std::memory_order_relaxed);
+                if (Bucket::to_kv(entry)->first == key)
+                {
+                    // 说明这里已经有键值对了，并且key相同，换成新的键值对，旧的交给EpochManager，指纹不变
+                    slot.store(Bucket::from_kv(kv), std::memory_order_release);
+                    release_value(Bucket::to_kv(entry)->second);
+                    retire(Bucket::to_kv(entry));
+                    return nullptr;
+                }
+            }
+            if (free_bucket == nullptr && (free_slot = bk->first_free()) >= 0)
             {
                 // 如果既不会进入下一层节点，也不会替换value，那就记录第一个空的entry位置
-                first_empty_index = std::distance(entries.begin(), it);
+                free_bucket = bk;
             }
         }
-        if (first_empty_index != -1)
+        if (free_bucket != nullptr)
         {
-            this_node->header.prefix[directory_index].segments[segment_index]->buckets[bucket_index].entries[first_empty_index] = std::make_pair(key, value);
-            return; // 插入完毕，返回
+            free_bucket->put(free_slot, Bucket::from_kv(kv), fingerprint);
+            return nullptr; // 插入完毕，返回
         }
-        else if (first_empty_index == -1 && segment_local_depth < 4)
+        else if (segment_local_depth < kMaxGlobalDepth && this_node->split_helps(*bucket, code, start_pos))
         {
-            split_segment(segment_index, this_node->header.prefix[directory_index], 4);
-            // 段分裂后也重新插入insert_to_segment_bucket(this_node, key, value, start_pos, directory_index);
+            // 段分裂要持有目录写锁，先把这里的锁都放掉
+            seg_lock.unlock();
+            dir_lock.unlock();
+            this_node->split_segment(code, directory, start_pos);
+            // 段分裂后重新插入，分裂后可能还是满的，那就继续分裂直到生成子节点
         }
-        else if (first_empty_index == -1 && segment_local_depth >= 4)
+        else
         {
-            // 这里要继续生成下一层节点
-            // 这里首先要创造一个新的节点，然后再把该key-value插入
-            std::shared_ptr<MERTNode> new_node = std::make_shared<MERTNode>();
-            auto new_node_ptr = new_node.get();
-            add_child_node(new_node_ptr, this_node->header.prefix[directory_index].segments[segment_index]->buckets[bucket_index], start_pos);
-            // 重新插入
-            insert_to_segment_bucket(this_node, key, value, start_pos, directory_index);
+            // 段已经分到底了，或者桶里的键分叉字节的段索引都一样、分裂也分不开，就生成下一层节点
+            // 只需要持有当前段的锁，新节点挂上去之前别的线程看不到
+            if (!this_node->add_child_node(*bucket, start_pos))
+            {
+                // 桶里的键两两之间在start_pos处都不相同，生成不了子节点，只能溢出存放
+                counters_->add(MERTCounter::ChildNodeFailure);
+                put_entry(segment, bucket_index, Bucket::from_kv(kv), fingerprint);
+                return nullptr;
+            }
+            // 新节点已经挂到桶里了，然后重新插入
         }
     }
-    // 然后查看该segment下面的
-}
-
-void MERTRootNode::insert(const std::string &key, const std::string &value)
-{
-    // 这里是创造新的根节点，因为根节点会出现前缀完全不匹配的情况，所以这里要创建新的节点
-    /*****
-     * 1.创建新的节点，
-     * 2.把已存在的节点放入到根节点的segment_bucket
-     * 3.根节点的话prefix是为空的，而且bucket索引是节点的前八位了，而不是后八位
-     * 4.因为节点的话不好获取它们的后八位，而且也不统一
-     * 5.根节点的桶是存放mertnode的指针的，不存放key-value
-     * 6.根节点的桶是存放指针的，
-     */
-    // uint8_t root_segment_index = cal_SegmentIndex(key);
-    uint8_t root_bucket_index = cal_BucketIndex(key);
-    bool not_this_node = false;
-
-    if (root_bucket[root_bucket_index].node_entry.has_value())
-    {
-        // 获取在这里的MERTNode节点，并插入键值对
-        std::shared_ptr<MERTNode> nodePtr = root_bucket[root_bucket_index].node_entry.value();
-        nodePtr->insert_to_new_node(nodePtr.get(), key, value, 0, not_this_node);
-    }
-    else
-    {
-        // 如果没有的话就创建一个新的节点
-        std::shared_ptr<MERTNode> new_node = std::make_shared<MERTNode>();
-        auto new_node_ptr = new_node.get();
-        new_node->insert_to_new_node(new_node_ptr, key, value, 0, not_this_node);
-        root_bucket[root_bucket_index].node_entry = new_node;
-    }
-    // std::shared_ptr<MERTNode> new_root = std::make_shared<MERTNode>(0,config_);
-}
-
-uint8_t MERTRootNode::cal_BucketIndex(const std::string &key)
-{
-    if (key.empty())
-    {
-        return 0; // 如果 key 为空字符串，返回 0
-    }
-    // 直接将第 0 个字符转换为 uint8_t 类型，其值就是对应的十进制数
-    return static_cast<uint8_t>(key[0]);
 }
 
-std::string MERTNode::longestCommonSubstringBetweenTwo(const std::string &s1, const std::string &s2, int start_pos)
+template <typename Config>
+bool MERTNode<Config>::erase_from_node(MERTNode *new_node, std::string_view key, int start_pos)
 {
-    int len1 = s1.length();
-    int len2 = s2.length();
-    int max_len = 0;                                                   // 记录最大公共子串的长度
-    int end_pos = 0;                                                   // 记录最大公共子串的结束位置
-    std::vector<std::vector<int>> dp(len1, std::vector<int>(len2, 0)); // DP 表
-
-    // 从 start_pos 开始进行动态规划计算
-    for (int i = start_pos; i < len1; ++i)
+    // 和insert_to_new_node走的路径一样，记下最后进入的子节点挂在哪里，删完之后看要不要把它合并回去
+    MERTNode *node = new_node;
+    const int root_pos = start_pos;
+    MERTNode *parent = nullptr;
+    int parent_directory = 0;
+    bool erased = false;
+    while (node != nullptr)
     {
-        for (int j = start_pos; j < len2; ++j)
+        int key_index = start_pos;
+        int prefix_index_ = 0;
+        PrefixView prefix;
+        bool restart = false;
         {
-            if (s1[i] == s2[j])
+            std::shared_lock<WriterSharedMutex> node_lock(node->node_lock_);
+            restart = node->collapsed_;
+            prefix_index_ = node->match_prefix(key, key_index, prefix);
+        }
+        if (!restart && prefix_index_ == 0)
+        {
+            return false; // 空节点或者完全不匹配
+        }
+        if (!restart && key_index == key.length())
+        {
+            // prefix只会往后扩展，已经匹配上的部分不会变，拿到写锁后不用重新匹配
+            // 节点外的位置可能刚被别的写者分配出来，重新读一份prefix
+            std::unique_lock<WriterSharedMutex> node_lock(node->node_lock_);
+            restart = node->collapsed_;
+            if (!restart)
             {
-                dp[i][j] = (i > 0 && j > 0) ? dp[i - 1][j - 1] + 1 : 1; // 继续扩展公共子串
-                if (dp[i][j] > max_len)
+                std::atomic<std::string *> *total = node->prefix_view().total_value(prefix_index_ - 1);
+                std::string *old_value = total == nullptr ? nullptr : total->exchange(nullptr, std::memory_order_acq_rel);
+                if (old_value != nullptr)
                 {
-                    max_len = dp[i][j]; // 更新最大公共子串长度
-                    end_pos = i;        // 更新最大公共子串的结束位置
+                    release_value(*old_value);
+                    retire(old_value);
+                    erased = true;
                 }
+                break;
             }
         }
+        if (!restart && prefix.directory(prefix_index_ - 1) == nullptr)
+        {
+            return false; // 节点外的这个位置上没有键分叉过
+        }
+        MERTNode *next = restart ? node : erase_from_segment_bucket(node, key, key_index, prefix_index_ - 1, erased);
+        if (next == node)
+        {
+            // 走到的节点已经被合并回父节点了，从头再来
+            node = new_node;
+            start_pos = root_pos;
+            parent = nullptr;
+            continue;
+        }
+        if (next == nullptr)
+        {
+            break;
+        }
+        parent = node;
+        parent_directory = prefix_index_ - 1;
+        node = next;
+        start_pos = key_index;
     }
-
-    // 返回最长公共子串
-    return s1.substr(end_pos - max_len + 1, max_len);
+    if (erased && parent != nullptr)
+    {
+        parent->collapse_child(node, parent_directory, key, start_pos);
+    }
+    return erased;
 }
 
-// 查找字符串数组从 start_pos 开始，任意两个字符串间的最长公共子串
-std::string MERTNode::longestCommonSubstringAmongTwo(const std::vector<std::string> &strs, int start_pos)
+template <typename Config>
+MERTNode<Config> *MERTNode<Config>::erase_from_segment_bucket(MERTNode *this_node, std::string_view key, int start_pos, int directory_index, bool &erased)
 {
-    std::string longest;
-    int n = strs.size();
-    for (int i = 0; i < n; ++i)
+    PrefixDirectory &directory = this_node->directory_at(directory_index);
+    const uint8_t code = extract_subkey_segment(key, 8, start_pos);
+    const uint8_t bucket_index = extract_subkey_bucket(key, start_pos);
+    const uint8_t fingerprint = Bucket::key_fingerprint(key);
+    bool try_merge = false;
     {
-        for (int j = i + 1; j < n; ++j)
+        std::shared_lock<WriterSharedMutex> dir_lock(directory.prefix_lock);
+        if (this_node->collapsed_)
         {
-            std::string current = longestCommonSubstringBetweenTwo(strs[i], strs[j], start_pos);
-            if (current.length() > longest.length())
+            return this_node;
+        }
+        const DirectoryView view = directory.view();
+        Segment *segment = view.slot(code).load(std::memory_order_acquire);
+        if (segment->local_depth == 0)
+        {
+            return nullptr; // 还没有键进入过这半边目录
+        }
+        std::lock_guard<WriterMutex> seg_lock(segment->seg_lock);
+        int remaining = 0;
+        for (Bucket *bk = segment->buckets[bucket_index].load(std::memory_order_relaxed); bk != nullptr; bk = bk->overflow.load(std::memory_order_relaxed))
+        {
+            uint32_t nodes = bk->match(static_cast<uint8_t>(key[start_pos]), true);
+            if (nodes != 0)
             {
-                longest = current; // 更新最长公共子串
+                const int slot = __builtin_ctz(nodes);
+                typename Bucket::EntryType entry = bk->entries[slot].load(std::memory_order_relaxed);
+                if (!Bucket::is_compact(entry))
+                {
+                    return Bucket::to_node(entry); // 要到子节点里删
+                }
+                // 同一个字节的键都在紧凑节点里，桶里不会再有这个key
+                erased = this_node->erase_from_compact(segment, bucket_index, *bk, slot, key, fingerprint);
             }
+            for (uint32_t kvs = nodes != 0 ? 0 : bk->match(fingerprint, false); kvs != 0 && !erased; kvs &= kvs - 1)
+            {
+                const int slot = __builtin_ctz(kvs);
+                typename Bucket::EntryType entry = bk->entries[slot].load(std::memory_order_relaxed);
+                if (Bucket::to_kv(entry)->first == key)
+                {
+                    // 读者可能还在读这个键值对，交给EpochManager
+                    bk->erase(slot);
+                    release_value(Bucket::to_kv(entry)->second);
+                    retire(Bucket::to_kv(entry));
+                    erased = true;
+                }
+            }
+            remaining += __builtin_popcount(bk->bitmap.load(std::memory_order_relaxed) & Bucket::kSlotMask);
+        }
+        if (!erased)
+        {
+            return nullptr;
+        }
+        // 这里只粗看一下这个桶和伙伴段的同一个桶，真正合并之前会在目录写锁下检查所有的桶
+        const uint8_t depth = segment->local_depth;
+        if (depth == 1)
+        {
+            try_merge = remaining == 0;
+        }
+        else
+        {
+            const Segment *buddy = view.slots[view.index(code) ^ (view.size() >> depth)].load(std::memory_order_acquire);
+            if (buddy->local_depth == depth)
+            {
+                for (const Bucket *bk = buddy->buckets[bucket_index].load(std::memory_order_acquire); bk != nullptr; bk = bk->overflow.load(std::memory_order_acquire))
+                {
+                    remaining += __builtin_popcount(bk->bitmap.load(std::memory_order_relaxed) & Bucket::kSlotMask);
+                }
+                try_merge = remaining <= kMergeThreshold;
+            }
+        }
+    }
+    if (try_merge)
+    {
+        this_node->merge_segment(code, directory);
+    }
+    return nullptr;
+}
+
+template <typename Config>
+void MERTNode<Config>::merge_segment(uint8_t code, PrefixDirectory &directory)
+{
+    std::unique_lock<WriterSharedMutex> dir_lock(directory.prefix_lock);
+    if (collapsed_)
+    {
+        return;
+    }
+    auto count = [](const Segment *segment, std::size_t bucket_index)
+    {
+        int n = 0;
+        for (const Bucket *bk = segment->buckets[bucket_index].load(std::memory_order_relaxed); bk != nullptr; bk = bk->overflow.load(std::memory_order_relaxed))
+        {
+            n += __builtin_popcount(bk->bitmap.load(std::memory_order_relaxed) & Bucket::kSlotMask);
+        }
+        return n;
+    };
+    // 持有目录写锁时已经没有别的写者持有这个目录下的段锁了，目录也不会翻倍
+    // 目录不跟着缩小，翻倍过的目录段合并回去之后还是每个段占好几项
+    const DirectoryView view = directory.view();
+    const std::size_t segment_index = view.index(code);
+    while (true)
+    {
+        Segment *segment = view.slots[segment_index].load(std::memory_order_relaxed);
+        const uint8_t depth = segment->local_depth;
+        if (depth == 0)
+        {
+            return;
+        }
+        if (depth == 1)
+        {
+            // 半边目录全空了就重新指向共享的空段
+            for (std::size_t bucket_index = 0; bucket_index < kBucketCount; bucket_index++)
+            {
+                if (count(segment, bucket_index) != 0)
+                {
+                    return;
+                }
+            }
+            const std::size_t half = view.size() / 2;
+            const std::size_t first = segment_index & half;
+            for (std::size_t i = first; i < first + half; i++)
+            {
+                view.slots[i].store(empty_segment(), std::memory_order_release);
+            }
+            retire_segment(segment);
+            return;
+        }
+        // 伙伴段是段索引(目录项的前depth位)最后一位取反的那个段
+        const std::size_t span = view.size() >> depth;
+        Segment *buddy = view.slots[segment_index ^ span].load(std::memory_order_relaxed);
+        if (buddy->local_depth != depth)
+        {
+            return; // 伙伴段已经分裂得更细了
+        }
+        for (std::size_t bucket_index = 0; bucket_index < kBucketCount; bucket_index++)
+        {
+            if (count(segment, bucket_index) + count(buddy, bucket_index) > kMergeThreshold)
+            {
+                return;
+            }
+        }
+        // 和段分裂一样，新段建好之后再替换目录项，键值对和子节点只拷贝指针
+        Segment *merged = arena_->create<Segment>();
+        merged->local_depth = depth - 1;
+        for (Segment *old_segment : {segment, buddy})
+        {
+            for (std::size_t bucket_index = 0; bucket_index < kBucketCount; bucket_index++)
+            {
+                for (Bucket *bk = old_segment->buckets[bucket_index].load(std::memory_order_relaxed); bk != nullptr; bk = bk->overflow.load(std::memory_order_relaxed))
+                {
+                    for (int slot = 0; slot < Bucket::kCapacity; slot++)
+                    {
+                        typename Bucket::EntryType entry = bk->entries[slot].load(std::memory_order_relaxed);
+                        if (entry != 0)
+                        {
+                            put_entry(merged, bucket_index, entry, bk->fingerprint_at(slot));
+                        }
+                    }
+                }
+            }
+        }
+        const std::size_t first = segment_index & ~(2 * span - 1);
+        for (std::size_t i = first; i < first + 2 * span; i++)
+        {
+            view.slots[i].store(merged, std::memory_order_release);
+        }
+        counters_->add(MERTCounter::SegmentMerge);
+        retire_segment(segment);
+        retire_segment(buddy);
+        // 合并出来的段可能还能和上一层的伙伴段合并
+    }
+}
+
+template <typename Config>
+void MERTNode<Config>::collapse_child(MERTNode *child, int directory_index, std::string_view key, int start_pos)
+{
+    PrefixDirectory &directory = directory_at(directory_index);
+    const uint8_t code = extract_subkey_segment(key, 8, start_pos);
+    const uint8_t bucket_index = extract_subkey_bucket(key, start_pos);
+    std::shared_lock<WriterSharedMutex> dir_lock(directory.prefix_lock);
+    if (collapsed_)
+    {
+        return;
+    }
+    Segment *segment = directory.view().slot(code).load(std::memory_order_acquire);
+    std::lock_guard<WriterMutex> seg_lock(segment->seg_lock);
+    // 找到child所在的槽位，顺便数一下桶链里还有多少空位
+    Bucket *head = segment->buckets[bucket_index].load(std::memory_order_relaxed);
+    Bucket *child_bucket = nullptr;
+    int child_slot = -1;
+    std::size_t free_slots = 0;
+    for (Bucket *bk = head; bk != nullptr; bk = bk->overflow.load(std::memory_order_relaxed))
+    {
+        uint32_t nodes = bk->match(static_cast<uint8_t>(key[start_pos]), true);
+        if (nodes != 0 && bk->entries[__builtin_ctz(nodes)].load(std::memory_order_relaxed) == Bucket::from_node(child))
+        {
+            child_bucket = bk;
+            child_slot = __builtin_ctz(nodes);
+        }
+        free_slots += __builtin_popcount(~bk->bitmap.load(std::memory_order_relaxed) & Bucket::kSlotMask);
+    }
+    if (child_bucket == nullptr)
+    {
+        return;
+    }
+    // child的节点锁和所有目录锁都拿写锁，这样child里已经没有进行到一半的写者了
+    // 合并只是为了省空间，child里有写者的话用try_lock直接放弃，不在持有父节点的锁时等子节点的锁
+    std::unique_lock<WriterSharedMutex> child_node_lock(child->node_lock_, std::try_to_lock);
+    if (!child_node_lock.owns_lock())
+    {
+        return;
+    }
+    // 持有child的节点锁时它的prefix不会再变，写者只可能在prefix以内已经有目录的位置上
+    const PrefixView child_prefix = child->prefix_view();
+    std::vector<std::unique_lock<WriterSharedMutex>> child_dir_locks;
+    for (int i = 0; i < child_prefix.length; i = child_prefix.next_level(i))
+    {
+        child_dir_locks.emplace_back(child_prefix.directory(i)->prefix_lock, std::try_to_lock);
+        if (!child_dir_locks.back().owns_lock())
+        {
+            return;
+        }
+    }
+    // 收集child里剩下的键，有更深的子节点或者键多到紧凑节点都不该放就不合并了
+    // 按索引取法的不同，child的一个段里可能只用到一个桶，也可能用到好几个桶，都扫一遍
+    std::vector<KVPair> moved;
+    std::string prefix(key.substr(0, start_pos));
+    for (int i = 0; i < child_prefix.length; i = child_prefix.next_level(i))
+    {
+        while (static_cast<int>(prefix.size()) <= start_pos + i)
+        {
+            prefix.push_back(child_prefix.byte(static_cast<int>(prefix.size()) - start_pos));
+        }
+        const std::string *total = child_prefix.total_value(i)->load(std::memory_order_relaxed);
+        if (total != nullptr)
+        {
+            if (moved.size() >= kDemoteThreshold)
+            {
+                return;
+            }
+            moved.emplace_back(prefix, *total);
+        }
+        const Segment *prev = nullptr;
+        const DirectoryView child_view = child_prefix.directory(i)->view();
+        for (int index = 0; index < child_view.size(); index++)
+        {
+            const Segment *child_segment = child_view.slots[index].load(std::memory_order_relaxed);
+            if (child_segment == prev || child_segment->local_depth == 0)
+            {
+                continue;
+            }
+            prev = child_segment;
+            for (const auto &child_head : child_segment->buckets)
+            {
+                for (const Bucket *bk = child_head.load(std::memory_order_relaxed); bk != nullptr; bk = bk->overflow.load(std::memory_order_relaxed))
+                {
+                    for (const auto &entry_slot : bk->entries)
+                    {
+                        typename Bucket::EntryType entry = entry_slot.load(std::memory_order_relaxed);
+                        if (entry == 0)
+                        {
+                            continue;
+                        }
+                        if (Bucket::is_node(entry) || moved.size() >= kDemoteThreshold)
+                        {
+                            return;
+                        }
+                        moved.push_back(*Bucket::to_kv(entry));
+                    }
+                }
+            }
+        }
+    }
+    if (moved.size() <= kCollapseThreshold && moved.size() <= free_slots + 1)
+    {
+        // 先把键值对放进空位，最后一个放不下的话放在child的槽位上，否则清空child的槽位
+        // 和add_child_node一样，前后改版本号，让没找到的读者重新找
+        head->version.fetch_add(1, std::memory_order_acq_rel);
+        for (std::size_t i = 0; i < moved.size(); i++)
+        {
+            const uint8_t fingerprint = Bucket::key_fingerprint(moved[i].first);
+            typename Bucket::EntryType entry = Bucket::from_kv(arena_->create<KVPair>(std::move(moved[i])));
+            if (i + 1 == moved.size() && free_slots < moved.size())
+            {
+                child_bucket->put(child_slot, entry, fingerprint);
+            }
+            else
+            {
+                put_entry(segment, bucket_index, entry, fingerprint);
+            }
+        }
+        if (free_slots >= moved.size())
+        {
+            child_bucket->erase(child_slot);
+        }
+        child->collapsed_ = true;
+        head->version.fetch_add(1, std::memory_order_release);
+        counters_->add(MERTCounter::ChildCollapse);
+    }
+    else
+    {
+        // 桶里放不下，降级成紧凑节点换掉child的槽位，读者不管读到哪一个键都是全的，不用改版本号
+        std::sort(moved.begin(), moved.end(), [](const KVPair &a, const KVPair &b)
+                  { return a.first < b.first; });
+        CompactNode *compact = create_compact(arena_, static_cast<uint8_t>(key[start_pos]), static_cast<int>(moved.size()));
+        for (std::size_t i = 0; i < moved.size(); i++)
+        {
+            compact->fingerprints[i] = Bucket::key_fingerprint(moved[i].first);
+            compact->entries()[i] = arena_->create<KVPair>(std::move(moved[i]));
+        }
+        child_bucket->entries[child_slot].store(Bucket::from_compact(compact), std::memory_order_release);
+        child->collapsed_ = true;
+        counters_->add(MERTCounter::CompactDemotion);
+    }
+    // 读者和等锁的写者可能还在child里，child连同它自己的键值对都等它们离开后再释放
+    retire(child);
+}
+
+template <typename Config>
+bool MERTNode<Config>::search_in_node(std::string_view key, int start_pos, std::string &value) const
+{
+    // 和insert_to_new_node走的路径一样，只是不会修改prefix，并且是循环往下走而不是递归
+    // 读者不加锁，只读原子指针，读到的段、键值对在离开EpochManager临界区之前都不会被释放
+    const MERTNode *node = this;
+    int key_index = start_pos;
+    const uint8_t fingerprint = Bucket::key_fingerprint(key);
+    while (node != nullptr)
+    {
+        counters_->add(MERTCounter::SearchLevels);
+        PrefixView prefix;
+        int prefix_index_ = node->match_prefix(key, key_index, prefix);
+        if (prefix_index_ == 0)
+        {
+            // 空节点或者完全不匹配
+            return false;
+        }
+        if (key_index == key.length())
+        {
+            // key正好在prefix上结束，直接从total_value返回，不用再进段桶
+            const std::atomic<std::string *> *total_slot = prefix.total_value(prefix_index_ - 1);
+            const std::string *total = total_slot == nullptr ? nullptr : total_slot->load(std::memory_order_acquire);
+            if (total == nullptr)
+            {
+                return false;
+            }
+            value = node->load_value(*total);
+            return true;
+        }
+        // 进入prefix[prefix_index_ - 1]的目录，段和桶的索引与插入时相同，节点外的位置没有目录的话就没有键在这里分叉
+        const PrefixDirectory *directory = prefix.directory(prefix_index_ - 1);
+        if (directory == nullptr)
+        {
+            return false;
+        }
+        const Segment *segment = directory->view().slot(extract_subkey_segment(key, 8, key_index)).load(std::memory_order_acquire);
+        if (segment->local_depth == 0)
+        {
+            return false; // 还没有键进入过这个段
+        }
+        const Bucket *head = segment->buckets[extract_subkey_bucket(key, key_index)].load(std::memory_order_acquire);
+        const MERTNode *next = nullptr;
+        if (node->probe_level(head, key, key_index, fingerprint, value, next) == ProbeResult::Found)
+        {
+            return true;
+        }
+        // 子节点的prefix从key_index开始匹配
+        node = next;
+    }
+    return false;
+}
+
+template <typename Config>
+typename MERTNode<Config>::ProbeResult MERTNode<Config>::probe_level(const Bucket *head, std::string_view key, int key_index, uint8_t fingerprint,
+                                                                   std::string &value, const MERTNode *&next) const
+{
+    next = nullptr;
+    // 这一层读过的桶数和比较完整key的次数，离开这一层时记一次
+    int probed = 0;
+    int compares = 0;
+    auto record_probe = [&]()
+    {
+        counters_->record_probe(probed);
+        counters_->add(MERTCounter::ProbeKeyCompares, compares);
+    };
+    while (head != nullptr)
+    {
+        uint32_t version = head->version.load(std::memory_order_acquire);
+        if (version & 1)
+        {
+            std::this_thread::yield(); // 有写者正在把键值对搬进子节点
+            continue;
+        }
+        for (const Bucket *bucket = head; bucket != nullptr && next == nullptr; bucket = bucket->overflow.load(std::memory_order_acquire))
+        {
+            probed++;
+            for (uint32_t kvs = bucket->match(fingerprint, false); kvs != 0; kvs &= kvs - 1)
+            {
+                typename Bucket::EntryType entry = bucket->entries[__builtin_ctz(kvs)].load(std::memory_order_acquire);
+                if (entry != 0 && !Bucket::is_node(entry) && (compares++, Bucket::to_kv(entry)->first == key))
+                {
+                    value = load_value(Bucket::to_kv(entry)->second);
+                    record_probe();
+                    return ProbeResult::Found;
+                }
+            }
+            // 子节点的prefix[0]就是key_index处的字节，同一个字节的键都已经移到子节点里了
+            for (uint32_t nodes = bucket->match(static_cast<uint8_t>(key[key_index]), true); nodes != 0; nodes &= nodes - 1)
+            {
+                typename Bucket::EntryType entry = bucket->entries[__builtin_ctz(nodes)].load(std::memory_order_acquire);
+                if (!Bucket::is_node(entry) || Bucket::branch_of(entry) != static_cast<uint8_t>(key[key_index]))
+                {
+                    continue;
+                }
+                if (!Bucket::is_compact(entry))
+                {
+                    next = Bucket::to_node(entry);
+                    break;
+                }
+                // 紧凑节点里只有键值对，在这里就查完了，它也算走过的一层
+                const CompactNode *compact = Bucket::to_compact(entry);
+                counters_->add(MERTCounter::SearchLevels);
+                for (uint32_t kvs = compact->match(fingerprint); kvs != 0; kvs &= kvs - 1)
+                {
+                    const KVPair *kv = compact->entries()[__builtin_ctz(kvs)];
+                    if ((compares++, kv->first == key))
+                    {
+                        value = load_value(kv->second);
+                        record_probe();
+                        return ProbeResult::Found;
+                    }
+                }
+                record_probe();
+                return ProbeResult::Missing;
+            }
+        }
+        // 找到了子节点，或者整个查找期间没有发生过搬动，没找到就是真的没有
+        if (next != nullptr || head->version.load(std::memory_order_acquire) == version)
+        {
+            break;
+        }
+    }
+    record_probe();
+    return next != nullptr ? ProbeResult::Child : ProbeResult::Missing;
+}
+
+template <typename Config>
+void MERTNode<Config>::Lookup::start(const MERTNode *root, std::string_view lookup_key, std::string *out)
+{
+    key = lookup_key;
+    value = out;
+    node = root;
+    key_index = 0;
+    fingerprint = Bucket::key_fingerprint(key);
+    stage = kNode;
+    found = false;
+    __builtin_prefetch(node);
+}
+
+template <typename Config>
+bool MERTNode<Config>::Lookup::advance()
+{
+    // 每一步的读和search_in_node、probe_level里的一样，只是在读之前的那一步就预取了
+    switch (stage)
+    {
+    case kNode:
+    {
+        node->counters_->add(MERTCounter::SearchLevels);
+        PrefixView prefix;
+        const int matched = node->match_prefix(key, key_index, prefix);
+        if (matched == 0)
+        {
+            return false;
+        }
+        if (key_index == key.length())
+        {
+            const std::atomic<std::string *> *total_slot = prefix.total_value(matched - 1);
+            const std::string *total = total_slot == nullptr ? nullptr : total_slot->load(std::memory_order_acquire);
+            found = total != nullptr;
+            if (found)
+            {
+                *value = node->load_value(*total);
+            }
+            return false;
+        }
+        const PrefixDirectory *directory = prefix.directory(matched - 1);
+        if (directory == nullptr)
+        {
+            return false;
+        }
+        segment_slot = &directory->view().slot(node->extract_subkey_segment(key, 8, key_index));
+        bucket_index = node->extract_subkey_bucket(key, key_index);
+        __builtin_prefetch(segment_slot);
+        stage = kDirectory;
+        return true;
+    }
+    case kDirectory:
+        segment = segment_slot->load(std::memory_order_acquire);
+        __builtin_prefetch(&segment->local_depth);
+        __builtin_prefetch(&segment->buckets[bucket_index]);
+        stage = kSegment;
+        return true;
+    case kSegment:
+        if (segment->local_depth == 0)
+        {
+            return false; // 还没有键进入过这个段
+        }
+        head = segment->buckets[bucket_index].load(std::memory_order_acquire);
+        if (head == nullptr)
+        {
+            return false;
+        }
+        __builtin_prefetch(head);
+        stage = kBucket;
+        return true;
+    case kBucket:
+    {
+        // 先看键值对的候选，没有的话看子节点，只预取第一个候选所在的槽位，一般也只有一个
+        uint32_t slots = head->match(fingerprint, false);
+        if (slots == 0)
+        {
+            slots = head->match(static_cast<uint8_t>(key[key_index]), true);
+        }
+        candidate = nullptr;
+        if (slots != 0)
+        {
+            candidate = &head->entries[__builtin_ctz(slots)];
+            __builtin_prefetch(candidate);
+        }
+        stage = kEntry;
+        return true;
+    }
+    case kEntry:
+        if (candidate != nullptr)
+        {
+            typename Bucket::EntryType entry = candidate->load(std::memory_order_acquire);
+            if (entry != 0)
+            {
+                // 槽位去掉标记位就是键值对或者子节点的地址，下一步要读的都在它的第一个缓存行里
+                __builtin_prefetch(reinterpret_cast<const void *>(entry & ~static_cast<typename Bucket::EntryType>(3)));
+            }
+        }
+        stage = kCompare;
+        return true;
+    case kCompare:
+    {
+        // 要读的都已经预取过了，剩下的(溢出桶、版本号对不上时重找)交给probe_level
+        const MERTNode *next = nullptr;
+        const ProbeResult result = node->probe_level(head, key, key_index, fingerprint, *value, next);
+        if (result != ProbeResult::Child)
+        {
+            found = result == ProbeResult::Found;
+            return false;
+        }
+        // 子节点的prefix从key_index开始匹配
+        node = next;
+        __builtin_prefetch(node);
+        stage = kNode;
+        return true;
+    }
+    }
+    return false;
+}
+
+template <typename Config>
+bool MERTNode<Config>::scan_node(std::string &path, ScanState &state) const
+{
+    const PrefixView prefix = prefix_view();
+    if (prefix.length == 0)
+    {
+        return true; // 刚发布还没有写入的节点
+    }
+    const std::size_t base = path.size();
+    path.push_back(prefix.byte(0));
+    bool keep_going = scan_level(0, prefix, path, state);
+    path.resize(base);
+    return keep_going;
+}
+
+/***
+ * 一个节点里键的顺序：设prefix为P，本节点的键都以path+P[0]开头
+ * 完全匹配到P[level]的键(total_value[level])就是path本身，比这一层其他的键都小
+ * prefix[level]的目录里的键在P[level]之后的那个字节上和P[level+1]不同，所以比P[level+1]小的排在更深的层前面，大的排在后面
+ * 目录里的段是按字节的后四位分的，所以一层的键要收集起来按字节排序，同一个字节要么是一个子节点，要么是若干个键值对
+ */
+template <typename Config>
+bool MERTNode<Config>::scan_level(int level, const PrefixView &prefix, std::string &path, ScanState &state) const
+{
+    // 以path开头的键都在start之前的话这一层整个跳过，都在end之后的话整个遍历都可以结束了
+    if (path.compare(0, std::string::npos, state.start.data(), std::min(path.size(), state.start.size())) < 0)
+    {
+        return true;
+    }
+    if (!state.end.empty() && std::string_view(path) >= state.end)
+    {
+        return false;
+    }
+    auto emit = [&state](std::string_view key, std::string_view value)
+    {
+        if (key < state.start)
+        {
+            return true;
+        }
+        if (!state.end.empty() && key >= state.end)
+        {
+            return false;
+        }
+        state.count++;
+        state.stopped = !(*state.callback)(key, value) || state.count >= state.limit;
+        return !state.stopped;
+    };
+    // scan_level只会走到有目录的位置上，节点外没有分配的位置在下面直接跳过
+    const std::string *total = prefix.total_value(level)->load(std::memory_order_acquire);
+    if (total != nullptr && !emit(path, load_value(*total)))
+    {
+        return false;
+    }
+
+    // 收集这一层目录里的键值对和子节点
+    struct Item
+    {
+        uint8_t byte;
+        const KVPair *kv;
+        const MERTNode *child;
+        const CompactNode *compact;
+    };
+    std::vector<Item> items;
+    const std::size_t pos = path.size(); // 目录里的键在这个字节上分开
+    // 桶索引只和key[0]有关的话，一个节点里的键都在同一个桶里，否则段里的桶都要扫
+    int first_bucket = 0;
+    int last_bucket = kBucketCount;
+    if (!IndexPolicy::kBucketByBranch)
+    {
+        first_bucket = extract_subkey_bucket(path, 0);
+        last_bucket = first_bucket + 1;
+    }
+    const PrefixDirectory &directory = *prefix.directory(level);
+    // 一个段占连续的size>>local_depth个目录项，每个键只属于其中一个目录项(分叉字节的段编码的前global_depth位)
+    // 遍历期间段可能被分裂替换，所以每个段只收集还没处理过的那些目录项里的键，这样不会重复也不会漏掉已有的键
+    // 目录翻倍了的话接着用开始时读到的旧表，它的段指针在离开临界区之前都有效，和读到分裂之前的段一样
+    const DirectoryView view = directory.view();
+    for (int index = 0; index < view.size();)
+    {
+        const Segment *segment = view.slots[index].load(std::memory_order_acquire);
+        // 空段占的是半边目录
+        const int end_index = (index | ((view.size() >> std::max<int>(segment->local_depth, 1)) - 1)) + 1;
+        const int begin_index = index;
+        index = end_index;
+        if (segment->local_depth == 0)
+        {
+            continue;
+        }
+        for (int bucket_index = first_bucket; bucket_index < last_bucket; bucket_index++)
+        {
+            const Bucket *head = segment->buckets[bucket_index].load(std::memory_order_acquire);
+            const std::size_t collected = items.size();
+            while (head != nullptr)
+            {
+                // 和search_in_node一样，碰上生成子节点搬键值对的话要重新收集这个桶
+                uint32_t version = head->version.load(std::memory_order_acquire);
+                if (version & 1)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (const Bucket *bucket = head; bucket != nullptr; bucket = bucket->overflow.load(std::memory_order_acquire))
+                {
+                    for (const auto &entry_slot : bucket->entries)
+                    {
+                        typename Bucket::EntryType entry = entry_slot.load(std::memory_order_acquire);
+                        if (entry == 0)
+                        {
+                            continue;
+                        }
+                        Item item{};
+                        if (Bucket::is_compact(entry))
+                        {
+                            item.compact = Bucket::to_compact(entry);
+                            item.byte = item.compact->branch;
+                        }
+                        else if (Bucket::is_node(entry))
+                        {
+                            item.child = Bucket::to_node(entry);
+                            item.byte = static_cast<uint8_t>(item.child->prefix_byte(0));
+                        }
+                        else
+                        {
+                            item.kv = Bucket::to_kv(entry);
+                            item.byte = static_cast<uint8_t>(item.kv->first[pos]);
+                        }
+                        const int item_index = view.index(segment_code(item.byte));
+                        if (item_index >= begin_index && item_index < end_index)
+                        {
+                            items.push_back(item);
+                        }
+                    }
+                }
+                if (head->version.load(std::memory_order_acquire) == version)
+                {
+                    break;
+                }
+                items.resize(collected);
+            }
+        }
+    }
+    std::sort(items.begin(), items.end(), [](const Item &a, const Item &b)
+              {
+        if (a.byte != b.byte)
+        {
+            return a.byte < b.byte;
+        }
+        // 同一个字节只会有键值对，比较完整的key
+        return a.kv != nullptr && b.kv != nullptr && a.kv->first < b.kv->first; });
+
+    auto visit = [&](const Item &item)
+    {
+        if (item.kv != nullptr)
+        {
+            return emit(item.kv->first, load_value(item.kv->second));
+        }
+        if (item.compact != nullptr)
+        {
+            // 紧凑节点里的键本来就是排好序的
+            for (int i = 0; i < item.compact->count; i++)
+            {
+                const KVPair *kv = item.compact->entries()[i];
+                if (!emit(kv->first, load_value(kv->second)))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        // 子节点的prefix从pos开始，它之前的key就是path
+        return item.child->scan_node(path, state);
+    };
+    std::size_t i = 0;
+    // 下一个有目录的位置，节点外中间没有分配目录的那些字节上没有键，直接接到path上跳过去
+    const int next_level = prefix.next_level(level);
+    if (next_level < prefix.length)
+    {
+        const char next_char = prefix.byte(level + 1);
+        for (; i < items.size() && items[i].byte < static_cast<uint8_t>(next_char); i++)
+        {
+            if (!visit(items[i]))
+            {
+                return false;
+            }
+        }
+        const std::size_t base = path.size();
+        for (int j = level + 1; j <= next_level; j++)
+        {
+            path.push_back(prefix.byte(j));
+        }
+        bool keep_going = scan_level(next_level, prefix, path, state);
+        path.resize(base);
+        if (!keep_going)
+        {
+            return false;
+        }
+    }
+    for (; i < items.size(); i++)
+    {
+        if (!visit(items[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Config>
+void MERTNode<Config>::collect_skew(int start_pos, std::size_t depth, MERTSkewReport &report) const
+{
+    report.nodes++;
+    report.max_depth = std::max(report.max_depth, depth);
+    const PrefixView prefix = prefix_view();
+    report.long_prefixes += prefix.tail != nullptr;
+    report.max_prefix_length = std::max<std::size_t>(report.max_prefix_length, prefix.length);
+    for (int level = 0; level < prefix.length; level = prefix.next_level(level))
+    {
+        // 目录prefix[level]里的键在start_pos + level + 1这个字节上分开，子节点的prefix从这里开始
+        const int pos = start_pos + level + 1;
+        const Segment *prev = nullptr;
+        const DirectoryView view = prefix.directory(level)->view();
+        report.grown_directories += view.global_depth > kGlobalDepth;
+        for (int index = 0; index < view.size(); index++)
+        {
+            const Segment *segment = view.slots[index].load(std::memory_order_acquire);
+            if (segment == prev || segment->local_depth == 0)
+            {
+                continue;
+            }
+            prev = segment;
+            report.segments++;
+            report.segments_by_depth[segment->local_depth]++;
+            for (const auto &head : segment->buckets)
+            {
+                for (const Bucket *bucket = head.load(std::memory_order_acquire); bucket != nullptr; bucket = bucket->overflow.load(std::memory_order_acquire))
+                {
+                    report.buckets++;
+                    report.overflow_buckets += bucket != head.load(std::memory_order_relaxed);
+                    report.bucket_fill[__builtin_popcount(bucket->bitmap.load(std::memory_order_acquire) & Bucket::kSlotMask)]++;
+                    for (const auto &slot : bucket->entries)
+                    {
+                        typename Bucket::EntryType entry = slot.load(std::memory_order_acquire);
+                        if (entry == 0)
+                        {
+                            continue;
+                        }
+                        if (Bucket::is_compact(entry))
+                        {
+                            // 紧凑节点没有段和桶，它的键都记在分叉字节的段索引上
+                            const CompactNode *compact = Bucket::to_compact(entry);
+                            report.nodes++;
+                            report.compact_nodes++;
+                            report.max_depth = std::max(report.max_depth, depth + 1);
+                            report.keys += compact->count;
+                            report.key_levels += compact->count * (depth + 1);
+                            report.keys_per_slot[segment_slot(compact->branch)] += compact->count;
+                        }
+                        else if (Bucket::is_node(entry))
+                        {
+                            Bucket::to_node(entry)->collect_skew(pos, depth + 1, report);
+                        }
+                        else
+                        {
+                            report.keys++;
+                            report.key_levels += depth;
+                            report.keys_per_slot[segment_slot(static_cast<uint8_t>(Bucket::to_kv(entry)->first[pos]))]++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename Config>
+void MERTRootNode<Config>::insert(std::string_view key, std::string &&value)
+{
+    // 这里是创造新的根节点，因为根节点会出现前缀完全不匹配的情况，所以这里要创建新的节点
+    /*****
+     * 1.创建新的节点，
+     * 2.把已存在的节点放入到根节点的segment_bucket
+     * 3.根节点的话prefix是为空的，而且bucket索引是节点的前八位了，而不是后八位
+     * 4.因为节点的话不好获取它们的后八位，而且也不统一
+     * 5.根节点的桶是存放mertnode的指针的，不存放key-value
+     * 6.根节点的桶是存放指针的，
+     */
+    // uint8_t root_segment_index = cal_SegmentIndex(key);
+    counters_.add(MERTCounter::Insert);
+    auto guard = epoch_.pin();
+    // 获取在这里的MERTNode节点，并插入键值对，节点发布后就不会再变
+    insert_to_root(node_for_write(key), key, std::move(value));
+    // std::shared_ptr<Node> new_root = std::make_shared<Node>(0,config_);
+}
+
+template <typename Config>
+void MERTRootNode<Config>::insert_to_root(Node *nodePtr, std::string_view key, std::string &&value)
+{
+    bool not_this_node = false;
+    // 键值对先建好，key在这里拷贝这一次，value直接移进去，之后一路往下传的都是这个指针
+    KVPair *kv = arena_.create<KVPair>(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(store_value(std::move(value))));
+    if (!nodePtr->insert_to_new_node(nodePtr, kv, 0, not_this_node, true))
+    {
+        // value放进了total_value，键值对本身没有别人看到过
+        arena_.destroy(kv);
+    }
+}
+
+template <typename Config>
+typename MERTRootNode<Config>::Node *MERTRootNode<Config>::node_for_write(std::string_view key)
+{
+    const uint8_t root_bucket_index = cal_BucketIndex(key);
+    RootBucket &bucket = root_bucket[root_bucket_index];
+    Node *nodePtr = bucket.node_entry.load(std::memory_order_acquire);
+    if (nodePtr == nullptr)
+    {
+        // 如果没有的话就创建一个新的节点，用CAS发布，别的线程先发布了的话就用别人的
+        Node *new_node = arena_.create<Node>(&epoch_, &arena_, &counters_, value_log_.get());
+        if (bucket.node_entry.compare_exchange_strong(nodePtr, new_node, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            nodePtr = new_node;
+        }
+        else
+        {
+            arena_.destroy(new_node);
+        }
+    }
+    if (bucket.snapshot_chunks.load(std::memory_order_acquire) == 0)
+    {
+        return nodePtr;
+    }
+    // 写时复制以块为单位：先把key所在的那块条目插进树里，标记置上之前读者读这一块时一直读的是快照，
+    // 这一块的写者都等在锁上，所以插进去的都是快照里的值，不会盖掉新写的
+    std::size_t index;
+    const std::size_t chunk = bucket.chunk_base + snapshot_->chunk_of(root_bucket_index, key, index);
+    if (chunk_done_[chunk].load(std::memory_order_acquire))
+    {
+        return nodePtr;
+    }
+    std::lock_guard<std::mutex> lock(chunk_locks_[chunk % kChunkLocks]);
+    if (!chunk_done_[chunk].load(std::memory_order_relaxed))
+    {
+        const std::size_t first = snapshot_->chunk_begin(root_bucket_index, chunk - bucket.chunk_base);
+        const std::size_t last = snapshot_->chunk_begin(root_bucket_index, chunk - bucket.chunk_base + 1);
+        for (std::size_t i = first; i < last; i++)
+        {
+            insert_to_root(nodePtr, snapshot_->key_at(i), std::string(snapshot_->value_at(i)));
+        }
+        chunk_done_[chunk].store(true, std::memory_order_release);
+        bucket.snapshot_chunks.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    return nodePtr;
+}
+
+namespace
+{
+    // 少于这么多个键时基数排序改用比较排序
+    constexpr std::size_t kRadixSortCutoff = 32;
+
+    // 按key做MSD基数排序，是稳定的(相同的键保持原来的先后顺序)
+    // order[0, n)是pairs的下标，这些键的前depth个字节都相同
+    void radix_sort_keys(const std::vector<std::pair<std::string, std::string>> &pairs, std::size_t *order, std::size_t *buffer, std::size_t n, std::size_t depth)
+    {
+        if (n < kRadixSortCutoff)
+        {
+            std::stable_sort(order, order + n, [&pairs, depth](std::size_t a, std::size_t b)
+                             { return pairs[a].first.compare(depth, std::string::npos, pairs[b].first, depth, std::string::npos) < 0; });
+            return;
+        }
+        // 第0个桶是在depth处已经结束的键，之后是depth处的字节+1
+        auto radix = [&pairs, depth](std::size_t index)
+        {
+            const std::string &key = pairs[index].first;
+            return depth < key.length() ? static_cast<uint8_t>(key[depth]) + 1 : 0;
+        };
+        std::size_t offsets[258] = {0};
+        for (std::size_t i = 0; i < n; i++)
+        {
+            offsets[radix(order[i]) + 1]++;
+        }
+        for (int i = 1; i < 258; i++)
+        {
+            offsets[i] += offsets[i - 1];
+        }
+        std::size_t cursor[257];
+        std::copy(offsets, offsets + 257, cursor);
+        for (std::size_t i = 0; i < n; i++)
+        {
+            buffer[cursor[radix(order[i])]++] = order[i];
+        }
+        std::copy(buffer, buffer + n, order);
+        // 已经结束的键都相同，不用再排
+        for (int i = 1; i < 257; i++)
+        {
+            if (offsets[i + 1] - offsets[i] > 1)
+            {
+                radix_sort_keys(pairs, order + offsets[i], buffer + offsets[i], offsets[i + 1] - offsets[i], depth + 1);
+            }
+        }
+    }
+}
+
+template <typename Config>
+void MERTRootNode<Config>::bulk_load(std::vector<KVPair> &pairs)
+{
+    using KVPair = KVPair;
+    if (!std::is_sorted(pairs.begin(), pairs.end(), [](const KVPair &a, const KVPair &b)
+                        { return a.first < b.first; }))
+    {
+        // 排的是下标，排完再把键值对按顺序移过去，之后建树时是顺序访问的
+        std::vector<std::size_t> order(pairs.size());
+        std::vector<std::size_t> buffer(pairs.size());
+        std::iota(order.begin(), order.end(), 0);
+        radix_sort_keys(pairs, order.data(), buffer.data(), order.size(), 0);
+        std::vector<KVPair> sorted;
+        sorted.reserve(pairs.size());
+        for (std::size_t index : order)
+        {
+            sorted.push_back(std::move(pairs[index]));
+        }
+        pairs.swap(sorted);
+    }
+    // 相同的键只留最后一个，和逐个插入的结果一样(排序是稳定的)
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < pairs.size(); i++)
+    {
+        if (i + 1 < pairs.size() && pairs[i + 1].first == pairs[i].first)
+        {
+            continue;
+        }
+        if (kept != i)
+        {
+            pairs[kept] = std::move(pairs[i]);
+        }
+        kept++;
+    }
+    pairs.resize(kept);
+    if constexpr (Node::kValueLogThreshold > 0)
+    {
+        for (KVPair &pair : pairs)
+        {
+            pair.second = store_value(std::move(pair.second));
+        }
+    }
+
+    auto guard = epoch_.pin();
+    std::size_t begin = 0;
+    while (begin < pairs.size())
+    {
+        // 排好序之后同一个根桶的键是连续的
+        uint8_t root_bucket_index = cal_BucketIndex(pairs[begin].first);
+        std::size_t end = begin;
+        while (end < pairs.size() && cal_BucketIndex(pairs[end].first) == root_bucket_index)
+        {
+            end++;
+        }
+        RootBucket &bucket = root_bucket[root_bucket_index];
+        // 快照里这个根桶还有块没插进树里的话逐个插入，每个键先把它所在的块插进树里
+        const bool partial = bucket.snapshot_chunks.load(std::memory_order_acquire) != 0;
+        Node *nodePtr = bucket.node_entry.load(std::memory_order_acquire);
+        if (nodePtr == nullptr && !partial)
+        {
+            // 新节点建好之前别的线程看不到，建好之后再用CAS发布
+            std::vector<std::size_t> indices(end - begin);
+            std::iota(indices.begin(), indices.end(), begin);
+            Node *new_node = arena_.create<Node>(&epoch_, &arena_, &counters_, value_log_.get());
+            new_node->bulk_build(pairs, indices, 0);
+            if (bucket.node_entry.compare_exchange_strong(nodePtr, new_node, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                begin = end;
+                continue;
+            }
+            // 别的线程先往这个根桶里插入了，建好的节点不要了，退回逐个插入，value的句柄还在pairs里，接着用
+            arena_.destroy(new_node);
+        }
+        for (std::size_t i = begin; i < end; i++)
+        {
+            if (partial)
+            {
+                nodePtr = node_for_write(pairs[i].first);
+            }
+            bool not_this_node = false;
+            KVPair *kv = arena_.create<KVPair>(pairs[i]);
+            if (!nodePtr->insert_to_new_node(nodePtr, kv, 0, not_this_node, true))
+            {
+                arena_.destroy(kv);
+            }
+        }
+        begin = end;
+    }
+}
+
+template <typename Config>
+uint8_t MERTRootNode<Config>::cal_BucketIndex(std::string_view key) const
+{
+    if (key.empty())
+    {
+        return 0; // 如果 key 为空字符串，返回 0
+    }
+    // 直接将第 0 个字符转换为 uint8_t 类型，其值就是对应的十进制数
+    return static_cast<uint8_t>(key[0]);
+}
+
+/***
+ * 批量建树，建出来的形状要和逐个插入时满足同样的约定，之后还能继续插入和查找：
+ * 1. prefix和逐个插入时一样由最小的键决定，后面的键以它为前缀的话，逐个插入时prefix会被后面的键继续扩展，
+ *    所以换成后面那个键，排好序之后只需要比较相邻的两个键
+ * 2. 不会有键匹配完整个prefix还有剩余，所以最后一个位置的目录一定是空的
+ * 3. 完全匹配到prefix[m-1]的键放total_value[m-1]，匹配m个字节还有剩余的放prefix[m-1]的目录，
+ *    m超过kPrefixLength的话这个位置的目录和total_value分配在节点外
+ */
+template <typename Config>
+void MERTNode<Config>::bulk_build(const std::vector<KVPair> &pairs, const std::vector<std::size_t> &indices, int start_pos)
+{
+    std::size_t chosen = indices[0];
+    for (std::size_t i = 1; i < indices.size(); i++)
+    {
+        const std::string &shorter = pairs[chosen].first;
+        if (pairs[indices[i]].first.compare(0, shorter.length(), shorter) != 0)
+        {
+            break;
+        }
+        chosen = indices[i];
+    }
+    const std::string_view prefix = std::string_view(pairs[chosen].first).substr(start_pos);
+    extend_prefix(prefix);
+
+    std::vector<std::vector<std::size_t>> directory_keys(prefix.length());
+    for (std::size_t index : indices)
+    {
+        const std::string &key = pairs[index].first;
+        // 本节点的键在start_pos处的字节都等于prefix[0]，所以至少匹配一个字节
+        int matched = 1;
+        while (matched < prefix.length() && start_pos + matched < key.length() && key[start_pos + matched] == prefix[matched])
+        {
+            matched++;
+        }
+        if (start_pos + matched == key.length())
+        {
+            total_value_for_write(matched - 1).store(arena_->create<std::string>(pairs[index].second), std::memory_order_relaxed);
+        }
+        else
+        {
+            directory_keys[matched - 1].push_back(index);
+        }
+    }
+    for (std::size_t i = 0; i < directory_keys.size(); i++)
+    {
+        if (!directory_keys[i].empty())
+        {
+            // 目录prefix[i]下段索引取的是匹配完i+1个字节之后的那个字节
+            bulk_build_segment(directory_for_write(static_cast<int>(i)), pairs, directory_keys[i], start_pos + static_cast<int>(i) + 1, 0, 0);
+        }
+    }
+}
+
+template <typename Config>
+void MERTNode<Config>::bulk_build_segment(PrefixDirectory &directory, const std::vector<KVPair> &pairs, const std::vector<std::size_t> &indices,
+                                  int start_pos, uint8_t segment_prefix, uint8_t local_depth)
+{
+    // 按桶分组，组内还是按key排好序的，桶索引只和key[0]有关的话就只有一组
+    auto bucket_of = [&](std::size_t index)
+    { return extract_subkey_bucket(pairs[index].first, start_pos); };
+    std::vector<std::size_t> grouped(indices);
+    if (IndexPolicy::kBucketByBranch)
+    {
+        std::stable_sort(grouped.begin(), grouped.end(), [&](std::size_t a, std::size_t b)
+                         { return bucket_of(a) < bucket_of(b); });
+    }
+    std::vector<std::pair<std::size_t, std::size_t>> groups; // grouped里的[begin, end)
+    for (std::size_t i = 0; i < grouped.size(); i++)
+    {
+        if (i == 0 || bucket_of(grouped[i]) != bucket_of(grouped[i - 1]))
+        {
+            groups.emplace_back(i, i);
+        }
+        groups.back().second = i + 1;
+    }
+    // 逐个插入时半边目录第一次有键就建local_depth为1的段，桶满了、而且分裂能把桶里的键分开时才分裂，这里直接算出分裂到最后的样子
+    bool split = local_depth == 0;
+    // 和split_helps一样，段编码的前kMaxGlobalDepth位都相同的键分不开
+    for (std::size_t g = 0; g < groups.size() && !split && local_depth < kMaxGlobalDepth; g++)
+    {
+        if (groups[g].second - groups[g].first <= Bucket::kCapacity)
+        {
+            continue;
+        }
+        const uint8_t first_code = extract_subkey_segment(pairs[grouped[groups[g].first]].first, kMaxGlobalDepth, start_pos);
+        for (std::size_t i = groups[g].first + 1; i < groups[g].second && !split; i++)
+        {
+            split = extract_subkey_segment(pairs[grouped[i]].first, kMaxGlobalDepth, start_pos) != first_code;
+        }
+    }
+    if (split)
+    {
+        std::vector<std::size_t> zero;
+        std::vector<std::size_t> one;
+        for (std::size_t index : indices)
+        {
+            (extract_subkey_segment(pairs[index].first, local_depth + 1, start_pos) & 1 ? one : zero).push_back(index);
+        }
+        // 没有键的半边目录继续指向空段；已经有段的半边分裂出来的两个段即使是空的也要建，不然插入时会当成整个半边都没建过
+        if (local_depth != 0 || !zero.empty())
+        {
+            bulk_build_segment(directory, pairs, zero, start_pos, segment_prefix * 2, local_depth + 1);
+        }
+        if (local_depth != 0 || !one.empty())
+        {
+            bulk_build_segment(directory, pairs, one, start_pos, segment_prefix * 2 + 1, local_depth + 1);
+        }
+        return;
+    }
+
+    Segment *segment = arena_->create<Segment>();
+    segment->local_depth = local_depth;
+    // 段分得比目录细的话先把目录翻倍，已经建好的段翻倍之后占的目录项也跟着翻倍
+    DirectoryView view = directory.view();
+    while (view.global_depth < local_depth)
+    {
+        view = grow_directory(directory);
+    }
+    const int span = view.size() >> local_depth;
+    for (int i = segment_prefix * span; i < (segment_prefix + 1) * span; i++)
+    {
+        view.slots[i].store(segment, std::memory_order_relaxed);
+    }
+    if (indices.empty())
+    {
+        return;
+    }
+    for (const auto &group : groups)
+    {
+        const uint8_t bucket_index = bucket_of(grouped[group.first]);
+        const std::size_t count = group.second - group.first;
+        // 放不下的话，和add_child_node一样把start_pos处字节相同的键放进子节点
+        // 排好序之后start_pos之前的字节都相同，所以这样的键是连续的一段，先把最长的几段放进子节点，直到桶放得下为止
+        std::vector<std::pair<std::size_t, std::size_t>> runs; // grouped里的[begin, end)
+        for (std::size_t i = group.first; i < group.second; i++)
+        {
+            if (i == group.first || pairs[grouped[i]].first[start_pos] != pairs[grouped[i - 1]].first[start_pos])
+            {
+                runs.emplace_back(i, i);
+            }
+            runs.back().second = i + 1;
+        }
+        std::vector<bool> to_child(runs.size(), false);
+        if (count > Bucket::kCapacity)
+        {
+            std::vector<std::size_t> by_length(runs.size());
+            std::iota(by_length.begin(), by_length.end(), 0);
+            std::stable_sort(by_length.begin(), by_length.end(), [&runs](std::size_t a, std::size_t b)
+                             { return runs[a].second - runs[a].first > runs[b].second - runs[b].first; });
+            std::size_t entries = count;
+            for (std::size_t i = 0; i < by_length.size() && entries > Bucket::kCapacity; i++)
+            {
+                const std::size_t length = runs[by_length[i]].second - runs[by_length[i]].first;
+                if (length < 2)
+                {
+                    break; // 剩下的两两之间字节都不同，只能挂溢出桶
+                }
+                to_child[by_length[i]] = true;
+                entries -= length - 1;
+            }
+        }
+        for (std::size_t r = 0; r < runs.size(); r++)
+        {
+            const uint8_t branch = static_cast<uint8_t>(pairs[grouped[runs[r].first]].first[start_pos]);
+            const std::size_t length = runs[r].second - runs[r].first;
+            if (to_child[r] && length <= kCompactCapacity)
+            {
+                // 和add_child_node一样，键不多的子节点建成紧凑节点，这一段本来就是按key排好序的
+                CompactNode *compact = create_compact(arena_, branch, static_cast<int>(length));
+                for (std::size_t i = 0; i < length; i++)
+                {
+                    const KVPair &pair = pairs[grouped[runs[r].first + i]];
+                    compact->entries()[i] = arena_->create<KVPair>(pair);
+                    compact->fingerprints[i] = Bucket::key_fingerprint(pair.first);
+                }
+                put_entry(segment, bucket_index, Bucket::from_compact(compact), branch);
+                continue;
+            }
+            if (to_child[r])
+            {
+                MERTNode *child = arena_->create<MERTNode>(epoch_, arena_, counters_, value_log_);
+                child->bulk_build(pairs, std::vector<std::size_t>(grouped.begin() + runs[r].first, grouped.begin() + runs[r].second), start_pos);
+                put_entry(segment, bucket_index, Bucket::from_node(child), branch);
+                continue;
+            }
+            for (std::size_t i = runs[r].first; i < runs[r].second; i++)
+            {
+                const KVPair &pair = pairs[grouped[i]];
+                put_entry(segment, bucket_index, Bucket::from_kv(arena_->create<KVPair>(pair)), Bucket::key_fingerprint(pair.first));
+            }
+        }
+    }
+}
+
+// 子节点的prefix必须从start_pos开始，所以这里求的是从start_pos开始的公共前缀，而不是任意位置的公共子串
+template <typename Config>
+std::string_view MERTNode<Config>::longestCommonSubstringBetweenTwo(std::string_view s1, std::string_view s2, int start_pos)
+{
+    std::size_t len = std::min(s1.length(), s2.length());
+    std::size_t end_pos = start_pos; // 记录公共前缀的结束位置
+    while (end_pos < len && s1[end_pos] == s2[end_pos])
+    {
+        end_pos++;
+    }
+    if (end_pos <= static_cast<std::size_t>(start_pos))
+    {
+        return std::string_view();
+    }
+    return s1.substr(start_pos, end_pos - start_pos);
+}
+
+// 查找字符串数组从 start_pos 开始，任意两个字符串间的最长公共前缀
+template <typename Config>
+std::string_view MERTNode<Config>::longestCommonSubstringAmongTwo(const std::vector<std::string_view> &strs, int start_pos)
+{
+    // 两两比较是O(n^2)的，生成子节点时都要调一次，单独计时看看它占了多少
+    counters_->add(MERTCounter::CommonPrefixCall);
+    MERTCounters::Timer timer(counters_, MERTCounter::CommonPrefixNanos);
+    std::string_view longest;
+    int n = strs.size();
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = i + 1; j < n; ++j)
+        {
+            std::string_view current = longestCommonSubstringBetweenTwo(strs[i], strs[j], start_pos);
+            if (current.length() > longest.length())
+            {
+                longest = current; // 更新最长公共前缀
+            }
+        }
+    }
+    return longest;
+}
+
+template <typename Config>
+void BasicMERT<Config>::insert(std::string_view key, std::string_view value)
+{
+    insert(key, std::string(value));
+}
+
+template <typename Config>
+void BasicMERT<Config>::insert(std::string_view key, std::string &&value)
+{
+    if (key.empty())
+    {
+        return; // 空键没有前缀可以匹配，不支持
+    }
+    if (wal_ == nullptr)
+    {
+        // 首先创造根节点
+        root_.insert(key, std::move(value));
+        return;
+    }
+    // 同一个key的写者在条带锁里先写日志再改树，日志里的先后和树上的先后一致，放锁之后再等落盘
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> guard(wal_->key_lock(key));
+        lsn = wal_->append(MERTWal::RecordType::Put, key, value);
+        root_.insert(key, std::move(value));
+    }
+    wal_->commit(lsn);
+}
+
+template <typename Config>
+bool BasicMERT<Config>::search(std::string_view key, std::string &value) const
+{
+    return root_.search(key, value);
+}
+
+template <typename Config>
+std::size_t BasicMERT<Config>::multi_get(const std::string_view *keys, std::size_t count, std::string *values, bool *found) const
+{
+    return root_.multi_get(keys, count, values, found);
+}
+
+template <typename Config>
+bool BasicMERT<Config>::erase(std::string_view key)
+{
+    if (key.empty())
+    {
+        return false;
+    }
+    if (wal_ == nullptr)
+    {
+        return root_.erase(key);
+    }
+    // 不存在的key不用写日志
+    uint64_t lsn = 0;
+    {
+        std::lock_guard<std::mutex> guard(wal_->key_lock(key));
+        if (!root_.erase(key))
+        {
+            return false;
+        }
+        lsn = wal_->append(MERTWal::RecordType::Erase, key, std::string_view());
+    }
+    wal_->commit(lsn);
+    return true;
+}
+
+template <typename Config>
+bool MERTRootNode<Config>::erase(std::string_view key)
+{
+    counters_.add(MERTCounter::Erase);
+    auto guard = epoch_.pin();
+    const uint8_t i = cal_BucketIndex(key);
+    Node *nodePtr = root_bucket[i].node_entry.load(std::memory_order_acquire);
+    if (root_bucket[i].snapshot_chunks.load(std::memory_order_acquire) != 0)
+    {
+        // key所在的块还没插进树里、快照里也没有这个键的话，树里也不会有，不用把这一块插进树里
+        std::size_t index;
+        const std::size_t chunk = snapshot_->chunk_of(i, key, index);
+        if ((index == snapshot_->end(i) || snapshot_->key_at(index) != key) && !chunk_done_[root_bucket[i].chunk_base + chunk].load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        nodePtr = node_for_write(key);
+    }
+    if (nodePtr == nullptr)
+    {
+        return false;
+    }
+    // 根桶里的节点不会被合并掉，空了也留着
+    return nodePtr->erase_from_node(nodePtr, key, 0);
+}
+
+template <typename Config>
+bool MERTRootNode<Config>::search(std::string_view key, std::string &value) const
+{
+    if (key.empty())
+    {
+        return false;
+    }
+    counters_.add(MERTCounter::Search);
+    auto guard = epoch_.pin();
+    const uint8_t i = cal_BucketIndex(key);
+    // 先看根桶里还有没有块在快照里，再查树，反过来的话查树之后才插进树里的块会被当成没有这个键
+    const bool partial = root_bucket[i].snapshot_chunks.load(std::memory_order_acquire) != 0;
+    const Node *nodePtr = root_bucket[i].node_entry.load(std::memory_order_acquire);
+    // 根节点下的MERTNode的prefix是从key的第0个字节开始的
+    if (nodePtr != nullptr && nodePtr->search_in_node(key, 0, value))
+    {
+        return true;
+    }
+    return partial && search_snapshot(i, key, value);
+}
+
+template <typename Config>
+bool MERTRootNode<Config>::search_snapshot(uint8_t i, std::string_view key, std::string &value) const
+{
+    std::size_t index;
+    const std::size_t chunk = snapshot_->chunk_of(i, key, index);
+    if (!chunk_done_[root_bucket[i].chunk_base + chunk].load(std::memory_order_acquire))
+    {
+        if (index == snapshot_->end(i) || snapshot_->key_at(index) != key)
+        {
+            return false;
+        }
+        value.assign(snapshot_->value_at(index));
+        return true;
+    }
+    // 块插进树里之前节点就已经发布了
+    return root_bucket[i].node_entry.load(std::memory_order_acquire)->search_in_node(key, 0, value);
+}
+
+template <typename Config>
+std::size_t MERTRootNode<Config>::multi_get(const std::string_view *keys, std::size_t count, std::string *values, bool *found) const
+{
+    constexpr int kWidth = BasicMERT<Config>::kMultiGetWidth;
+    counters_.add(MERTCounter::Search, count);
+    auto guard = epoch_.pin();
+    // AMAC：kWidth个槽位轮流推进，一个查找结束了就在它的槽位上开始下一个键，槽位一直是满的
+    typename Node::Lookup lookups[kWidth];
+    std::size_t owner[kWidth];
+    bool partial[kWidth];
+    int active = 0;
+    std::size_t next = 0;
+    std::size_t hits = 0;
+    // 在槽位slot上开始下一个需要走树的键，空键、没有节点的根桶里的键直接出结果，返回是否开始了
+    auto start_next = [&](int slot)
+    {
+        while (next < count)
+        {
+            const std::size_t i = next++;
+            found[i] = false;
+            if (keys[i].empty())
+            {
+                continue;
+            }
+            const uint8_t first = static_cast<uint8_t>(keys[i][0]);
+            // 和search一样先看根桶里还有没有块在快照里，树里没找到的话再看快照
+            const bool in_snapshot = root_bucket[first].snapshot_chunks.load(std::memory_order_acquire) != 0;
+            const Node *nodePtr = root_bucket[first].node_entry.load(std::memory_order_acquire);
+            if (nodePtr == nullptr)
+            {
+                found[i] = in_snapshot && search_snapshot(first, keys[i], values[i]);
+                hits += found[i];
+                continue;
+            }
+            lookups[slot].start(nodePtr, keys[i], &values[i]);
+            owner[slot] = i;
+            partial[slot] = in_snapshot;
+            return true;
+        }
+        return false;
+    };
+    while (active < kWidth && start_next(active))
+    {
+        active++;
+    }
+    while (active > 0)
+    {
+        for (int slot = 0; slot < active;)
+        {
+            if (lookups[slot].advance())
+            {
+                slot++;
+                continue;
+            }
+            const std::size_t i = owner[slot];
+            found[i] = lookups[slot].found || (partial[slot] && search_snapshot(static_cast<uint8_t>(keys[i][0]), keys[i], values[i]));
+            hits += found[i];
+            if (!start_next(slot))
+            {
+                // 没有键了，把最后一个槽位挪过来，继续推进这个位置
+                active--;
+                lookups[slot] = lookups[active];
+                owner[slot] = owner[active];
+                partial[slot] = partial[active];
+            }
+            else
+            {
+                slot++;
+            }
+        }
+    }
+    return hits;
+}
+
+template <typename Config>
+std::size_t BasicMERT<Config>::scan(std::string_view start, std::string_view end, const ScanCallback &callback, std::size_t limit) const
+{
+    if (limit == 0 || (!end.empty() && start >= end))
+    {
+        return 0;
+    }
+    typename Node::ScanState state{start, end, &callback, limit};
+    root_.scan(state);
+    return state.count;
+}
+
+template <typename Config>
+std::size_t BasicMERT<Config>::prefix_scan(std::string_view prefix, const ScanCallback &callback, std::size_t limit) const
+{
+    // 以prefix开头的键都小于把prefix最后一个不是0xFF的字节加一之后的串，全是0xFF的话就没有上界
+    std::string end(prefix);
+    while (!end.empty() && static_cast<uint8_t>(end.back()) == 0xFF)
+    {
+        end.pop_back();
+    }
+    if (!end.empty())
+    {
+        end.back() = static_cast<char>(static_cast<uint8_t>(end.back()) + 1);
+    }
+    return scan(prefix, end, callback, limit);
+}
+
+template <typename Config>
+void MERTRootNode<Config>::scan(ScanState &state) const
+{
+    auto guard = epoch_.pin();
+    std::string path;
+    // 根桶的下标就是key[0]，按下标从小到大就是按key[0]从小到大
+    for (int i = state.start.empty() ? 0 : static_cast<uint8_t>(state.start[0]); i < 256; i++)
+    {
+        if (root_bucket[i].snapshot_chunks.load(std::memory_order_acquire) != 0)
+        {
+            if (!scan_partial(i, path, state))
+            {
+                return;
+            }
+            continue;
+        }
+        const Node *nodePtr = root_bucket[i].node_entry.load(std::memory_order_acquire);
+        if (nodePtr != nullptr && !nodePtr->scan_node(path, state))
+        {
+            return;
+        }
+    }
+}
+
+template <typename Config>
+bool MERTRootNode<Config>::scan_partial(uint8_t i, std::string &path, ScanState &state) const
+{
+    std::size_t index;
+    const std::size_t chunks = snapshot_->chunks(i);
+    for (std::size_t chunk = snapshot_->chunk_of(i, state.start, index); chunk < chunks; chunk++)
+    {
+        // 这一块管的键是[low, high)，第0块往前、最后一块往后都不限
+        const std::string_view low = chunk == 0 ? std::string_view() : snapshot_->key_at(snapshot_->chunk_begin(i, chunk));
+        const std::string_view high = chunk + 1 == chunks ? std::string_view() : snapshot_->key_at(snapshot_->chunk_begin(i, chunk + 1));
+        if (!state.end.empty() && !low.empty() && low >= state.end)
+        {
+            return false;
+        }
+        if (chunk_done_[root_bucket[i].chunk_base + chunk].load(std::memory_order_acquire))
+        {
+            // 在树里的块：把范围收窄到这一块再遍历树
+            ScanState range = state;
+            range.start = std::max(state.start, low);
+            if (!high.empty() && (range.end.empty() || high < range.end))
+            {
+                range.end = high;
+            }
+            root_bucket[i].node_entry.load(std::memory_order_acquire)->scan_node(path, range);
+            state.count = range.count;
+            if (range.stopped)
+            {
+                state.stopped = true;
+                return false;
+            }
+            continue;
+        }
+        // 快照里的条目本来就是排好序的，从这一块里第一个>=start的开始往后走
+        for (std::size_t entry = std::max(index, snapshot_->chunk_begin(i, chunk)); entry < snapshot_->chunk_begin(i, chunk + 1); entry++)
+        {
+            const std::string_view key = snapshot_->key_at(entry);
+            if (!state.end.empty() && key >= state.end)
+            {
+                return false;
+            }
+            state.count++;
+            if (!(*state.callback)(key, snapshot_->value_at(entry)) || state.count >= state.limit)
+            {
+                state.stopped = true;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename Config>
+MERTNode<Config>::MERTNode(EpochManager *epoch, MERTArena *arena, MERTCounters *counters, MERTValueLog *value_log)
+    : epoch_(epoch), arena_(arena), counters_(counters), value_log_(value_log)
+{
+    // 初始化一下prefix
+    for (int i = 0; i < kPrefixWords; i++)
+    {
+        header.prefix_words[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < kPrefixLength; i++)
+    {
+        total_value[i].store(nullptr, std::memory_order_relaxed);
+        header.prefix[i].prefix_index = i;
+        for (int j = 0; j < kSegmentCount; j++)
+        {
+            /* 先都指向共享的空段，第一次有键进入这半边目录时才创建真正的段 */
+            header.prefix[i].segments[j].store(empty_segment(), std::memory_order_relaxed);
+        }
+    }
+}
+
+template <typename Config>
+MERTNode<Config>::~MERTNode()
+{
+    // 节点里的目录和节点外分配了的目录一样释放
+    auto destroy_directory = [this](PrefixDirectory &directory, std::atomic<std::string *> &total)
+    {
+        Segment *prev = nullptr;
+        const DirectoryView view = directory.view();
+        for (int j = 0; j < view.size(); j++)
+        {
+            Segment *segment = view.slots[j].load(std::memory_order_relaxed);
+            if (segment == prev || segment == empty_segment())
+            {
+                continue; // 一个段占的是连续的几个目录项，共享的空段不属于任何节点
+            }
+            prev = segment;
+            for (auto &head : segment->buckets)
+            {
+                for (Bucket *bucket = head.load(std::memory_order_relaxed); bucket != nullptr; bucket = bucket->overflow.load(std::memory_order_relaxed))
+                {
+                    for (auto &slot : bucket->entries)
+                    {
+                        typename Bucket::EntryType entry = slot.load(std::memory_order_relaxed);
+                        if (entry == 0)
+                        {
+                            continue;
+                        }
+                        if (Bucket::is_compact(entry))
+                        {
+                            CompactNode *compact = Bucket::to_compact(entry);
+                            for (int k = 0; k < compact->count; k++)
+                            {
+                                arena_->destroy(compact->entries()[k]);
+                            }
+                            destroy_compact(arena_, compact);
+                        }
+                        else if (Bucket::is_node(entry))
+                        {
+                            arena_->destroy(Bucket::to_node(entry));
+                        }
+                        else
+                        {
+                            arena_->destroy(Bucket::to_kv(entry));
+                        }
+                    }
+                }
+            }
+            destroy_segment(arena_, segment);
+        }
+        // 翻倍过的话segments里是翻倍之前的旧段指针，那些段已经交给EpochManager了
+        destroy_table(arena_, directory.table.load(std::memory_order_relaxed));
+        arena_->destroy(total.load(std::memory_order_relaxed));
+    };
+    for (int i = 0; i < kPrefixLength; i++)
+    {
+        destroy_directory(header.prefix[i], total_value[i]);
+    }
+    if (PrefixTail *tail = header.tail.load(std::memory_order_relaxed))
+    {
+        for (uint32_t i = 0; i < tail->level_count; i++)
+        {
+            PrefixLevel *level = tail->levels()[i].level;
+            destroy_directory(level->directory, level->total_value);
+            arena_->destroy(level);
         }
+        destroy_tail(arena_, tail);
     }
-    return longest;
 }
 
-void MERT::insert(const std::string &key, const std::string &value)
+template <typename Config>
+MERTNode<Config>::Segment::Segment()
 {
-    // 首先创造根节点
-    root_.insert(key, value);
-    return;
+    local_depth = 0;
+    for (auto &bucket : buckets)
+    {
+        bucket.store(nullptr, std::memory_order_relaxed);
+    }
 }
 
-MERTNode::MERTNode()
+template <typename Config>
+typename MERTNode<Config>::Segment *MERTNode<Config>::empty_segment()
 {
-    total_value.reserve(6);
-    // 初始化一下prefix
-    for (int i = 0; i < 6; i++)
+    // 所有树、所有节点共享的一个空段，local_depth为0，没有任何桶，也不会有人写它
+    static Segment empty;
+    return &empty;
+}
+
+template <typename Config>
+void MERTNode<Config>::destroy_segment(MERTArena *arena, Segment *segment)
+{
+    for (auto &head : segment->buckets)
     {
-        header.prefix[i].prefix_index = i;
-        header.prefix[i].segments.resize(16);
-        for (int j = 0; j < 16; j++)
+        Bucket *bucket = head.load(std::memory_order_relaxed);
+        while (bucket != nullptr)
         {
-            /* 创建segment对象，否则会段错误 */
-            header.prefix[i].segments[j] = std::make_shared<MERTNode::Segment>();
+            Bucket *next = bucket->overflow.load(std::memory_order_relaxed);
+            arena->destroy(bucket);
+            bucket = next;
         }
     }
+    arena->destroy(segment);
 }
 
-MERTNode::Segment::Segment()
+template <typename Config>
+typename MERTNode<Config>::SegmentTable *MERTNode<Config>::create_table(MERTArena *arena, int global_depth)
 {
-    local_depth = 0;
-    buckets.reserve(256);
+    const std::size_t count = std::size_t(1) << global_depth;
+    void *memory = arena->allocate(sizeof(SegmentTable) + count * sizeof(std::atomic<Segment *>));
+    SegmentTable *table = new (memory) SegmentTable;
+    table->global_depth = global_depth;
+    table->slots = reinterpret_cast<std::atomic<Segment *> *>(table + 1);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        new (&table->slots[i]) std::atomic<Segment *>(nullptr);
+    }
+    return table;
+}
+
+template <typename Config>
+void MERTNode<Config>::destroy_table(MERTArena *arena, SegmentTable *table)
+{
+    if (table == nullptr)
+    {
+        return;
+    }
+    // 段指针是原子的指针，不用析构
+    arena->deallocate(table, sizeof(SegmentTable) + (std::size_t(1) << table->global_depth) * sizeof(std::atomic<Segment *>));
+}
+
+template <typename Config>
+typename MERTNode<Config>::CompactNode *MERTNode<Config>::create_compact(MERTArena *arena, uint8_t branch, int count)
+{
+    CompactNode *compact = new (arena->allocate(CompactNode::size(count))) CompactNode();
+    compact->branch = branch;
+    compact->count = static_cast<uint8_t>(count);
+    return compact;
+}
+
+template <typename Config>
+void MERTNode<Config>::destroy_compact(MERTArena *arena, CompactNode *compact)
+{
+    arena->deallocate(compact, CompactNode::size(compact->count));
+}
+
+template <typename Config>
+typename MERTNode<Config>::PrefixTail *MERTNode<Config>::create_tail(MERTArena *arena, uint32_t length, uint32_t level_count)
+{
+    PrefixTail *tail = new (arena->allocate(PrefixTail::size(length, level_count))) PrefixTail();
+    tail->length = length;
+    tail->level_count = level_count;
+    return tail;
+}
+
+template <typename Config>
+void MERTNode<Config>::destroy_tail(MERTArena *arena, PrefixTail *tail)
+{
+    arena->deallocate(tail, PrefixTail::size(tail->length, tail->level_count));
+}
+
+template <typename Config>
+MERTNode<Config>::PrefixLevel::PrefixLevel(int position)
+{
+    directory.prefix_index = position;
+    for (auto &segment : directory.segments)
+    {
+        segment.store(empty_segment(), std::memory_order_relaxed);
+    }
+}
+
+template <typename Config>
+typename MERTNode<Config>::PrefixLevel *MERTNode<Config>::PrefixTail::find(int position) const
+{
+    // 分配了目录的位置不多，按位置二分
+    const LevelRef *first = levels();
+    const LevelRef *last = first + level_count;
+    const LevelRef *found = std::lower_bound(first, last, position, [](const LevelRef &ref, int value)
+                                             { return static_cast<int>(ref.position) < value; });
+    return found != last && static_cast<int>(found->position) == position ? found->level : nullptr;
+}
+
+template <typename Config>
+typename MERTNode<Config>::PrefixDirectory *MERTNode<Config>::PrefixView::directory(int level) const
+{
+    if (level < kPrefixLength)
+    {
+        return const_cast<PrefixDirectory *>(&node->header.prefix[level]);
+    }
+    PrefixLevel *found = tail->find(level);
+    return found == nullptr ? nullptr : &found->directory;
+}
+
+template <typename Config>
+std::atomic<std::string *> *MERTNode<Config>::PrefixView::total_value(int level) const
+{
+    if (level < kPrefixLength)
+    {
+        return const_cast<std::atomic<std::string *> *>(&node->total_value[level]);
+    }
+    PrefixLevel *found = tail->find(level);
+    return found == nullptr ? nullptr : &found->total_value;
+}
+
+template <typename Config>
+int MERTNode<Config>::PrefixView::next_level(int level) const
+{
+    if (level + 1 < kPrefixLength)
+    {
+        return level + 1;
+    }
+    if (tail != nullptr)
+    {
+        for (uint32_t i = 0; i < tail->level_count; i++)
+        {
+            if (static_cast<int>(tail->levels()[i].position) > level)
+            {
+                return static_cast<int>(tail->levels()[i].position);
+            }
+        }
+    }
+    return length;
+}
+
+template <typename Config>
+uint32_t MERTNode<Config>::CompactNode::match(uint8_t fingerprint) const
+{
+    const uint32_t valid = count == 32 ? ~0u : (1u << count) - 1;
+#if defined(__SSE2__)
+    // 和桶一样一条比较16个指纹，最多两条
+    const __m128i target = _mm_set1_epi8(static_cast<char>(fingerprint));
+    uint32_t equal = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(fingerprints)), target)));
+    if (count > 16)
+    {
+        equal |= static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(fingerprints + 16)), target))) << 16;
+    }
+    return equal & valid;
+#else
+    uint32_t equal = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (fingerprints[i] == fingerprint)
+        {
+            equal |= 1u << i;
+        }
+    }
+    return equal;
+#endif
+}
+
+template <typename Config>
+int MERTNode<Config>::CompactNode::find(std::string_view key, uint8_t fingerprint) const
+{
+    for (uint32_t candidates = match(fingerprint); candidates != 0; candidates &= candidates - 1)
+    {
+        const int index = __builtin_ctz(candidates);
+        if (entries()[index]->first == key)
+        {
+            return index;
+        }
+    }
+    return -1;
+}
+
+template <typename Config>
+int MERTNode<Config>::CompactNode::lower_bound(std::string_view key) const
+{
+    return static_cast<int>(std::lower_bound(entries(), entries() + count, key, [](const KVPair *kv, std::string_view target)
+                                             { return std::string_view(kv->first) < target; }) -
+                            entries());
+}
+
+template <typename Config>
+MERTNode<Config>::Bucket::Bucket()
+{
+    fingerprints[0].store(0, std::memory_order_relaxed);
+    fingerprints[1].store(0, std::memory_order_relaxed);
+    for (auto &slot : entries)
+    {
+        slot.store(0, std::memory_order_relaxed);
+    }
+}
+
+template <typename Config>
+uint8_t MERTNode<Config>::Bucket::branch_of(EntryType entry)
+{
+    if (is_compact(entry))
+    {
+        return to_compact(entry)->branch;
+    }
+    return static_cast<uint8_t>(to_node(entry)->prefix_byte(0));
+}
+
+template <typename Config>
+uint8_t MERTNode<Config>::Bucket::key_fingerprint(std::string_view key)
+{
+    // std::hash<std::string_view>和std::hash<std::string>对同样的字节结果相同
+    return static_cast<uint8_t>(std::hash<std::string_view>{}(key) >> (8 * (sizeof(std::size_t) - 1)));
+}
+
+template <typename Config>
+uint32_t MERTNode<Config>::Bucket::match(uint8_t fingerprint, bool node) const
+{
+    // 先读位图，写者是最后才写位图的，读到位图里的位时对应的指纹已经写好了
+    const uint32_t bits = bitmap.load(std::memory_order_acquire);
+    const uint32_t node_bits = bits >> 16;
+    const uint32_t candidates = bits & kSlotMask & (node ? node_bits : ~node_bits);
+    if (candidates == 0)
+    {
+        return 0;
+    }
+    const uint64_t low = fingerprints[0].load(std::memory_order_relaxed);
+    const uint64_t high = fingerprints[1].load(std::memory_order_relaxed);
+#if defined(__SSE2__)
+    // 16个指纹正好是一个128位寄存器，一次比较得到所有相等的槽位
+    const __m128i all = _mm_set_epi64x(static_cast<long long>(high), static_cast<long long>(low));
+    const __m128i equal = _mm_cmpeq_epi8(all, _mm_set1_epi8(static_cast<char>(fingerprint)));
+    return candidates & static_cast<uint32_t>(_mm_movemask_epi8(equal));
+#else
+    uint32_t equal = 0;
+    for (int i = 0; i < kCapacity; i++)
+    {
+        const uint64_t word = i < 8 ? low : high;
+        if (static_cast<uint8_t>(word >> (8 * (i % 8))) == fingerprint)
+        {
+            equal |= 1u << i;
+        }
+    }
+    return candidates & equal;
+#endif
+}
+
+template <typename Config>
+int MERTNode<Config>::Bucket::first_free() const
+{
+    const uint32_t free_slots = ~bitmap.load(std::memory_order_relaxed) & kSlotMask;
+    return free_slots == 0 ? -1 : __builtin_ctz(free_slots);
+}
+
+template <typename Config>
+uint8_t MERTNode<Config>::Bucket::fingerprint_at(int slot) const
+{
+    return static_cast<uint8_t>(fingerprints[slot / 8].load(std::memory_order_relaxed) >> (8 * (slot % 8)));
+}
+
+template <typename Config>
+void MERTNode<Config>::Bucket::put(int slot, EntryType entry, uint8_t fingerprint)
+{
+    std::atomic<uint64_t> &word = fingerprints[slot / 8];
+    const int shift = 8 * (slot % 8);
+    word.store((word.load(std::memory_order_relaxed) & ~(uint64_t{0xFF} << shift)) | (uint64_t{fingerprint} << shift),
+               std::memory_order_relaxed);
+    entries[slot].store(entry, std::memory_order_release);
+    uint32_t bits = bitmap.load(std::memory_order_relaxed) | (1u << slot);
+    if (is_node(entry))
+    {
+        bits |= 1u << (slot + 16);
+    }
+    else
+    {
+        bits &= ~(1u << (slot + 16));
+    }
+    bitmap.store(bits, std::memory_order_release);
+}
+
+template <typename Config>
+void MERTNode<Config>::Bucket::erase(int slot)
+{
+    // 先从位图里去掉，读者就不会再把它当成候选
+    bitmap.store(bitmap.load(std::memory_order_relaxed) & ~((1u << slot) | (1u << (slot + 16))), std::memory_order_release);
+    entries[slot].store(0, std::memory_order_release);
+}
+
+template <typename Config>
+MERTRootNode<Config>::MERTRootNode() : root_bucket(256)
+{
+    if constexpr (Node::kValueLogThreshold > 0)
+    {
+        value_log_.reset(new MERTValueLog(&epoch_));
+    }
+} // 初始化根节点的桶，桶里是原子指针，不能resize，只能直接构造
+
+template <typename Config>
+std::string MERTRootNode<Config>::store_value(std::string &&value)
+{
+    if constexpr (Node::kValueLogThreshold == 0)
+    {
+        return std::move(value);
+    }
+    else
+    {
+        return value_log_->store(value, Node::kValueLogThreshold);
+    }
+}
+
+template <typename Config>
+MERTRootNode<Config>::~MERTRootNode()
+{
+    for (auto &bucket : root_bucket)
+    {
+        arena_.destroy(bucket.node_entry.load(std::memory_order_relaxed));
+    }
+}
+
+template <typename Config>
+BasicMERT<Config>::BasicMERT()
+{
+    if constexpr (Node::kValueLogThreshold > 0)
+    {
+        start_value_log_compaction(std::chrono::milliseconds(1000));
+    }
+}
+
+template <typename Config>
+std::size_t BasicMERT<Config>::memory_usage() const
+{
+    return root_.memory_usage();
+}
+
+template <typename Config>
+std::size_t MERTRootNode<Config>::memory_usage() const
+{
+    return arena_.reserved_bytes();
+}
+
+template <typename Config>
+MERTSkewReport BasicMERT<Config>::skew_report() const
+{
+    return root_.skew_report();
+}
+
+template <typename Config>
+MERTSkewReport MERTRootNode<Config>::skew_report() const
+{
+    MERTSkewReport report;
+    report.keys_per_slot.assign(Node::kSegmentCount, 0);
+    report.segments_by_depth.assign(Node::kMaxGlobalDepth + 1, 0);
+    report.bucket_fill.assign(Node::Bucket::kCapacity + 1, 0);
+    auto guard = epoch_.pin();
+    for (const RootBucket &bucket : root_bucket)
+    {
+        const Node *node = bucket.node_entry.load(std::memory_order_acquire);
+        if (node != nullptr)
+        {
+            node->collect_skew(0, 1, report);
+        }
+    }
+    return report;
+}
+
+template <typename Config>
+MERTStats MERTRootNode<Config>::stats() const
+{
+    MERTStats stats;
+    stats.inserts = counters_.total(MERTCounter::Insert);
+    stats.searches = counters_.total(MERTCounter::Search);
+    stats.erases = counters_.total(MERTCounter::Erase);
+    stats.segment_splits = counters_.total(MERTCounter::SegmentSplit);
+    stats.directory_doublings = counters_.total(MERTCounter::DirectoryDoubling);
+    stats.child_node_calls = counters_.total(MERTCounter::ChildNodeCall);
+    stats.child_node_failures = counters_.total(MERTCounter::ChildNodeFailure);
+    stats.segment_merges = counters_.total(MERTCounter::SegmentMerge);
+    stats.child_collapses = counters_.total(MERTCounter::ChildCollapse);
+    stats.compact_promotions = counters_.total(MERTCounter::CompactPromotion);
+    stats.compact_demotions = counters_.total(MERTCounter::CompactDemotion);
+    stats.common_prefix_calls = counters_.total(MERTCounter::CommonPrefixCall);
+    stats.common_prefix_nanos = counters_.total(MERTCounter::CommonPrefixNanos);
+    stats.search_levels = counters_.total(MERTCounter::SearchLevels);
+    stats.probe_buckets = counters_.total(MERTCounter::ProbeBuckets);
+    stats.probe_key_compares = counters_.total(MERTCounter::ProbeKeyCompares);
+    for (int i = 0; i < MERTCounters::kProbeHistogram; i++)
+    {
+        stats.probe_length.push_back(counters_.probe_length(i));
+    }
+    stats.shape = skew_report();
+    stats.bucket_capacity = Node::Bucket::kCapacity;
+    stats.memory_bytes = memory_usage();
+    if (snapshot_ != nullptr)
+    {
+        stats.snapshot_bytes = snapshot_->mapped_bytes();
+        for (const RootBucket &bucket : root_bucket)
+        {
+            const std::size_t chunks = bucket.snapshot_chunks.load(std::memory_order_acquire);
+            stats.snapshot_partitions += chunks != 0;
+            stats.snapshot_chunks += chunks;
+        }
+    }
+    if (value_log_ != nullptr)
+    {
+        stats.value_log_bytes = value_log_->reserved_bytes();
+        stats.value_log_live_bytes = value_log_->live_bytes();
+    }
+    return stats;
+}
+
+template <typename Config>
+bool BasicMERT<Config>::save_snapshot(const std::string &path) const
+{
+    return root_.save_snapshot(path);
+}
+
+template <typename Config>
+bool BasicMERT<Config>::open_snapshot(const std::string &path)
+{
+    return root_.open_snapshot(path);
+}
+
+template <typename Config>
+bool BasicMERT<Config>::open_wal(const std::string &path, const MERTWalOptions &options)
+{
+    if (wal_ != nullptr)
+    {
+        return false;
+    }
+    // 重放时直接改树，不再写日志
+    auto apply = [this](MERTWal::RecordType type, std::string_view key, std::string_view value)
+    {
+        if (type == MERTWal::RecordType::Put)
+        {
+            root_.insert(key, std::string(value));
+        }
+        else
+        {
+            root_.erase(key);
+        }
+    };
+    std::size_t records = 0;
+    if (!MERTWal::replay(path + ".prev", apply, records) || !MERTWal::replay(path, apply, records))
+    {
+        return false;
+    }
+    wal_ = MERTWal::open(path, options);
+    return wal_ != nullptr;
+}
+
+template <typename Config>
+bool BasicMERT<Config>::checkpoint(const std::string &snapshot_path)
+{
+    if (wal_ == nullptr)
+    {
+        return save_snapshot(snapshot_path);
+    }
+    if (!wal_->rotate() || !save_snapshot(snapshot_path))
+    {
+        return false;
+    }
+    wal_->drop_previous();
+    return true;
+}
+
+template <typename Config>
+int BasicMERT<Config>::wal_error() const
+{
+    return wal_ == nullptr ? 0 : wal_->error();
+}
+
+template <typename Config>
+bool MERTRootNode<Config>::save_snapshot(const std::string &path) const
+{
+    // scan是按无符号字节序从小到大回调的，正好是快照要求的顺序
+    MERTSnapshot::Writer writer(path);
+    typename Node::ScanCallback callback = [&writer](std::string_view key, std::string_view value)
+    {
+        return writer.add(key, value);
+    };
+    ScanState state{std::string_view(), std::string_view(), &callback, SIZE_MAX};
+    scan(state);
+    return writer.finish();
+}
+
+template <typename Config>
+bool MERTRootNode<Config>::open_snapshot(const std::string &path)
+{
+    if (snapshot_ != nullptr)
+    {
+        return false;
+    }
+    for (const RootBucket &bucket : root_bucket)
+    {
+        if (bucket.node_entry.load(std::memory_order_acquire) != nullptr)
+        {
+            return false; // 只能在空树上打开
+        }
+    }
+    snapshot_ = MERTSnapshot::open(path);
+    if (snapshot_ == nullptr)
+    {
+        return false;
+    }
+    // 每个根桶的块在chunk_done_里连续排着，还没有别的线程在用这棵树，直接写
+    std::size_t total = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        root_bucket[i].chunk_base = total;
+        root_bucket[i].snapshot_chunks.store(snapshot_->chunks(i), std::memory_order_relaxed);
+        total += snapshot_->chunks(i);
+    }
+    chunk_done_ = std::make_unique<std::atomic<bool>[]>(total);
+    for (std::size_t c = 0; c < total; c++)
+    {
+        chunk_done_[c].store(false, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+template <typename Config>
+MERTStats BasicMERT<Config>::stats() const
+{
+    return root_.stats();
+}
+
+template <typename Config>
+void BasicMERT<Config>::start_stats_dump(std::chrono::milliseconds interval, std::function<void(const MERTStats &)> hook)
+{
+    stats_task_.start(interval, [this, hook = std::move(hook)]()
+                      { hook(stats()); });
+}
+
+template <typename Config>
+void BasicMERT<Config>::stop_stats_dump()
+{
+    stats_task_.stop();
+}
+
+template <typename Config>
+void BasicMERT<Config>::start_value_log_compaction(std::chrono::milliseconds interval, double min_garbage_ratio)
+{
+    compaction_task_.start(interval, [this, min_garbage_ratio]()
+                           { compact_value_log(min_garbage_ratio); });
+}
+
+template <typename Config>
+void BasicMERT<Config>::stop_value_log_compaction()
+{
+    compaction_task_.stop();
 }
 
-MERTRootNode::MERTRootNode()
+template <typename Config>
+std::size_t BasicMERT<Config>::compact_value_log(double min_garbage_ratio)
 {
-    root_bucket.reserve(256);
-} // 初始化根节点的桶
+    MERTValueLog *log = root_.value_log();
+    return log == nullptr ? 0 : log->compact(min_garbage_ratio);
+}
+
+template <typename Config>
+BasicMERT<Config>::~BasicMERT()
+{
+    stats_task_.stop();
+    compaction_task_.stop();
+}
+
+double MERTStats::bucket_occupancy() const
+{
+    if (shape.buckets == 0)
+    {
+        return 0;
+    }
+    std::size_t used = 0;
+    for (std::size_t fill = 0; fill < shape.bucket_fill.size(); fill++)
+    {
+        used += fill * shape.bucket_fill[fill];
+    }
+    return static_cast<double>(used) / (shape.buckets * bucket_capacity);
+}
 
-MERT::MERT()
+void MERTStats::dump(std::ostream &out) const
 {
-    root_ = MERTRootNode();
+    auto per = [](uint64_t total, uint64_t count)
+    {
+        return count == 0 ? 0.0 : static_cast<double>(total) / count;
+    };
+    out << "形状: 键 " << shape.keys << "，节点 " << shape.nodes << "(紧凑节点 " << shape.compact_nodes << "，prefix接到节点外的 " << shape.long_prefixes << "，最长prefix "
+        << shape.max_prefix_length << ")，最大深度 " << shape.max_depth << "，键平均深度 "
+        << per(shape.key_levels, shape.keys) << "，段 " << shape.segments << "(翻倍过的目录 " << shape.grown_directories << ")"
+        << "，桶 " << shape.buckets << "(溢出桶 " << shape.overflow_buckets << ")，桶占用率 " << bucket_occupancy() * 100
+        << "%，内存池 " << memory_bytes / (1024 * 1024) << "MB\n";
+    if (snapshot_bytes != 0)
+    {
+        out << "快照: 映射 " << snapshot_bytes / (1024 * 1024) << "MB，还有 " << snapshot_partitions << " 个根桶的 " << snapshot_chunks << " 块没插进树里、直接读快照\n";
+    }
+    if (value_log_bytes != 0)
+    {
+        out << "value日志: " << value_log_bytes / (1024 * 1024) << "MB，其中活着的value " << value_log_live_bytes / (1024 * 1024) << "MB\n";
+    }
+    out << "段深度分布:";
+    for (std::size_t depth = 0; depth < shape.segments_by_depth.size(); depth++)
+    {
+        out << " " << depth << ":" << shape.segments_by_depth[depth];
+    }
+    out << "\n";
+    if (!counters_enabled)
+    {
+        out << "计数器在编译时关掉了(MERT_ENABLE_STATS=0)\n";
+        return;
+    }
+    out << "操作: 插入 " << inserts << "，查找 " << searches << "，删除 " << erases << "\n";
+    out << "结构变化: 段分裂 " << segment_splits << "，目录翻倍 " << directory_doublings << "，生成子节点 " << child_node_calls << "(失败 " << child_node_failures
+        << ")，段合并 " << segment_merges << "，子节点合并 " << child_collapses << "，紧凑节点升级 " << compact_promotions << "、降级 "
+        << compact_demotions << "\n";
+    out << "最长公共前缀: 调用 " << common_prefix_calls << " 次，共 " << common_prefix_nanos / 1000000.0 << "ms，平均 "
+        << per(common_prefix_nanos, common_prefix_calls) << "ns\n";
+    out << "查找: 平均经过 " << per(search_levels, searches) << " 个节点，每层平均读 " << per(probe_buckets, search_levels)
+        << " 个桶、比较 " << per(probe_key_compares, search_levels) << " 次key\n";
+    out << "桶链长度分布:";
+    for (std::size_t length = 0; length < probe_length.size(); length++)
+    {
+        out << " " << length << (length + 1 == probe_length.size() ? "+:" : ":") << probe_length[length];
+    }
+    out << "\n";
 }
+
+// 实现都在这个文件里，用到的配置在这里显式实例化
+template class MERTNode<MERTConfig>;
+template class MERTRootNode<MERTConfig>;
+template class BasicMERT<MERTConfig>;
+template class MERTNode<MERTSmallKeyConfig>;
+template class MERTRootNode<MERTSmallKeyConfig>;
+template class BasicMERT<MERTSmallKeyConfig>;
+template class MERTNode<MERTLongKeyConfig>;
+template class MERTRootNode<MERTLongKeyConfig>;
+template class BasicMERT<MERTLongKeyConfig>;
+template class MERTNode<MERTMixedHashConfig>;
+template class MERTRootNode<MERTMixedHashConfig>;
+template class BasicMERT<MERTMixedHashConfig>;
+template class MERTNode<MERTValueLogConfig>;
+template class MERTRootNode<MERTValueLogConfig>;
+template class BasicMERT<MERTValueLogConfig>;
+template class MERTNode<MERTU64Config>;
+template class MERTRootNode<MERTU64Config>;
+template class BasicMERT<MERTU64Config>;
+template class MERTNode<MERTGrowingDirectoryConfig>;
+template class MERTRootNode<MERTGrowingDirectoryConfig>;
+template class BasicMERT<MERTGrowingDirectoryConfig>;
+template class MERTNode<MERTSingleWriterConfig<MERTConfig>>;
+template class MERTRootNode<MERTSingleWriterConfig<MERTConfig>>;
+template class BasicMERT<MERTSingleWriterConfig<MERTConfig>>;
+template class MERTNode<MERTSingleWriterConfig<MERTMixedHashConfig>>;
+template class MERTRootNode<MERTSingleWriterConfig<MERTMixedHashConfig>>;
+template class BasicMERT<MERTSingleWriterConfig<MERTMixedHashConfig>>;
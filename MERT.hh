@@ -6,11 +6,22 @@
 #include <memory>
 #include <mutex>
 #include <shared_mutex>
+#include <type_traits>
 #include <atomic>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <cstdint>
 #include <optional>
+#include <chrono>
+#include <iosfwd>
+#include "EpochManager.hh"
+#include "MERTArena.hh"
+#include "MERTCounters.hh"
+#include "MERTPeriodicTask.hh"
+#include "MERTSnapshot.hh"
+#include "MERTValueLog.hh"
+#include "MERTWal.hh"
 
 // key的类型只能是string！键的类型也只能是string，给我输入都换成string，草！
 // 我的代码我做主！
@@ -18,50 +29,402 @@
 // =========================
 // 1. 配置结构体：MERTConfig
 // =========================
+// 段索引和桶索引的取法，first为key[0]，branch为prefix后的第一个字节(分叉字节)
+// 子节点是按分叉字节找的(它的prefix[0])，同一个分叉字节的键和子节点必须落在同一个段的同一个桶里，
+// 所以两个索引都只能由这两个字节决定，不能用后面的字节
+// 段索引取segment_byte的低segment_bits位，目录翻倍之后再接着取它剩下的高位，桶索引取bucket_byte的低bucket_bits位
+struct MERTRawBitsIndex
+{
+    // 原来的取法：段索引是分叉字节的低位，桶索引是key[0]，一个节点里所有的键都进同一个桶
+    // 目录项和字节的低位一一对应，适合有序遍历
+    static constexpr bool kBucketByBranch = false;
+    static uint8_t segment_byte(uint8_t branch) { return branch; }
+    static uint8_t bucket_byte(uint8_t first, uint8_t) { return first; }
+};
+
+struct MERTMixedHashIndex
+{
+    // 段索引用打散之后的分叉字节，十进制数字、小写字母这种只占低位一小段的字节也能均匀地分到各个段
+    // 桶索引用分叉字节本身，同一个段里不同分叉字节的键进不同的桶，一个桶满了只说明这一个字节的键多，
+    // 这时段分裂分不开它们，会直接生成子节点。遍历时要扫段里所有的桶，适合点查为主的负载
+    static constexpr bool kBucketByBranch = true;
+    static uint8_t segment_byte(uint8_t branch)
+    {
+        // 8位上的双射：乘奇数、异或右移都可逆，常数是让'0'~'9'、'a'~'z'在各级local_depth下都分得比较匀的一组
+        uint8_t x = static_cast<uint8_t>(branch * 0x5F);
+        x ^= x >> 5;
+        x = static_cast<uint8_t>(x * 0x3B);
+        x ^= x >> 4;
+        return x;
+    }
+    static uint8_t bucket_byte(uint8_t, uint8_t branch) { return branch; }
+};
+
+// 树的形状在编译期定下来，MERTNode/MERT按它实例化，段索引、桶索引的掩码和各处的循环边界都是常量
+// 新加一种配置的话要在MERT.cc的最后显式实例化一下
 struct MERTConfig
 {
-    // int span = 16;           // 一次处理多少位，比如 16 bits
-    int bucket_capacity = 16; // 每个桶最多存多少键值对
-    int segment_size = 256;   // 每个段最多多少个桶
-    int back_num = 8;         // 最多桶的数量为2^back_num=256
-    int global_depth = 4;     // 最多有2^4=16个段
+    static constexpr int prefix_length = 6;    // prefix的前几个字节连同它们的目录放在节点里，更长的prefix接在节点外(PrefixTail)
+    static constexpr int segment_bits = 4;     // 段索引取prefix后第一个字节的低几位，也就是初始的global_depth，每个目录2^4=16个段
+    // 段分到segment_bits位还要分的话目录翻倍，global_depth最多到几位，到了才生成子节点
+    // 默认不翻倍：扇出小的子节点先是紧凑节点，很便宜，翻倍换来的浅一层抵不上多出来的段指针表和半空的段(见GrowingDirectoryMERT)
+    static constexpr int max_segment_bits = 4;
+    static constexpr int bucket_bits = 8;      // 桶索引取key[0]的低几位，每个段2^8=256个桶
+    static constexpr int bucket_capacity = 16; // 每个桶最多存多少键值对，只能是8或16
+    static constexpr int compact_capacity = 32; // 子节点不超过这么多个键时存成紧凑节点(排好序的数组)，超过了才建目录和段，最多32
+    using index_policy = MERTRawBitsIndex;     // 段索引和桶索引的取法
+    static constexpr std::size_t value_log_threshold = 0; // 不短于这么多字节的value放进value日志(见MERTValueLog.hh)，0表示不用
+    // 为true时写者之间不加锁(节点锁、目录锁、段锁都换成MERTNoLock)，调用者要保证同一个根桶同一时刻只有一个写者，读者本来就不加锁
+    static constexpr bool single_writer = false;
+};
+
+// 短key：一个根桶下的键key[0]都相同，每个段其实只会用到一个桶，所以桶索引不取位，段从2KB缩到几十字节
+// prefix短一些节点头更小(桶容量不减，减成8的话子节点变多，反而更占内存)
+struct MERTSmallKeyConfig
+{
+    static constexpr int prefix_length = 4;
+    static constexpr int segment_bits = 4;
+    static constexpr int max_segment_bits = 4;
+    static constexpr int bucket_bits = 0;
+    static constexpr int bucket_capacity = 16;
+    static constexpr int compact_capacity = 32;
+    using index_policy = MERTRawBitsIndex;
+    static constexpr std::size_t value_log_threshold = 0;
+    static constexpr bool single_writer = false;
+};
+
+// 长key：公共前缀长，节点里多放几个字节的目录，分叉在前十几个字节上的话不用到节点外找目录
+struct MERTLongKeyConfig
+{
+    static constexpr int prefix_length = 12;
+    static constexpr int segment_bits = 4;
+    static constexpr int max_segment_bits = 4;
+    static constexpr int bucket_bits = 0;
+    static constexpr int bucket_capacity = 16;
+    static constexpr int compact_capacity = 32;
+    using index_policy = MERTRawBitsIndex;
+    static constexpr std::size_t value_log_threshold = 0;
+    static constexpr bool single_writer = false;
+};
+
+// 点查为主的负载：默认形状，段索引打散，桶按分叉字节分开
+struct MERTMixedHashConfig : MERTConfig
+{
+    using index_policy = MERTMixedHashIndex;
+};
+
+// 64位整数键(insert_u64等)：一律8个字节，key[0]是最高字节，一个根桶下的键key[0]都相同，桶索引不取位，和短key一样
+// 分叉字节是原始的二进制字节，低位本来就是匀的，段索引直接取低位
+// 连续分配的ID高位的几个0字节一个节点就压缩掉了，prefix取4到8查找差不多，短一些节点头小、省内存
+struct MERTU64Config
+{
+    static constexpr int prefix_length = 4;
+    static constexpr int segment_bits = 4;
+    static constexpr int max_segment_bits = 4;
+    static constexpr int bucket_bits = 0;
+    static constexpr int bucket_capacity = 16;
+    static constexpr int compact_capacity = 32;
+    using index_policy = MERTRawBitsIndex;
+    static constexpr std::size_t value_log_threshold = 0;
+    static constexpr bool single_writer = false;
+};
+
+// 目录翻倍到8位：段分满之后先翻倍目录，分叉字节的8位都用完了才生成子节点，树浅一些，但多占内存，查找也不见得快，用来对比(数字见README)
+struct MERTGrowingDirectoryConfig : MERTConfig
+{
+    static constexpr int max_segment_bits = 8;
+};
+
+// value从几十字节到几KB不等：长value放进value日志，键值对只带一个句柄，覆盖留下的空间由后台整理回收
+struct MERTValueLogConfig : MERTConfig
+{
+    static constexpr std::size_t value_log_threshold = 128;
+};
+
+// 分片模式(MERTSharded.hh)的树：每个根桶同一时刻只归一个worker，只有它写，写者之间的锁都省掉
+template <typename Base>
+struct MERTSingleWriterConfig : Base
+{
+    static constexpr bool single_writer = true;
+};
+
+// single_writer的配置里代替写者之间的锁，什么都不做
+struct MERTNoLock
+{
+    void lock() {}
+    bool try_lock() { return true; }
+    void unlock() {}
+    void lock_shared() {}
+    bool try_lock_shared() { return true; }
+    void unlock_shared() {}
+};
+
+// 键在段和桶之间的分布，用来比较不同的索引取法，由MERT::skew_report()统计
+struct MERTSkewReport
+{
+    std::size_t keys = 0;             // 段桶里的键值对数，不含完全匹配在prefix上的
+    std::size_t nodes = 0;            // 节点数(包括根桶里的)
+    std::size_t segments = 0;         // 真正分配了的段，不含共享的空段
+    std::size_t buckets = 0;          // 分配了的桶，包括溢出桶
+    std::size_t overflow_buckets = 0; // 其中的溢出桶
+    std::size_t max_depth = 0;        // 最深的节点在第几层，根桶里的节点为第1层
+    std::size_t key_levels = 0;       // 每个键所在的节点在第几层，加起来，除以keys就是查到一个键平均要经过几个节点
+    std::size_t grown_directories = 0; // 翻倍过(global_depth超过segment_bits)的目录
+    std::size_t compact_nodes = 0;     // nodes里的紧凑节点，它们没有段和桶
+    std::size_t long_prefixes = 0;     // prefix超过prefix_length、有一部分放在节点外的节点
+    std::size_t max_prefix_length = 0; // 最长的一个节点prefix
+    std::vector<std::size_t> keys_per_slot;     // 按段索引(目录项)统计的键值对数
+    std::vector<std::size_t> segments_by_depth; // 下标为local_depth
+    std::vector<std::size_t> bucket_fill;       // 下标为桶里的条目数(键值对和子节点)
+};
+
+// MERT::stats()的结果：热路径上的累计计数(编译时关掉的话都是0)，加上遍历得到的当前形状
+struct MERTStats
+{
+    bool counters_enabled = MERT_ENABLE_STATS;
+    uint64_t inserts = 0;
+    uint64_t searches = 0;
+    uint64_t erases = 0;
+    uint64_t segment_splits = 0;
+    uint64_t directory_doublings = 0; // 目录翻倍
+    uint64_t child_node_calls = 0;
+    uint64_t child_node_failures = 0; // 生成不了子节点，只能挂溢出桶
+    uint64_t segment_merges = 0;
+    uint64_t child_collapses = 0;
+    uint64_t compact_promotions = 0;  // 紧凑节点装不下了升级成MERTNode
+    uint64_t compact_demotions = 0;   // MERTNode删到只剩很少的键降回紧凑节点
+    uint64_t common_prefix_calls = 0; // longestCommonSubstringAmongTwo
+    uint64_t common_prefix_nanos = 0;
+    uint64_t search_levels = 0;       // 查找经过的节点数之和
+    uint64_t probe_buckets = 0;       // 查找读过的桶数之和
+    uint64_t probe_key_compares = 0;  // 比较完整key的次数之和
+    std::vector<uint64_t> probe_length; // 下标为一次桶链查找读过的桶数，最后一项为这么多及以上
+    MERTSkewReport shape;             // 节点、段、桶的数量和桶的填充分布
+    std::size_t bucket_capacity = 0;
+    std::size_t memory_bytes = 0;     // 内存池向系统要的字节数
+    std::size_t snapshot_bytes = 0;   // 打开的快照映射了多少字节
+    std::size_t snapshot_partitions = 0; // 还有块没插进树里、要读快照的根桶数
+    std::size_t snapshot_chunks = 0;  // 快照里还没插进树里的块数
+    std::size_t value_log_bytes = 0;  // value日志向系统要的字节数，没有开键值分离时为0
+    std::size_t value_log_live_bytes = 0; // 其中还活着的value占的字节数，其余的等整理回收
+
+    // 桶里被占用的槽位(键值对和子节点)占全部槽位的比例
+    double bucket_occupancy() const;
+    // 输出成几行人能看的文字，定期输出的钩子里可以直接用
+    void dump(std::ostream &out) const;
 };
 
 // =============================
 // 2. MERTNode 声明
 // =============================
+template <typename Config>
 class MERTNode
 {
 public:
+    static constexpr int kPrefixLength = Config::prefix_length;
+    static constexpr int kGlobalDepth = Config::segment_bits;
+    static constexpr int kSegmentCount = 1 << kGlobalDepth;
+    static constexpr uint8_t kSegmentMask = kSegmentCount - 1;
+    static constexpr int kMaxGlobalDepth = Config::max_segment_bits;
+    static constexpr int kBucketBits = Config::bucket_bits;
+    static constexpr int kBucketCount = 1 << kBucketBits;
+    static constexpr int kCompactCapacity = Config::compact_capacity;
+    static constexpr int kPrefixWords = (kPrefixLength + 7) / 8;
+    using IndexPolicy = typename Config::index_policy;
+    static constexpr std::size_t kValueLogThreshold = Config::value_log_threshold;
+    // 写者之间的锁，single_writer的配置里是空的
+    using WriterMutex = std::conditional_t<Config::single_writer, MERTNoLock, std::mutex>;
+    using WriterSharedMutex = std::conditional_t<Config::single_writer, MERTNoLock, std::shared_mutex>;
+    static_assert(kPrefixLength > 0, "节点至少要有一个前缀字节");
+    static_assert(kGlobalDepth > 0 && kGlobalDepth <= 8, "段索引取的是一个字节里的位");
+    static_assert(kMaxGlobalDepth >= kGlobalDepth && kMaxGlobalDepth <= 8, "目录翻倍也只能取到一个字节里的位");
+    static_assert(kBucketBits >= 0 && kBucketBits <= 8, "桶索引取的是key[0]里的位");
+    static_assert(kCompactCapacity > Config::bucket_capacity && kCompactCapacity <= 32, "紧凑节点要比一个桶装得多，指纹按最多32个排布");
+
+    // 键值对一旦挂到桶里就不再修改，更新value时是换一个新的键值对，旧的交给EpochManager回收
+    using KVPair = std::pair<std::string, std::string>;
+    // 遍历时的回调，返回false表示不要再往下遍历了
+    using ScanCallback = std::function<bool(std::string_view key, std::string_view value)>;
+    // 一次遍历的范围和进度，end为空表示没有上界
+    struct ScanState
+    {
+        std::string_view start;
+        std::string_view end;
+        const ScanCallback *callback;
+        std::size_t limit;
+        std::size_t count = 0;
+        bool stopped = false; // 回调返回了false或者到了数量上限，和走出了范围区分开
+    };
+    struct CompactNode;
+
     // -------------------------
     // 2.1 桶结构声明
     // -------------------------
     struct Bucket
     {
         // bucket里面可以存key-value或者指针
-        using EntryType = std::variant<std::pair<std::string, std::string>, std::shared_ptr<MERTNode>>;
-        std::vector<std::optional<EntryType>> entries;
+        // 槽位里存的是带标记的指针：0为空，最低位为1是子节点指针，否则是键值对指针
+        // 子节点有两种，最低两位为01是MERTNode，为11是紧凑节点(CompactNode)，位图里都算子节点
+        // 键值对换成子节点只是一次原子写，读者读到的槽位不会半新半旧，所以类型以槽位里的标记为准
+        using EntryType = uintptr_t;
+        static constexpr int kCapacity = Config::bucket_capacity; // 桶容量
+        static constexpr uint32_t kSlotMask = (1u << kCapacity) - 1;
+        static_assert(kCapacity == 8 || kCapacity == 16, "指纹和位图按最多16个槽位排布，槽位要占满整个缓存行");
+
+        /* 第一个缓存行是查找时要读的元数据：指纹、位图、版本号、溢出桶
+         * 查找先用一条SIMD比较在16个指纹里找出候选槽位，一般只会剩一个，再去读槽位和比较完整的key
+         * 后面是kCapacity个槽位(一个或两个缓存行)，sizeof为64的倍数，从MERTArena分配时整个桶是缓存行对齐的 */
+        // 每个槽位一个字节的指纹，键值对是key的哈希，子节点是它的prefix[0]，16个字节拼成两个原子字
+        std::atomic<uint64_t> fingerprints[2];
+        // 低16位：槽位是否被占用，高16位：槽位是否是子节点，写者在槽位和指纹写好之后才更新位图
+        std::atomic<uint32_t> bitmap{0};
+        // 生成子节点搬走键值对时前后各加一，读者没找到时用它判断是不是刚好碰上了搬动，要重新找
+        // 只记在桶链的第一个桶上
+        std::atomic<uint32_t> version{0};
+        // 桶满了又生成不了子节点时挂的溢出桶
+        std::atomic<Bucket *> overflow{nullptr};
+        char padding[64 - 2 * sizeof(uint64_t) - 2 * sizeof(uint32_t) - sizeof(Bucket *)];
+        std::atomic<EntryType> entries[kCapacity];
+
+        Bucket();
+
+        static bool is_node(EntryType entry) { return (entry & 1) != 0; }
+        static bool is_compact(EntryType entry) { return (entry & 3) == 3; }
+        static KVPair *to_kv(EntryType entry) { return reinterpret_cast<KVPair *>(entry); }
+        static MERTNode *to_node(EntryType entry) { return reinterpret_cast<MERTNode *>(entry & ~static_cast<EntryType>(3)); }
+        static CompactNode *to_compact(EntryType entry) { return reinterpret_cast<CompactNode *>(entry & ~static_cast<EntryType>(3)); }
+        static EntryType from_kv(KVPair *kv) { return reinterpret_cast<EntryType>(kv); }
+        static EntryType from_node(MERTNode *node) { return reinterpret_cast<EntryType>(node) | 1; }
+        static EntryType from_compact(CompactNode *compact) { return reinterpret_cast<EntryType>(compact) | 3; }
+        // 子节点在父节点里分叉的字节，也就是它在桶里的指纹：MERTNode是它的prefix[0]，紧凑节点是branch
+        static uint8_t branch_of(EntryType entry);
+        // 键值对的指纹，取key的哈希的最高字节，和桶索引、段索引用到的字节无关
+        static uint8_t key_fingerprint(std::string_view key);
+
+        // 返回指纹等于fingerprint、类型为node(子节点)或者键值对的槽位掩码，读者写者都可以调用
+        // 结果只是候选，读者还要以槽位里的标记和完整的key为准
+        uint32_t match(uint8_t fingerprint, bool node) const;
+        // 第一个空槽位的下标，没有则返回-1
+        int first_free() const;
+        uint8_t fingerprint_at(int slot) const;
+        // 以下两个只有写者调用，要持有段锁(或桶还没有发布)
+        // 先写指纹和槽位，最后写位图，读者看到位图里的位时指纹和槽位都已经写好了
+        void put(int slot, EntryType entry, uint8_t fingerprint);
+        void erase(int slot);
     };
+    static_assert(sizeof(Bucket) % 64 == 0, "桶要占整数个缓存行");
 
     // -------------------------
     // 2.2 段结构声明
     // -------------------------
     struct Segment
     {
-        std::vector<Bucket> buckets;
+        // 桶在第一次写入时才分配，读者通过原子指针读取
+        std::atomic<Bucket *> buckets[kBucketCount];
         uint8_t local_depth = 0;
-     //   mutable std::shared_mutex seg_lock;
+        // 只有写者改桶时持有，读者不加锁
+        mutable WriterMutex seg_lock;
 
         // 段构造函数
         Segment();
     };
+    // 紧凑节点：add_child_node生成的子节点一开始只有十几个键，为它建节点头、目录、段和桶要好几KB，
+    // 所以先只存这些键值对按key排好序的数组，超过kCompactCapacity个键时才升级成MERTNode，
+    // MERTNode删到不超过kDemoteThreshold个键(而且没有更深的子节点)时再降回紧凑节点
+    // 发布之后就不再修改：写者持有父桶所在段的段锁，拷贝一份改好之后原子地替换父桶里的槽位，旧的交给EpochManager
+    // 里面只有键值对，没有更深的子节点
+    struct alignas(sizeof(void *)) CompactNode
+    {
+        // 每个键的指纹，和桶里键值对的指纹一样，查找时先比指纹，count之后的不用
+        uint8_t fingerprints[32];
+        // 这些键在父节点里分叉的字节
+        uint8_t branch;
+        uint8_t count;
+
+        // count个键值对指针紧跟在后面，按key从小到大，从内存池按实际个数分配
+        KVPair **entries() { return reinterpret_cast<KVPair **>(this + 1); }
+        KVPair *const *entries() const { return reinterpret_cast<KVPair *const *>(this + 1); }
+        static std::size_t size(int count) { return sizeof(CompactNode) + count * sizeof(KVPair *); }
+        // 指纹等于fingerprint的下标掩码
+        uint32_t match(uint8_t fingerprint) const;
+        // key的下标，没有则返回-1
+        int find(std::string_view key, uint8_t fingerprint) const;
+        // 第一个不小于key的下标，也就是key要插入的位置
+        int lower_bound(std::string_view key) const;
+    };
+    // 目录翻倍之后的段指针表，2^global_depth项紧跟在后面，从内存池按实际大小分配
+    struct SegmentTable
+    {
+        int global_depth;
+        std::atomic<Segment *> *slots;
+    };
+    // 目录现在用的段指针数组，读者读一次之后就一直用这一份，期间目录翻倍了也没关系，旧表等读者离开后才释放
+    // 目录项是段编码(segment_code)的前global_depth位，local_depth为d的段占连续的size()>>d项
+    struct DirectoryView
+    {
+        std::atomic<Segment *> *slots;
+        int global_depth;
+
+        int size() const { return 1 << global_depth; }
+        int index(uint8_t code) const { return code >> (8 - global_depth); }
+        std::atomic<Segment *> &slot(uint8_t code) const { return slots[index(code)]; }
+    };
     // 每一个前缀字节都有属于自己的目录，查询时用最长前缀匹配
     struct PrefixDirectory
     {
-        char c{0};
-       // mutable std::shared_mutex prefix_lock;
-        std::vector<std::shared_ptr<Segment>> segments;
+        // 段分到了kGlobalDepth位还要分时目录翻倍，之后segments不再使用，段指针都在这张表里
+        // 再翻倍时换一张新表，旧表交给EpochManager，目录只会翻倍不会缩小
+        std::atomic<SegmentTable *> table{nullptr};
+        // 写者之间保护segments这些段指针，只有生成新段、段分裂和目录翻倍时才会持有写锁，读者不加锁
+        mutable WriterSharedMutex prefix_lock;
+        // 段分裂时新段是原子地替换进来的，旧段交给EpochManager回收
+        std::atomic<Segment *> segments[kSegmentCount];
         int prefix_index; // 用于标记是第几个前缀,从0开始
+
+        DirectoryView view() const
+        {
+            std::atomic<Segment *> *inline_slots = const_cast<std::atomic<Segment *> *>(segments);
+            if constexpr (kMaxGlobalDepth == kGlobalDepth)
+            {
+                return DirectoryView{inline_slots, kGlobalDepth};
+            }
+            else
+            {
+                const SegmentTable *grown = table.load(std::memory_order_acquire);
+                return grown == nullptr ? DirectoryView{inline_slots, kGlobalDepth} : DirectoryView{grown->slots, grown->global_depth};
+            }
+        }
+    };
+
+    // prefix超过kPrefixLength个字节的位置上的目录和total_value，有键在这个位置上分叉或者结束时才分配，分配之后一直留到节点释放
+    struct PrefixLevel
+    {
+        PrefixDirectory directory;
+        std::atomic<std::string *> total_value{nullptr};
+
+        explicit PrefixLevel(int position);
+    };
+    // prefix超过kPrefixLength个字节的部分(路径压缩)：字节连续存放，长的公共前缀不用再拆成一串子节点
+    // 只有少数几个位置上真的有键分叉或者结束，这些位置的PrefixLevel按位置排好序记在字节前面
+    // 发布之后不再修改，写者(持有节点写锁)扩展prefix或者多一个位置时拷一份换上去，旧的交给EpochManager
+    struct PrefixTail
+    {
+        struct LevelRef
+        {
+            uint32_t position; // 在prefix里的下标，不小于kPrefixLength
+            PrefixLevel *level;
+        };
+        uint32_t length;      // prefix[kPrefixLength]开始的字节数
+        uint32_t level_count; // 分配了PrefixLevel的位置数
+
+        // 后面先是level_count个LevelRef，再是length个字节，从内存池按实际大小分配
+        LevelRef *levels() { return reinterpret_cast<LevelRef *>(this + 1); }
+        const LevelRef *levels() const { return reinterpret_cast<const LevelRef *>(this + 1); }
+        char *bytes() { return reinterpret_cast<char *>(levels() + level_count); }
+        const char *bytes() const { return reinterpret_cast<const char *>(levels() + level_count); }
+        static std::size_t size(uint32_t length, uint32_t level_count) { return sizeof(PrefixTail) + level_count * sizeof(LevelRef) + length; }
+        // position处的PrefixLevel，没有分配的话返回nullptr
+        PrefixLevel *find(int position) const;
     };
 
     // -------------------------
@@ -72,37 +435,209 @@ public:
         // std::atomic<int> depth{0}; // 节点层级深度(好像没啥用啊，debug时候用吧)
         // bool is_full{false};       // 这个是判断prefix是否已满，未满的话，符合前缀且比前缀长的话就会填入后续的prefix
         //  uint8_t prefix_length{0};  // 路径压缩用的前缀长度
-        PrefixDirectory prefix[6];
+        // prefix里已经写好的字节数，写者先写字节再用release发布长度，key里可以有0字节，不能靠字节是不是0来判断
+        // 这里只数节点里的kPrefixLength个，满了之后接着写在tail里
+        std::atomic<uint8_t> prefix_length{0};
+        // 节点里的prefix字节连续地放在一起，第i个字节在prefix_words[i / 8]的第i % 8个字节(从低位数)，
+        // 匹配时整个字读出来和key一起比较，不用一个目录一个目录地跳；写者在长度之后追加字节时读者可能在读同一个字，所以是原子的
+        std::atomic<uint64_t> prefix_words[kPrefixWords];
+        // prefix在节点外的部分，prefix_length到kPrefixLength之前一定是空的，写者先发布tail再发布prefix_length
+        std::atomic<PrefixTail *> tail{nullptr};
+        PrefixDirectory prefix[kPrefixLength];
+    };
+    // 读者读一次prefix的长度和节点外的部分之后就一直用这一份，期间prefix被扩展了也没关系：
+    // prefix只会往后加字节、加分配了目录的位置，已经读到的部分不会变
+    struct PrefixView
+    {
+        const MERTNode *node = nullptr;
+        const PrefixTail *tail = nullptr;
+        int length = 0;
+
+        char byte(int level) const
+        {
+            return level < kPrefixLength ? node->prefix_byte(level) : tail->bytes()[level - kPrefixLength];
+        }
+        // level处的目录和total_value，节点外的位置没有分配的话返回nullptr，说明没有键在这里分叉或者结束
+        PrefixDirectory *directory(int level) const;
+        std::atomic<std::string *> *total_value(int level) const;
+        // level之后下一个可能有键的位置：节点里的每个位置都算，节点外的只算分配了的，没有了返回length
+        int next_level(int level) const;
     };
 
 public:
     // -------------------------
     // 2.4 构造函数 & 接口声明
     // -------------------------
-    MERTNode();
+    // epoch为整棵树共用的回收器，被替换下来的段和键值对都交给它
+    // arena为整棵树共用的内存池，节点、段、桶、键值对都从这里分配
+    // counters为整棵树共用的事件计数器
+    // value_log为整棵树共用的value日志，没有开键值分离时为nullptr
+    MERTNode(EpochManager *epoch, MERTArena *arena, MERTCounters *counters, MERTValueLog *value_log);
+    // 释放整棵子树，调用时不能再有别的线程访问
+    ~MERTNode();
+    MERTNode(const MERTNode &) = delete;
+    MERTNode &operator=(const MERTNode &) = delete;
 public:
     // -------------------------
     // 2.5 工具函数声明
     // -------------------------
-    // 这里的key是完整的key，start为prefix后的第一个字节，提取该字节的后四位的前local_depth位
-    uint8_t extract_subkey_segment(const std::string &key, int local_depth, int start);
-    // 提取尾部的固定位，进入桶时需要
-    uint8_t extract_subkey_bucket(const std::string &key, int num);
-    // 段分裂，要指定是哪个前缀下的目录分裂，此时段分裂是还<=global_depth的情况
-    void split_segment(size_t segment_index, PrefixDirectory &directory, const uint16_t &global_depth);
-    // 二进制字符串转成十进制
-    int binary_to_decimal(const std::string &binary_str);
-    // 计算分裂后新的段索引，得到的是两个索引数组
-    void generate_new_segment_index(int binaryNumber, int local_depth, std::vector<int> &resultZero, std::vector<int> &resultOne);
-    // 添加子节点，进入下一层
-    void add_child_node(MERTNode *new_node, Bucket &bucket, int start_pos);
-    // 以下两个函数是查询字符串数组的从start_pos开始的两两之间最长的公共子串
-    std::string longestCommonSubstringBetweenTwo(const std::string &s1, const std::string &s2, int start_pos);
-    std::string longestCommonSubstringAmongTwo(const std::vector<std::string> &strs, int start_pos);
+    // 这里的key是完整的key，start为prefix后的第一个字节，提取该字节的段编码的前local_depth位，local_depth为8时是整个段编码
+    uint8_t extract_subkey_segment(std::string_view key, int local_depth, int start) const;
+    // 分叉字节的段编码：segment_byte循环左移，前kGlobalDepth位是原来的段索引(segment_byte的低位)，后面接着是剩下的高位
+    // 段和目录项都取它的前若干位，目录翻倍之后原来的段和目录项的位不变，只是多取一位
+    static uint8_t segment_code(uint8_t branch)
+    {
+        const uint8_t byte = IndexPolicy::segment_byte(branch);
+        return static_cast<uint8_t>((byte << (8 - kGlobalDepth)) | (byte >> kGlobalDepth));
+    }
+    // 分叉字节对应的初始段索引(kGlobalDepth位)
+    static uint8_t segment_slot(uint8_t branch) { return segment_code(branch) >> (8 - kGlobalDepth); }
+    // 桶索引，start同上，进入桶时需要
+    uint8_t extract_subkey_bucket(std::string_view key, int start) const;
+    // 桶满了时段分裂能不能把里面的条目分开：条目(连同要插入的key，段编码为code)的段编码前kMaxGlobalDepth位都相同的话，分裂只会多出空段
+    // start_pos为段索引所在的字节，调用时要持有段锁
+    bool split_helps(const Bucket &bucket, uint8_t code, int start_pos) const;
+    // 段分裂，要指定是哪个前缀下的目录分裂，code为要分裂的段里的某个段编码，此时段分裂是还<kMaxGlobalDepth的情况
+    // 段的local_depth已经等于目录的global_depth的话先把目录翻倍
+    // start_pos为该目录下段索引所在的字节(即prefix后的第一个字节)
+    // 内部会持有该目录和原段的写锁，调用时不能持有这两把锁
+    void split_segment(uint8_t code, PrefixDirectory &directory, int start_pos);
+    // 目录翻倍：每一项变成相邻的两项，指向同一个段，返回新的段指针数组，调用时要持有目录写锁(或本节点还没有发布)
+    DirectoryView grow_directory(PrefixDirectory &directory);
+    // 添加子节点，进入下一层，返回是否有键值对被移入了新节点，调用时要持有bucket所在段的写锁
+    // 成功的话新节点已经挂到了bucket里，搬过去的键不超过kCompactCapacity个时是紧凑节点，否则是MERTNode
+    bool add_child_node(Bucket &bucket, int start_pos);
+    // 把kvs(在start_pos处的字节都相同)建成一个还没有发布的MERTNode，prefix取它们从start_pos开始的最长公共前缀
+    // adopted[i]表示kvs[i]挂进了新节点的桶里，否则它的value拷进了total_value，发布之后要回收kvs[i]
+    // 调用方(add_child_node、promote_compact)持有父节点的段写锁，这里又走insert_to_new_node拿新节点的节点锁、目录锁、段锁，
+    // 锁的顺序是父节点->子节点，只有子节点还没发布、别的线程拿不到它的锁时才成立，见promote_compact
+    MERTNode *build_child(const std::vector<KVPair *> &kvs, int start_pos, std::vector<bool> &adopted);
+    // 以下三个调用时都要持有bucket所在段的写锁，slot为紧凑节点所在的槽位
+    // 把kv放进紧凑节点，key已经在里面的话换掉旧的键值对，返回false表示满了，要先升级
+    bool insert_to_compact(Bucket &bucket, int slot, KVPair *kv, uint8_t fingerprint);
+    // 紧凑节点升级成MERTNode，替换槽位之后返回新节点，start_pos为分叉字节的下标
+    MERTNode *promote_compact(Bucket &bucket, int slot, int start_pos);
+    // 从紧凑节点里删key，返回是否删掉了；剩下的键不超过kCollapseThreshold个、桶链里又放得下的话，和collapse_child一样放回父桶
+    bool erase_from_compact(Segment *segment, uint8_t bucket_index, Bucket &bucket, int slot, std::string_view key, uint8_t fingerprint);
+    // 以下两个函数是查询字符串数组的从start_pos开始的两两之间最长的公共前缀
+    // 返回的是指向strs里的键的string_view，不拷贝
+    std::string_view longestCommonSubstringBetweenTwo(std::string_view s1, std::string_view s2, int start_pos);
+    std::string_view longestCommonSubstringAmongTwo(const std::vector<std::string_view> &strs, int start_pos);
     // 生成新节点时将原来桶里的key-value插入到新的节点中，因为不知道和上面的insert是否有区别，所以先这么写
-    void insert_to_new_node(MERTNode *new_node, const std::string &key, const std::string &value, int start_pos, bool &not_this_node);
-    // 插入到段桶中
-    void insert_to_segment_bucket(MERTNode *new_node, const std::string &key, const std::string &value, int start_pos, int directory_index);
+    // kv是已经建好的键值对，键就是kv->first，插入路径上不再拷贝key和value
+    // 返回true表示kv本身挂进了桶里(归树所有)；返回false表示kv没有被树引用：not_this_node，或者key正好在prefix上结束，
+    // 这时value放进了total_value，movable时是从kv->second移过去的(kv还没有别人能看到)，否则是拷贝
+    bool insert_to_new_node(MERTNode *new_node, KVPair *kv, int start_pos, bool &not_this_node, bool movable);
+    // 插入到段桶中，如果key应该进入桶里的子节点，则返回该子节点(此时已经不持有任何锁)，否则返回nullptr
+    // 返回this_node说明它已经被合并回父节点了，要从头重新插入
+    // 返回nullptr时kv已经挂进了桶里
+    MERTNode *insert_to_segment_bucket(MERTNode *new_node, KVPair *kv, int start_pos, int directory_index);
+    // 删除key，new_node为根桶里的节点，返回key原来是否存在
+    // 删完之后段的桶变空了会尝试和伙伴段合并，子节点剩下的键很少的话会合并回父节点的桶里
+    bool erase_from_node(MERTNode *new_node, std::string_view key, int start_pos);
+    // 从段桶中删除key，返回值和insert_to_segment_bucket一样，erased表示是否删掉了
+    MERTNode *erase_from_segment_bucket(MERTNode *this_node, std::string_view key, int start_pos, int directory_index, bool &erased);
+    // 段分裂的反过程：段和它的伙伴段(local_depth相同、段索引只有最后一位不同)加起来每个桶都不超过kMergeThreshold个时合成一个
+    // local_depth为1的段空了的话，这半边目录重新指向空段，内部持有目录的写锁
+    void merge_segment(uint8_t code, PrefixDirectory &directory);
+    // 子节点child(挂在prefix[directory_index]的目录里，prefix从start_pos开始)里没有更深的子节点且只剩不多的键时把它收掉：
+    // 不超过kCollapseThreshold个键而且本节点的桶链放得下的话放回桶里，否则不超过kDemoteThreshold个键时降级成紧凑节点
+    // child标记为已合并后交给EpochManager，key用来拼出child里完全匹配在prefix上的键
+    void collapse_child(MERTNode *child, int directory_index, std::string_view key, int start_pos);
+    // 合并段和合并子节点的阈值，比分裂的阈值(桶容量、紧凑节点的容量)小，避免反复分裂合并
+    static constexpr int kMergeThreshold = Bucket::kCapacity / 2;
+    static constexpr int kCollapseThreshold = Bucket::kCapacity / 4;
+    static constexpr int kDemoteThreshold = kCompactCapacity / 2;
+    // 在本节点(及其子节点)中查找key，start_pos为本节点prefix对应的key下标，找到的话拷贝到value
+    // 不加任何锁，调用时要处在EpochManager的临界区里
+    bool search_in_node(std::string_view key, int start_pos, std::string &value) const;
+    // 在一层的桶链head里找key：找到键值对就拷贝到value，key_index处的字节对应一个子节点就放到next里
+    // 碰上写者正在把键值对搬进子节点的话会重新找，不加锁，调用时要处在EpochManager的临界区里
+    enum class ProbeResult
+    {
+        Found,
+        Child,
+        Missing,
+    };
+    ProbeResult probe_level(const Bucket *head, std::string_view key, int key_index, uint8_t fingerprint, std::string &value,
+                            const MERTNode *&next) const;
+    // multi_get里一个进行中的查找。查找每往下一层都要经过几次相互依赖的访存(节点->段指针->段->桶->槽位->键值对)，
+    // 这里把它拆成几步，每一步只读上一步预取过的缓存行，再预取下一步要读的，多个查找轮流推进，等内存的时间就重叠起来了
+    struct Lookup
+    {
+        enum Stage : uint8_t
+        {
+            kNode,      // 匹配prefix，预取段指针
+            kDirectory, // 读段指针，预取段
+            kSegment,   // 读段里的桶指针，预取桶的元数据
+            kBucket,    // 比较指纹，预取候选槽位
+            kEntry,     // 读槽位，预取键值对
+            kCompare,   // 比较完整的key，或者进入子节点
+        };
+        std::string_view key;
+        std::string *value = nullptr;
+        const MERTNode *node = nullptr;
+        const std::atomic<Segment *> *segment_slot = nullptr;
+        const Segment *segment = nullptr;
+        const Bucket *head = nullptr;
+        const std::atomic<typename Bucket::EntryType> *candidate = nullptr; // 第一个候选槽位
+        int key_index = 0;
+        uint8_t fingerprint = 0;
+        uint8_t bucket_index = 0;
+        Stage stage = kNode;
+        bool found = false;
+
+        // 从node开始查找key，预取node
+        void start(const MERTNode *root, std::string_view lookup_key, std::string *out);
+        // 推进一步，返回false表示查找已经结束，结果在found和value里
+        // 不加锁，调用时要处在EpochManager的临界区里
+        bool advance();
+    };
+    // 按key从小到大遍历本节点(及其子节点)里在[state.start, state.end)中的键值对，path为本节点prefix之前的那部分key
+    // 不加锁，调用时要处在EpochManager的临界区里，返回false表示遍历要停止了(超出了范围、到了数量上限或者回调返回false)
+    bool scan_node(std::string &path, ScanState &state) const;
+    // 遍历prefix[level]这一层：完全匹配到prefix[level]的键、prefix[level]的目录里的键，以及更深的层
+    // path此时是本节点之前的key加上prefix[0..level]，prefix是scan_node开始时读到的那一份
+    bool scan_level(int level, const PrefixView &prefix, std::string &path, ScanState &state) const;
+    // 计算key从key_index开始和prefix的最长匹配，返回匹配长度，key_index会移到匹配结束的位置，prefix为匹配时读到的prefix
+    int match_prefix(std::string_view key, int &key_index, PrefixView &prefix) const;
+    // 读一份现在的prefix，读者不加锁
+    PrefixView prefix_view() const;
+    // 节点里的第level个prefix字节
+    char prefix_byte(int level) const { return static_cast<char>(header.prefix_words[level / 8].load(std::memory_order_relaxed) >> (8 * (level % 8))); }
+    // 把bytes接到prefix后面，节点里放满了的接到节点外，要持有节点写锁(或本节点还没有发布)
+    void extend_prefix(std::string_view bytes);
+    // 写者取level处的目录和total_value，节点外的位置还没有分配的话先分配，要持有节点写锁(或本节点还没有发布)
+    PrefixDirectory &directory_for_write(int level);
+    PrefixLevel *add_level(int level);
+    std::atomic<std::string *> &total_value_for_write(int level);
+    // level处已经分配了的目录，写者在放掉节点锁之后用，分配了的PrefixLevel不会再消失
+    PrefixDirectory &directory_at(int level) { return *prefix_view().directory(level); }
+    // 把entry(连同它的指纹)放到段里bucket_index对应桶的第一个空位上，桶满了就挂溢出桶，调用时要持有段的写锁(或段还没有发布)
+    void put_entry(Segment *segment, uint8_t bucket_index, typename Bucket::EntryType entry, uint8_t fingerprint);
+    // 批量建树：indices里是pairs的下标，按key排好序且没有重复，这些键都属于本节点，从start_pos开始匹配prefix
+    // 本节点还没有发布，不加锁，段直接按最终的local_depth建好，不会再分裂
+    void bulk_build(const std::vector<KVPair> &pairs, const std::vector<std::size_t> &indices, int start_pos);
+    // 把段编码的前local_depth位为segment_prefix的键建成段，桶放不下又还能分的话就按下一位分成两个段，分过了global_depth就先把目录翻倍
+    // start_pos为段索引所在的字节，local_depth为0时是整个目录
+    void bulk_build_segment(PrefixDirectory &directory, const std::vector<KVPair> &pairs, const std::vector<std::size_t> &indices,
+                            int start_pos, uint8_t segment_prefix, uint8_t local_depth);
+    // 统计本节点(及其子节点)的段、桶和键的分布，start_pos为本节点prefix对应的key下标，depth为本节点在第几层
+    // 调用时要处在EpochManager的临界区里
+    void collect_skew(int start_pos, std::size_t depth, MERTSkewReport &report) const;
+    // 共享的空段，新节点的目录项都先指向它，local_depth为0说明这半边目录还没有键进入过
+    static Segment *empty_segment();
+    // 把段连同它的桶(包括溢出桶)放回内存池，桶里的键值对和子节点可能已经被新段接管了，不在这里释放
+    static void destroy_segment(MERTArena *arena, Segment *segment);
+    // 目录翻倍用的段指针表，段指针都先置空
+    static SegmentTable *create_table(MERTArena *arena, int global_depth);
+    static void destroy_table(MERTArena *arena, SegmentTable *table);
+    // 放count个键值对的紧凑节点，键值对和指纹由调用者填；释放时只放回紧凑节点本身，键值对可能已经被别处接管了
+    static CompactNode *create_compact(MERTArena *arena, uint8_t branch, int count);
+    static void destroy_compact(MERTArena *arena, CompactNode *compact);
+    // 放length个字节、level_count个位置的节点外prefix，内容由调用者填；释放时只放回它本身，PrefixLevel还留在新的那份里
+    static PrefixTail *create_tail(MERTArena *arena, uint32_t length, uint32_t level_count);
+    static void destroy_tail(MERTArena *arena, PrefixTail *tail);
 
 private:
     // -------------------------
@@ -110,9 +645,75 @@ private:
     // -------------------------
     Header header;
     // 注意这个是完全匹配，如果是前缀完全匹配的话，但是完整的键不是完全匹配的话就要进入桶
-    std::vector<std::optional<std::string>> total_value; // 当键完全匹配时存储的键，下标即为匹配的键数量的数字
-    // 节点锁（保护本节点 directory、header 以及子结构操作）
-    //  mutable std::shared_mutex node_lock_;
+    std::atomic<std::string *> total_value[kPrefixLength]; // 当键完全匹配时存储的值，下标即为匹配的键数量的数字，节点外的在PrefixLevel里
+    // 节点锁（写者之间保护本节点 header的prefix字节、节点外的prefix 以及 total_value）
+    // prefix只会往后扩展，已经匹配的部分不会变，所以进入目录之后就不再持有节点锁
+    mutable WriterSharedMutex node_lock_;
+    // 已经被合并回父节点了，持有节点锁或任一目录锁时读，写者看到之后要从根桶的节点重新开始
+    bool collapsed_ = false;
+    EpochManager *epoch_;
+    MERTArena *arena_;
+    MERTCounters *counters_;
+    MERTValueLog *value_log_;
+
+    // 树里存的value(键值对的second、total_value)转回真正的value，读者要在epoch临界区里
+    std::string_view load_value(const std::string &stored) const
+    {
+        if constexpr (kValueLogThreshold == 0)
+        {
+            return stored;
+        }
+        else
+        {
+            return value_log_->load(stored);
+        }
+    }
+    // 存着的value被覆盖或删除了，在value日志里的话等读者离开后回收它的空间
+    void release_value(const std::string &stored)
+    {
+        if constexpr (kValueLogThreshold > 0)
+        {
+            value_log_->release(stored);
+        }
+    }
+
+    // 把摘下来的对象交给EpochManager，等读者都离开后放回内存池
+    template <typename T>
+    void retire(T *ptr)
+    {
+        epoch_->retire(
+            ptr, [](void *arena, void *p)
+            { static_cast<MERTArena *>(arena)->destroy(static_cast<T *>(p)); },
+            arena_);
+    }
+    void retire_segment(Segment *segment)
+    {
+        epoch_->retire(
+            segment, [](void *arena, void *p)
+            { destroy_segment(static_cast<MERTArena *>(arena), static_cast<Segment *>(p)); },
+            arena_);
+    }
+    void retire_table(SegmentTable *table)
+    {
+        epoch_->retire(
+            table, [](void *arena, void *p)
+            { destroy_table(static_cast<MERTArena *>(arena), static_cast<SegmentTable *>(p)); },
+            arena_);
+    }
+    void retire_compact(CompactNode *compact)
+    {
+        epoch_->retire(
+            compact, [](void *arena, void *p)
+            { destroy_compact(static_cast<MERTArena *>(arena), static_cast<CompactNode *>(p)); },
+            arena_);
+    }
+    void retire_tail(PrefixTail *tail)
+    {
+        epoch_->retire(
+            tail, [](void *arena, void *p)
+            { destroy_tail(static_cast<MERTArena *>(arena), static_cast<PrefixTail *>(p)); },
+            arena_);
+    }
 };
 
 
@@ -121,46 +722,242 @@ private:
  * 只有bucket
  *
  */
+template <typename Config>
 class MERTRootNode
 {
 public:
+    using Node = MERTNode<Config>;
+    using KVPair = typename Node::KVPair;
+    using ScanState = typename Node::ScanState;
     struct RootBucket
     {
         // bucket里面可以存key-value或者指针
-        using EntryType = std::shared_ptr<MERTNode>;
-        std::optional<EntryType> node_entry; // root的bucket只存放一个entry
-        // mutable std::shared_mutex bucket_lock;
+        using EntryType = Node *;
+        // root的bucket只存放一个entry，第一次插入时用CAS发布，之后不会再变
+        std::atomic<EntryType> node_entry{nullptr};
+        // 快照里这个根桶还有几块没插进树里，为0的话读写都只看树
+        std::atomic<std::size_t> snapshot_chunks{0};
+        // 这个根桶的块在chunk_done_里从哪儿开始
+        std::size_t chunk_base = 0;
     };
 
 private:
+    // 整棵树的内存池，要比回收器后析构，因为回收器析构时会把对象放回池里
+    MERTArena arena_;
+    // open_snapshot打开的快照，按块写时复制：写一个键之前先把它所在的那块条目插进树里，
+    // 之后这一块的键以树为准，还没插进树里的块直接从快照里读
+    std::unique_ptr<MERTSnapshot> snapshot_;
+    // 每块一个标记，置上之后这一块已经在树里了
+    std::unique_ptr<std::atomic<bool>[]> chunk_done_;
+    // 同一块只让一个写者插进树里，按块的下标分到这些锁上
+    static constexpr std::size_t kChunkLocks = 64;
+    std::mutex chunk_locks_[kChunkLocks];
+    // 长value放在这里，回收器析构时还会回调它，所以要比回收器后析构
+    std::unique_ptr<MERTValueLog> value_log_;
+    // 被替换下来的对象的回收器，要比节点后析构
+    mutable EpochManager epoch_;
+    // 热路径上的事件计数，读者也要计数所以是mutable
+    mutable MERTCounters counters_;
     std::vector<RootBucket> root_bucket;
 
 public:
    // uint8_t cal_SegmentIndex(const std::string &key);
-    uint8_t cal_BucketIndex(const std::string &key);
-    void insert(const std::string &key, const std::string &value);
+    uint8_t cal_BucketIndex(std::string_view key) const;
+    // 返回key所在根桶里的节点，还没有的话新建一个用CAS发布，快照里key所在的那块还没插进树里的话先插进去
+    Node *node_for_write(std::string_view key);
+    // 键值对插进根桶的节点里，value会被移走
+    void insert_to_root(Node *nodePtr, std::string_view key, std::string &&value);
+    // 树里没找到key、查树之前根桶i还有块没插进树里的时候调用：
+    // key所在的块还没插进树里就以快照为准，已经插进去了(可能是查树之后才插的)就再查一次树
+    bool search_snapshot(uint8_t i, std::string_view key, std::string &value) const;
+    // 遍历还有块没插进树里的根桶i，一块一块地走，在树里的块遍历树里这一块的范围，其余的读快照
+    bool scan_partial(uint8_t i, std::string &path, ScanState &state) const;
+    // value会被移走
+    void insert(std::string_view key, std::string &&value);
+    bool search(std::string_view key, std::string &value) const;
+    std::size_t multi_get(const std::string_view *keys, std::size_t count, std::string *values, bool *found) const;
+    bool erase(std::string_view key);
+    void scan(ScanState &state) const;
+    // pairs可以没排好序，相同的键以后出现的为准，会在原地排序、去重
+    void bulk_load(std::vector<KVPair> &pairs);
+    std::size_t memory_usage() const;
+    MERTSkewReport skew_report() const;
+    MERTStats stats() const;
+    bool save_snapshot(const std::string &path) const;
+    bool open_snapshot(const std::string &path);
+    // value转成树里存的形式，没有开键值分离时原样移过去
+    std::string store_value(std::string &&value);
+    MERTValueLog *value_log() const { return value_log_.get(); }
     MERTRootNode();
+    ~MERTRootNode();
 };
+// 64位整数键按大端序转成的8个字节，字节序和数值大小的顺序一致，放在栈上，不经过十进制字符串
+// 用MERTU64Key(a).view()和MERTU64Key(b).view()做scan的范围，遍历出来的就是[a, b)按数值从小到大
+struct MERTU64Key
+{
+    explicit MERTU64Key(uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            bytes[i] = static_cast<char>(value >> (56 - 8 * i));
+        }
+    }
+    std::string_view view() const { return std::string_view(bytes, sizeof(bytes)); }
+    // key不是8个字节的话返回false
+    static bool decode(std::string_view key, uint64_t &value)
+    {
+        if (key.size() != 8)
+        {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            value = value << 8 | static_cast<uint8_t>(key[i]);
+        }
+        return true;
+    }
+    char bytes[8];
+};
+
 // =============================
 // 3. MERT 整体类声明
 // =============================
-class MERT
+template <typename Config>
+class BasicMERT
 {
 public:
+    using Node = MERTNode<Config>;
+    using ScanCallback = typename Node::ScanCallback;
+
     // 构造函数
-    MERT();
+    BasicMERT();
+    // 会先停掉定期输出统计信息的线程
+    ~BasicMERT();
 
-    // 插入
-    void insert(const std::string &key, const std::string &value);
+    // 插入，可以多个线程同时插入，打开了预写日志的话返回时记录已经按同步方式落盘
+    // key直接用调用者的内存(比如网络缓冲区)，只在建键值对时拷贝一次；value是右值的话直接移进树里，不再拷贝
+    // key已经存在时只换一个新的键值对，key不超过15个字节(std::string的内联长度)、value是移进来的话整个插入不会向堆要内存
+    void insert(std::string_view key, std::string_view value);
+    void insert(std::string_view key, std::string &&value);
+    void insert(std::string_view key, const char *value) { insert(key, std::string_view(value)); }
 
-    // 查找（返回是否找到，并输出到 value）
-    std::string search(const std::string &key);
+    // 查找（返回是否找到，并输出到 value），读者不加锁
+    bool search(std::string_view key, std::string &value) const;
 
-private:
-    MERTRootNode root_;
+    // 批量查找keys[0..count)，结果放在values[i]和found[i]里，返回找到的个数，读者不加锁
+    // 同时推进kMultiGetWidth个查找，每个查找每一步都先预取下一步要读的内存再切换到下一个查找，一批键很多、树比缓存大时比逐个search快
+    // (C++17没有std::span，用指针加个数)
+    std::size_t multi_get(const std::string_view *keys, std::size_t count, std::string *values, bool *found) const;
+    static constexpr int kMultiGetWidth = 16;
+
+    // 删除，返回key原来是否存在，可以和插入、查找同时进行，删掉了的话和插入一样写预写日志
+    bool erase(std::string_view key);
 
-    // 树锁
-    //mutable std::shared_mutex tree_lock_;
+    // 64位整数键，key按大端序转成8个字节(见MERTU64Key)，8个字节在std::string的内联长度以内，建键值对时不向堆要内存
+    // 可以用在任何配置上，MERTU64Config是按这种键定的形状；同一棵树里混用字符串键的话，8个字节的字符串键会和整数键撞在一起
+    void insert_u64(uint64_t key, std::string_view value) { insert(MERTU64Key(key).view(), value); }
+    void insert_u64(uint64_t key, std::string &&value) { insert(MERTU64Key(key).view(), std::move(value)); }
+    void insert_u64(uint64_t key, const char *value) { insert_u64(key, std::string_view(value)); }
+    bool search_u64(uint64_t key, std::string &value) const { return search(MERTU64Key(key).view(), value); }
+    bool erase_u64(uint64_t key) { return erase(MERTU64Key(key).view()); }
+
+    // 按key从小到大(按无符号字节比较)遍历[start, end)里的键值对，end为空表示没有上界，读者不加锁
+    // callback返回false时停止，最多回调limit次，返回回调的次数
+    // 要分批取的话每次给一个limit，下一批从上一批最后一个key后面加'\0'开始
+    // 交给callback的string_view只在回调期间有效，完全匹配在prefix上的键是临时拼出来的
+    // 遍历期间别的线程的写入不一定能看到，但已经存在且没有被改过的键一定会遍历到
+    std::size_t scan(std::string_view start, std::string_view end, const ScanCallback &callback,
+                     std::size_t limit = SIZE_MAX) const;
+    // 遍历所有以prefix开头的键值对，其余同scan
+    std::size_t prefix_scan(std::string_view prefix, const ScanCallback &callback, std::size_t limit = SIZE_MAX) const;
+
+    // 批量导入[first, last)里的键值对，可以没排好序，重复的键以后出现的为准，空键会被忽略
+    // 还没有节点的根桶直接自底向上把节点、目录、段按最终形状建好，不走段分裂和add_child_node
+    // 已经有节点的根桶退回逐个插入
+    // 打开了预写日志的话，拿着日志的全部条带锁把所有的键值对写进日志、建树，放开锁之后再等落盘返回，
+    // 期间别的写者都要等着，同一个key的并发写入在日志里和树里的先后一致
+    template <typename Iterator>
+    void bulk_load(Iterator first, Iterator last)
+    {
+        std::vector<typename Node::KVPair> pairs;
+        for (; first != last; ++first)
+        {
+            if (!first->first.empty())
+            {
+                pairs.emplace_back(first->first, first->second);
+            }
+        }
+        if (wal_ == nullptr)
+        {
+            root_.bulk_load(pairs);
+            return;
+        }
+        uint64_t lsn = 0;
+        {
+            MERTWal::AllKeysLock guard(*wal_);
+            for (const auto &pair : pairs)
+            {
+                lsn = wal_->append(MERTWal::RecordType::Put, pair.first, pair.second);
+            }
+            root_.bulk_load(pairs);
+        }
+        wal_->commit(lsn);
+    }
+
+    // 内存池向系统要的字节数，超过池上限的大对象不算在内
+    std::size_t memory_usage() const;
+
+    // 遍历整棵树，统计键在段和桶之间的分布，可以和写者同时进行(结果是个近似的快照)
+    MERTSkewReport skew_report() const;
+
+    // 事件计数加上树的形状(节点、段、桶的数量，桶的占用率，深度)，遍历整棵树，可以和读写同时进行
+    MERTStats stats() const;
+    // 后台线程每隔interval把stats()交给hook，比如输出到日志里，再次调用会替换原来的
+    void start_stats_dump(std::chrono::milliseconds interval, std::function<void(const MERTStats &)> hook);
+    void stop_stats_dump();
+
+    // 把所有键值对按顺序写成快照文件(格式见MERTSnapshot.hh)，先写临时文件，落盘之后再rename，返回是否成功
+    // 可以和读写同时进行，和scan一样，期间的写入不一定在快照里
+    bool save_snapshot(const std::string &path) const;
+    // 只能在空树上、别的线程开始使用这棵树之前调用，文件不存在、格式不对或者条目表检查不过的话返回false
+    // 文件是只读映射进来的，检查完条目表就能查和遍历，不用逐个插入；写到某个键(插入、删除、批量导入)之前，
+    // 才把快照里它所在的那一块键建成节点，之后这一块以树为准，没写过的块一直直接读映射
+    bool open_snapshot(const std::string &path);
+
+    // 打开预写日志：先在树上依次重放path.prev和path里的记录，再以追加的方式打开path，之后的插入和删除都先写日志
+    // 要在open_snapshot之后、别的线程开始使用这棵树之前调用，失败返回false(树里可能已经重放了一部分)
+    bool open_wal(const std::string &path, const MERTWalOptions &options = MERTWalOptions());
+    // 写快照并清掉快照已经包含的日志：先把日志rotate成path.prev，写好快照之后再删掉path.prev
+    // 中途失败的话path.prev留着，恢复时在旧快照上重放path.prev和path结果也是对的
+    bool checkpoint(const std::string &snapshot_path);
+    // 预写日志写文件或fdatasync失败时的errno，0表示正常或者没有打开日志
+    int wal_error() const;
+
+    // 键值分离(Config::value_log_threshold不为0)时，value日志里垃圾占一半以上的块由后台线程定期整理，
+    // 把还活着的value搬走再整块释放，树里的句柄不用改，不影响读写。默认每秒一次，再次调用会替换原来的
+    void start_value_log_compaction(std::chrono::milliseconds interval, double min_garbage_ratio = 0.5);
+    void stop_value_log_compaction();
+    // 马上整理一次，返回释放的字节数，没有开键值分离时什么都不做
+    std::size_t compact_value_log(double min_garbage_ratio = 0.5);
+
+private:
+    // 锁都在各层结构里(根桶->节点->目录->段)，树本身不需要锁
+    MERTRootNode<Config> root_;
+    // open_wal之后才有，析构时把缓冲里还没落盘的记录写出去
+    std::unique_ptr<MERTWal> wal_;
+    // 要比root_先析构，停下来之后才能释放树
+    MERTPeriodicTask stats_task_;
+    MERTPeriodicTask compaction_task_;
 };
 
+// 默认的形状，和之前的MERT一样
+using MERT = BasicMERT<MERTConfig>;
+using SmallKeyMERT = BasicMERT<MERTSmallKeyConfig>;
+using LongKeyMERT = BasicMERT<MERTLongKeyConfig>;
+using MixedHashMERT = BasicMERT<MERTMixedHashConfig>;
+using ValueLogMERT = BasicMERT<MERTValueLogConfig>;
+using U64MERT = BasicMERT<MERTU64Config>;
+using GrowingDirectoryMERT = BasicMERT<MERTGrowingDirectoryConfig>;
+
 #endif // MERT_H
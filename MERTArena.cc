@@ -0,0 +1,177 @@
+#include "MERTArena.hh"
+#include <cstdint>
+#include <sys/mman.h>
+
+MERTArena::MERTArena()
+{
+}
+
+MERTArena::~MERTArena()
+{
+    for (void *region : regions_)
+    {
+        munmap(region, kRegionSize);
+    }
+}
+
+void MERTArena::link(SizeClass &size_class, Chunk *chunk)
+{
+    chunk->prev = nullptr;
+    chunk->next = size_class.partial;
+    if (size_class.partial != nullptr)
+    {
+        size_class.partial->prev = chunk;
+    }
+    size_class.partial = chunk;
+    chunk->listed = true;
+}
+
+void MERTArena::unlink(SizeClass &size_class, Chunk *chunk)
+{
+    if (chunk->prev != nullptr)
+    {
+        chunk->prev->next = chunk->next;
+    }
+    else
+    {
+        size_class.partial = chunk->next;
+    }
+    if (chunk->next != nullptr)
+    {
+        chunk->next->prev = chunk->prev;
+    }
+    chunk->prev = chunk->next = nullptr;
+    chunk->listed = false;
+}
+
+MERTArena::Chunk *MERTArena::acquire_chunk()
+{
+    void *memory;
+    {
+        std::lock_guard<std::mutex> chunk_guard(chunk_lock_);
+        if (!empty_chunks_.empty())
+        {
+            memory = empty_chunks_.back();
+            empty_chunks_.pop_back();
+        }
+        else
+        {
+            if (region_cursor_ == region_end_)
+            {
+                // 多要一块的地址再把头尾多出来的还回去，region按块大小对齐，释放时用地址就能找到块首
+                // 没碰过的页不占物理内存，所以region可以比用得上的大
+                const std::size_t mapped = kRegionSize + kChunkSize;
+                void *raw = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (raw == MAP_FAILED)
+                {
+                    throw std::bad_alloc();
+                }
+                char *base = static_cast<char *>(raw);
+                char *aligned = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(base) + kChunkSize - 1) & ~(kChunkSize - 1));
+                if (aligned != base)
+                {
+                    munmap(base, aligned - base);
+                }
+                if (aligned + kRegionSize != base + mapped)
+                {
+                    munmap(aligned + kRegionSize, base + mapped - (aligned + kRegionSize));
+                }
+                regions_.push_back(aligned);
+                region_cursor_ = aligned;
+                region_end_ = aligned + kRegionSize;
+            }
+            memory = region_cursor_;
+            region_cursor_ += kChunkSize;
+            chunk_count_++;
+        }
+    }
+    Chunk *chunk = new (memory) Chunk();
+    chunk->cursor = static_cast<char *>(memory) + sizeof(Chunk);
+    return chunk;
+}
+
+void MERTArena::release_chunk(Chunk *chunk)
+{
+    // 块按页对齐、大小是页的整数倍，整块的物理页都能还回去，再碰到时是清零的新页
+    madvise(chunk, kChunkSize, MADV_DONTNEED);
+    std::lock_guard<std::mutex> chunk_guard(chunk_lock_);
+    empty_chunks_.push_back(chunk);
+}
+
+void *MERTArena::allocate(std::size_t size)
+{
+    if (size > kMaxPooledSize)
+    {
+        return ::operator new(size);
+    }
+    const std::size_t rounded = (size + kAlignment - 1) / kAlignment * kAlignment;
+    SizeClass &size_class = classes_[rounded / kAlignment - 1];
+    live_objects_.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> guard(size_class.lock);
+    Chunk *chunk = size_class.partial;
+    if (chunk == nullptr)
+    {
+        chunk = acquire_chunk();
+        link(size_class, chunk);
+    }
+    void *result;
+    // 先复用这一块里释放掉的，没有再往后切
+    if (chunk->free_list != nullptr)
+    {
+        FreeNode *node = chunk->free_list;
+        chunk->free_list = node->next;
+        result = node;
+    }
+    else
+    {
+        result = chunk->cursor;
+        chunk->cursor += rounded;
+    }
+    chunk->live++;
+    if (!has_room(chunk, rounded))
+    {
+        unlink(size_class, chunk);
+    }
+    return result;
+}
+
+void MERTArena::deallocate(void *ptr, std::size_t size)
+{
+    if (size > kMaxPooledSize)
+    {
+        ::operator delete(ptr);
+        return;
+    }
+    const std::size_t rounded = (size + kAlignment - 1) / kAlignment * kAlignment;
+    SizeClass &size_class = classes_[rounded / kAlignment - 1];
+    live_objects_.fetch_sub(1, std::memory_order_relaxed);
+
+    Chunk *chunk = chunk_of(ptr);
+    std::lock_guard<std::mutex> guard(size_class.lock);
+    FreeNode *node = static_cast<FreeNode *>(ptr);
+    node->next = chunk->free_list;
+    chunk->free_list = node;
+    chunk->live--;
+    if (!chunk->listed)
+    {
+        link(size_class, chunk);
+    }
+    // 空了的块留一个给这个池备用，免得在一块的边上反复分配释放时来回向系统要
+    if (chunk->live == 0 && (chunk->prev != nullptr || chunk->next != nullptr))
+    {
+        unlink(size_class, chunk);
+        release_chunk(chunk);
+    }
+}
+
+std::size_t MERTArena::chunk_count() const
+{
+    std::lock_guard<std::mutex> guard(chunk_lock_);
+    return chunk_count_ - empty_chunks_.size();
+}
+
+std::size_t MERTArena::reserved_bytes() const
+{
+    return chunk_count() * kChunkSize;
+}
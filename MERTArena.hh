@@ -0,0 +1,112 @@
+#ifndef MERT_ARENA_H
+#define MERT_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+/***
+ * 每棵树一个的内存池
+ * 节点、段、桶、键值对都是定长的小对象，原来每个都单独new，一个节点就要上千次堆分配
+ * 这里按对象大小分成若干个定长池，每个池一次向系统要一大块(chunk)，块内用bump指针往后切
+ * 块从一次mmap的一大段地址(region)里按块大小对齐切出来，块首一个缓存行记着这一块的空闲链表和还活着的对象数，
+ * 释放时按地址找到所在的块
+ * 同一个池里还有空位的块串成链表，分配时先用链表头上那块的空闲对象，再往后切
+ * 一块里的对象全都释放了、池里又还有别的有空位的块时，这一块用madvise还给系统(地址留着)，
+ * 放进整个内存池共用的空块里，哪个池再要块时先拿这些，所以删掉大部分键之后常驻内存会跟着降下来
+ * 超过kMaxPooledSize的对象直接走operator new
+ */
+class MERTArena
+{
+public:
+    MERTArena();
+    // 整块释放，调用之前要先把池里对象的析构函数都调完(节点析构时会做)
+    ~MERTArena();
+    MERTArena(const MERTArena &) = delete;
+    MERTArena &operator=(const MERTArena &) = delete;
+
+    template <typename T, typename... Args>
+    T *create(Args &&...args)
+    {
+        static_assert(alignof(T) <= kAlignment, "MERTArena只保证16字节对齐");
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    void destroy(T *ptr)
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        ptr->~T();
+        deallocate(ptr, sizeof(T));
+    }
+
+    void *allocate(std::size_t size);
+    void deallocate(void *ptr, std::size_t size);
+
+    // 统计信息：占着内存的块数(还给系统的不算)、字节数，池里还活着多少个对象
+    std::size_t chunk_count() const;
+    std::size_t reserved_bytes() const;
+    std::size_t live_objects() const { return live_objects_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr std::size_t kAlignment = 16;
+    static constexpr std::size_t kMaxPooledSize = 4096;
+    static constexpr std::size_t kChunkSize = 64 * 1024;
+    static constexpr std::size_t kRegionSize = 32 * kChunkSize;
+    static constexpr std::size_t kClassCount = kMaxPooledSize / kAlignment;
+
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+    // 块首，占一个缓存行，对象从后面开始切，第一个对象还是缓存行对齐的
+    struct alignas(64) Chunk
+    {
+        FreeNode *free_list = nullptr; // 这一块里释放掉的对象
+        char *cursor = nullptr;        // 这一块里下一个可以切的位置
+        std::size_t live = 0;          // 分出去还没释放的对象数
+        Chunk *prev = nullptr;         // 所在的池里还有空位的块组成的双向链表
+        Chunk *next = nullptr;
+        bool listed = false;           // 是否在那个链表里
+    };
+    static_assert(sizeof(Chunk) == 64, "块首要正好一个缓存行");
+    // 一个大小等级的定长池
+    struct SizeClass
+    {
+        std::mutex lock;
+        Chunk *partial = nullptr; // 还有空位的块
+    };
+
+    static Chunk *chunk_of(void *ptr)
+    {
+        return reinterpret_cast<Chunk *>(reinterpret_cast<uintptr_t>(ptr) & ~(kChunkSize - 1));
+    }
+    static bool has_room(const Chunk *chunk, std::size_t rounded)
+    {
+        return chunk->free_list != nullptr || chunk->cursor + rounded <= reinterpret_cast<const char *>(chunk) + kChunkSize;
+    }
+    static void link(SizeClass &size_class, Chunk *chunk);
+    static void unlink(SizeClass &size_class, Chunk *chunk);
+    // 先拿还给过系统的空块，再从当前的region里切，都没有的话再mmap一段
+    Chunk *acquire_chunk();
+    // 块里的对象都释放了，还给系统，地址留着给acquire_chunk
+    void release_chunk(Chunk *chunk);
+
+    SizeClass classes_[kClassCount];
+    mutable std::mutex chunk_lock_;
+    std::vector<void *> regions_;       // mmap过的所有region，析构时释放
+    char *region_cursor_ = nullptr;     // 当前region里下一块的位置
+    char *region_end_ = nullptr;
+    std::size_t chunk_count_ = 0;       // 切出来过的块数
+    std::vector<Chunk *> empty_chunks_; // 已经还给系统、可以再用的块
+    std::atomic<std::size_t> live_objects_{0};
+};
+
+#endif // MERT_ARENA_H
@@ -0,0 +1,74 @@
+#include "MERTCounters.hh"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    // 线程槽位的分配，故意不释放，静态对象析构之后才退出的线程也还能还槽位
+    std::mutex &slot_lock()
+    {
+        static std::mutex *lock = new std::mutex;
+        return *lock;
+    }
+    std::vector<unsigned> &free_slots()
+    {
+        static std::vector<unsigned> *slots = new std::vector<unsigned>;
+        return *slots;
+    }
+    unsigned next_slot = 0; // 持有slot_lock时读写
+
+    // 线程第一次计数时领一个槽位，之后在所有树上都用同一个，线程退出时还回去
+    // 新线程拿的是还回来的槽位里最小的，独占的份尽量不空着
+    // 还槽位和领槽位都经过slot_lock，新线程接着加的时候能读到退出的线程最后写进去的值
+    struct ThreadSlot
+    {
+        unsigned index;
+
+        ThreadSlot()
+        {
+            std::lock_guard<std::mutex> lock(slot_lock());
+            std::vector<unsigned> &slots = free_slots();
+            if (slots.empty())
+            {
+                index = next_slot++;
+                return;
+            }
+            auto smallest = std::min_element(slots.begin(), slots.end());
+            index = *smallest;
+            slots.erase(smallest);
+        }
+
+        ~ThreadSlot()
+        {
+            std::lock_guard<std::mutex> lock(slot_lock());
+            free_slots().push_back(index);
+        }
+    };
+}
+
+MERTCounters::Shard &MERTCounters::local()
+{
+    static thread_local ThreadSlot slot;
+    return shards_[std::min<unsigned>(slot.index, kExclusiveShards)];
+}
+
+uint64_t MERTCounters::total(MERTCounter counter) const
+{
+    uint64_t sum = 0;
+    for (const Shard &shard : shards_)
+    {
+        sum += shard.values[static_cast<int>(counter)].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+uint64_t MERTCounters::probe_length(int buckets) const
+{
+    uint64_t sum = 0;
+    for (const Shard &shard : shards_)
+    {
+        sum += shard.probe_length[buckets].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
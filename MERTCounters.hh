@@ -0,0 +1,133 @@
+#ifndef MERT_COUNTERS_H
+#define MERT_COUNTERS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// 编译时加-DMERT_ENABLE_STATS=0可以把热路径上的计数全部去掉，MERT::stats()里就只剩遍历得到的树的形状
+#ifndef MERT_ENABLE_STATS
+#define MERT_ENABLE_STATS 1
+#endif
+
+// 热路径上的事件，下标即为MERTCounters里计数器的位置
+enum class MERTCounter : int
+{
+    Insert,
+    Search,
+    Erase,
+    SegmentSplit,      // split_segment真正分裂了一个段
+    DirectoryDoubling, // 段要分裂但已经分到了global_depth，目录翻倍
+    ChildNodeCall,     // 调用add_child_node的次数
+    ChildNodeFailure,  // 其中生成不了子节点、只能挂溢出桶的次数
+    SegmentMerge,      // 伙伴段合并
+    ChildCollapse,     // 子节点合并回父节点
+    CompactPromotion,  // 紧凑节点装不下了，升级成MERTNode
+    CompactDemotion,   // MERTNode删到只剩很少的键，降回紧凑节点
+    CommonPrefixCall,  // longestCommonSubstringAmongTwo的调用次数
+    CommonPrefixNanos, // 以及花的总时间
+    SearchLevels,      // 查找经过的节点数之和，除以Search就是平均深度
+    ProbeBuckets,      // 查找在桶链里读过的桶数之和
+    ProbeKeyCompares,  // 指纹命中之后比较完整key的次数之和
+    Count
+};
+
+/***
+ * 每棵树一份的事件计数器
+ * 所有线程都往同一个原子变量上加的话，这个缓存行会在核之间来回跳，计数本身就成了瓶颈
+ * 所以分成很多份，读的时候再加起来。每个活着的线程占一个槽位(所有树共用，线程退出时还回去给后来的线程)，
+ * 槽位号小于kExclusiveShards的线程独占对应的那一份，只有它写，加的时候读出来加上再写回，不用带锁前缀的原子加；
+ * 同时活着的线程多过kExclusiveShards个的话，多出来的共用最后一份，还是原子加
+ * 计数都是relaxed的，读到的是个近似值，不保证和树的形状是同一时刻的
+ */
+class MERTCounters
+{
+public:
+    // 查找时每一层走过的桶链长度的分布，最后一项是kProbeHistogram-1个及以上
+    static constexpr int kProbeHistogram = 8;
+
+    void add(MERTCounter counter, uint64_t n = 1)
+    {
+#if MERT_ENABLE_STATS
+        Shard &shard = local();
+        bump(shard, shard.values[static_cast<int>(counter)], n);
+#else
+        (void)counter;
+        (void)n;
+#endif
+    }
+
+    // 一次桶链查找读了buckets个桶
+    void record_probe(int buckets)
+    {
+#if MERT_ENABLE_STATS
+        Shard &shard = local();
+        bump(shard, shard.values[static_cast<int>(MERTCounter::ProbeBuckets)], buckets);
+        bump(shard, shard.probe_length[buckets < kProbeHistogram ? buckets : kProbeHistogram - 1], 1);
+#else
+        (void)buckets;
+#endif
+    }
+
+    uint64_t total(MERTCounter counter) const;
+    uint64_t probe_length(int buckets) const;
+
+    // 计时的作用域守卫，析构时把经过的纳秒数加到counter上，关掉统计时不读时钟
+    class Timer
+    {
+    public:
+        Timer(MERTCounters *counters, MERTCounter counter)
+#if MERT_ENABLE_STATS
+            : counters_(counters), counter_(counter), begin_(std::chrono::steady_clock::now())
+#endif
+        {
+            (void)counters;
+            (void)counter;
+        }
+        ~Timer()
+        {
+#if MERT_ENABLE_STATS
+            counters_->add(counter_, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin_).count());
+#endif
+        }
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+    private:
+#if MERT_ENABLE_STATS
+        MERTCounters *counters_;
+        MERTCounter counter_;
+        std::chrono::steady_clock::time_point begin_;
+#endif
+    };
+
+private:
+    static constexpr int kExclusiveShards = 64;
+
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> values[static_cast<int>(MERTCounter::Count)] = {};
+        std::atomic<uint64_t> probe_length[kProbeHistogram] = {};
+    };
+
+    // 当前线程用的那一份
+    Shard &local();
+
+    void bump(Shard &shard, std::atomic<uint64_t> &value, uint64_t n)
+    {
+        if (&shard != &shards_[kExclusiveShards])
+        {
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+        else
+        {
+            value.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    // 最后一份是槽位用完之后的线程共用的
+    Shard shards_[kExclusiveShards + 1];
+};
+
+#endif // MERT_COUNTERS_H
@@ -0,0 +1,37 @@
+#include "MERTPeriodicTask.hh"
+
+MERTPeriodicTask::~MERTPeriodicTask()
+{
+    stop();
+}
+
+void MERTPeriodicTask::start(std::chrono::milliseconds interval, std::function<void()> task)
+{
+    stop();
+    stopping_ = false;
+    thread_ = std::thread([this, interval, task = std::move(task)]()
+                          {
+        std::unique_lock<std::mutex> guard(lock_);
+        while (!wakeup_.wait_for(guard, interval, [this]()
+                                 { return stopping_; }))
+        {
+            // task里会遍历整棵树，不要拿着锁做，否则stop()要等它做完才能通知到
+            guard.unlock();
+            task();
+            guard.lock();
+        } });
+}
+
+void MERTPeriodicTask::stop()
+{
+    if (!thread_.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    wakeup_.notify_all();
+    thread_.join();
+}
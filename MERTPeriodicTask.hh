@@ -0,0 +1,33 @@
+#ifndef MERT_PERIODIC_TASK_H
+#define MERT_PERIODIC_TASK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/***
+ * 后台线程每隔interval调用一次task：定期输出统计信息、整理value日志、预写日志定期落盘、分片重新分配都用它
+ * stop()或者析构时停下来，会等正在执行的task结束
+ */
+class MERTPeriodicTask
+{
+public:
+    MERTPeriodicTask() = default;
+    ~MERTPeriodicTask();
+    MERTPeriodicTask(const MERTPeriodicTask &) = delete;
+    MERTPeriodicTask &operator=(const MERTPeriodicTask &) = delete;
+
+    // 已经在运行的话先停掉原来的
+    void start(std::chrono::milliseconds interval, std::function<void()> task);
+    void stop();
+
+private:
+    std::mutex lock_;
+    std::condition_variable wakeup_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+#endif // MERT_PERIODIC_TASK_H
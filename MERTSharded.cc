@@ -0,0 +1,528 @@
+#include "MERTSharded.hh"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+
+namespace
+{
+    // worker连着这么多次取不到请求(每次之间让出一下CPU)才去睡
+    constexpr int kIdleSpins = 16;
+    // 客户端让出这么多次CPU之后done还没置上才去睡，请求大多几微秒就做完了，睡下去再被叫醒要贵得多
+    // 核不够分的时候让出CPU正好让worker先跑，只看不让的话会白白占满一个时间片
+    constexpr int kWaitSpins = 16;
+    // 睡的时候最多等这么久，防止漏掉唤醒
+    constexpr std::chrono::milliseconds kIdleSleep{1};
+}
+
+template <typename Config>
+struct BasicShardedMERT<Config>::Waiter
+{
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool signaled = false; // 持有lock时读写
+};
+
+template <typename Config>
+typename BasicShardedMERT<Config>::Waiter *BasicShardedMERT<Config>::completed()
+{
+    static Waiter marker;
+    return &marker;
+}
+
+template <typename Config>
+BasicShardedMERT<Config>::BasicShardedMERT(const MERTShardOptions &options) : options_(options)
+{
+    const int shards = std::max(1, options_.shards);
+    // 一开始按key[0]轮流分，相邻的字节(比如'0'到'9')落在不同的分片上
+    for (int i = 0; i < 256; i++)
+    {
+        owner_[i].store(i % shards, std::memory_order_relaxed);
+        recent_ops_[i].store(0, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < shards; i++)
+    {
+        shards_.emplace_back(new Shard(options_.queue_capacity));
+    }
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < shards; i++)
+    {
+        shards_[i]->worker = std::thread(&BasicShardedMERT::run, this, i);
+        if (options_.pin_threads)
+        {
+            // 绑核失败(比如容器里限制了可用的核)也能跑，只是不保证一个分片固定在一个核上
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cores, &cpus);
+            pthread_setaffinity_np(shards_[i]->worker.native_handle(), sizeof(cpus), &cpus);
+        }
+    }
+    if (options_.rebalance_interval.count() > 0)
+    {
+        rebalancer_.start(options_.rebalance_interval, [this]()
+                          { maybe_rebalance(); });
+    }
+}
+
+template <typename Config>
+BasicShardedMERT<Config>::~BasicShardedMERT()
+{
+    rebalancer_.stop();
+    stopping_.store(true, std::memory_order_release);
+    for (auto &shard : shards_)
+    {
+        {
+            std::lock_guard<std::mutex> guard(shard->sleep_lock);
+        }
+        shard->wakeup.notify_one();
+    }
+    for (auto &shard : shards_)
+    {
+        shard->worker.join();
+    }
+    // 转出去的请求可能正好落在一个已经退出的worker的队列里，也可能还在outbox里没转出去，
+    // 这时worker都退出了，只剩这一个线程，不用管归属，剩下的请求在这里执行完
+    for (auto &shard : shards_)
+    {
+        for (Request *request : shard->outbox)
+        {
+            complete(*shard, request);
+        }
+        shard->outbox.clear();
+        Request *request;
+        while (shard->queue.pop(request))
+        {
+            complete(*shard, request);
+        }
+    }
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::enqueue(int shard, Request *request)
+{
+    Shard &target = *shards_[shard];
+    if (!target.queue.push(request))
+    {
+        // 队列满了说明worker正忙着，睡着等它取走一些，它取的时候看到有人在等就会叫醒
+        std::unique_lock<std::mutex> guard(target.sleep_lock);
+        target.producers_waiting.fetch_add(1, std::memory_order_seq_cst);
+        while (!target.queue.push(request))
+        {
+            target.space.wait_for(guard, kIdleSleep);
+        }
+        target.producers_waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+    wake(shard);
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::wake(int shard)
+{
+    Shard &target = *shards_[shard];
+    if (target.sleeping.load(std::memory_order_seq_cst))
+    {
+        // 先拿一下锁，worker要么还没开始wait(之后会再检查队列)，要么已经在wait里，不会错过这次notify
+        {
+            std::lock_guard<std::mutex> guard(target.sleep_lock);
+        }
+        target.wakeup.notify_one();
+    }
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::submit(Request &request)
+{
+    request.done.store(false, std::memory_order_relaxed);
+    request.waiter.store(nullptr, std::memory_order_relaxed);
+    enqueue(owner(root_bucket_of(request.key)), &request);
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::wait(const Request &request)
+{
+    for (int i = 0; i < kWaitSpins; i++)
+    {
+        if (request.done.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        std::this_thread::yield();
+    }
+    // 线程退出之前一直都在，worker叫醒的时候不会碰到已经释放的东西
+    static thread_local Waiter self;
+    Waiter *expected = nullptr;
+    if (request.waiter.compare_exchange_strong(expected, &self, std::memory_order_acq_rel))
+    {
+        std::unique_lock<std::mutex> guard(self.lock);
+        self.wakeup.wait(guard, [&]()
+                         { return self.signaled; });
+        self.signaled = false;
+    }
+    // 没挂上的话worker已经换上了标记，马上就会置done
+    while (!request.done.load(std::memory_order_acquire))
+    {
+    }
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::insert(const std::string &key, const std::string &value)
+{
+    Request request;
+    request.type = OpType::Insert;
+    request.key = key;
+    request.value = value;
+    submit(request);
+    wait(request);
+}
+
+template <typename Config>
+bool BasicShardedMERT<Config>::search(const std::string &key, std::string &value)
+{
+    Request request;
+    request.type = OpType::Search;
+    request.key = key;
+    submit(request);
+    wait(request);
+    if (request.found)
+    {
+        value.swap(request.value);
+    }
+    return request.found;
+}
+
+template <typename Config>
+bool BasicShardedMERT<Config>::erase(const std::string &key)
+{
+    Request request;
+    request.type = OpType::Erase;
+    request.key = key;
+    submit(request);
+    wait(request);
+    return request.found;
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::execute(Request &request)
+{
+    // worker只执行归自己的请求，析构函数执行剩下的请求时worker都已经退出了，两种情况下主人的树都只有这一个线程写
+    Tree &tree = shards_[owner(root_bucket_of(request.key))]->tree;
+    switch (request.type)
+    {
+    case OpType::Insert:
+        tree.insert(request.key, std::move(request.value));
+        request.found = true;
+        break;
+    case OpType::Search:
+        request.found = tree.search(request.key, request.value);
+        break;
+    case OpType::Erase:
+        request.found = tree.erase(request.key);
+        break;
+    }
+}
+
+template <typename Config>
+std::size_t BasicShardedMERT<Config>::scan(std::string_view start, std::string_view end, const typename Tree::ScanCallback &callback,
+                                           std::size_t limit) const
+{
+    if (limit == 0 || (!end.empty() && start >= end))
+    {
+        return 0;
+    }
+    std::shared_lock<std::shared_mutex> guard(scan_lock_);
+    // 同一个分片连着的几个根桶一起交给它的树，callback返回false之后不再往后读
+    bool stopped = false;
+    const typename Tree::ScanCallback wrapped = [&callback, &stopped](std::string_view key, std::string_view value)
+    {
+        stopped = !callback(key, value);
+        return !stopped;
+    };
+    const int first = start.empty() ? 0 : static_cast<uint8_t>(start[0]);
+    const int last = end.empty() ? 255 : static_cast<uint8_t>(end[0]);
+    std::size_t count = 0;
+    for (int bucket = first; bucket <= last && count < limit && !stopped;)
+    {
+        const int shard = owner(static_cast<uint8_t>(bucket));
+        int next = bucket + 1;
+        while (next <= last && owner(static_cast<uint8_t>(next)) == shard)
+        {
+            next++;
+        }
+        // 这一段是[bucket, next)这几个根桶，头尾两段再用start和end截一下
+        const std::string low = bucket == first ? std::string(start) : std::string(1, static_cast<char>(bucket));
+        const std::string high = next > last ? std::string(end) : std::string(1, static_cast<char>(next));
+        count += shards_[shard]->tree.scan(low, high, wrapped, limit - count);
+        bucket = next;
+    }
+    return count;
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::complete(Shard &shard, Request *request)
+{
+    execute(*request);
+    recent_ops_[root_bucket_of(request->key)].fetch_add(1, std::memory_order_relaxed);
+    shard.ops.fetch_add(1, std::memory_order_relaxed);
+    // 先换上标记，之后客户端就不会再挂上来了；置完done之后request可能马上被客户端释放，不能再碰
+    Waiter *waiter = request->waiter.exchange(completed(), std::memory_order_acq_rel);
+    request->done.store(true, std::memory_order_release);
+    if (waiter != nullptr)
+    {
+        std::lock_guard<std::mutex> guard(waiter->lock);
+        waiter->signaled = true;
+        waiter->wakeup.notify_one();
+    }
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::forward(Shard &from, Request *request)
+{
+    const int current = owner(root_bucket_of(request->key));
+    if (shards_[current]->queue.push(request))
+    {
+        wake(current);
+    }
+    else
+    {
+        // 对方的队列满了也不能自己做，否则两个worker会同时写这棵子树；两边都在取自己的队列，过一会儿就有位置了
+        from.outbox.push_back(request);
+    }
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::flush_outbox(Shard &shard)
+{
+    std::vector<Request *> pending;
+    pending.swap(shard.outbox);
+    for (Request *request : pending)
+    {
+        forward(shard, request);
+    }
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::run(int index)
+{
+    Shard &shard = *shards_[index];
+    int idle = 0;
+    while (true)
+    {
+        if (pausing_.load(std::memory_order_acquire))
+        {
+            park();
+        }
+        if (!shard.outbox.empty())
+        {
+            flush_outbox(shard);
+        }
+        Request *request;
+        if (shard.queue.pop(request))
+        {
+            idle = 0;
+            if (shard.producers_waiting.load(std::memory_order_seq_cst) > 0)
+            {
+                std::lock_guard<std::mutex> guard(shard.sleep_lock);
+                shard.space.notify_all();
+            }
+            // 重新分配之前排进来的请求，转给现在的主人，开始停止之后也一样，对方退出了的话由析构函数执行
+            if (owner(root_bucket_of(request->key)) != index)
+            {
+                forward(shard, request);
+                continue;
+            }
+            complete(shard, request);
+            continue;
+        }
+        if (stopping_.load(std::memory_order_acquire))
+        {
+            break;
+        }
+        if (++idle < kIdleSpins)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        // 先声明要睡了再检查一次队列，生产者入队之后看到sleeping就会来叫醒
+        shard.sleeping.store(true, std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> guard(shard.sleep_lock);
+            if (shard.queue.size() == 0 && !stopping_.load(std::memory_order_acquire) && !pausing_.load(std::memory_order_acquire))
+            {
+                shard.wakeup.wait_for(guard, kIdleSleep);
+            }
+        }
+        shard.sleeping.store(false, std::memory_order_relaxed);
+        idle = 0;
+    }
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::park()
+{
+    std::unique_lock<std::mutex> guard(pause_lock_);
+    parked_++;
+    pause_changed_.notify_all();
+    pause_changed_.wait(guard, [this]()
+                        { return !pausing_.load(std::memory_order_relaxed); });
+    parked_--;
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::pause_workers()
+{
+    std::unique_lock<std::mutex> guard(pause_lock_);
+    pausing_.store(true, std::memory_order_release);
+    guard.unlock();
+    for (std::size_t i = 0; i < shards_.size(); i++)
+    {
+        wake(static_cast<int>(i));
+    }
+    // worker只在两个请求之间停下，都停下之后谁也没有执行到一半的请求
+    // 停之前的写入经过pause_lock_，对之后接手的worker都是可见的
+    guard.lock();
+    pause_changed_.wait(guard, [this]()
+                        { return parked_ == shards_.size(); });
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::resume_workers()
+{
+    {
+        std::lock_guard<std::mutex> guard(pause_lock_);
+        pausing_.store(false, std::memory_order_release);
+    }
+    pause_changed_.notify_all();
+}
+
+template <typename Config>
+bool BasicShardedMERT<Config>::rebalance()
+{
+    std::lock_guard<std::mutex> guard(rebalance_lock_);
+    const int shards = static_cast<int>(shards_.size());
+    uint64_t load[256];
+    std::vector<uint64_t> old_load(shards, 0);
+    for (int i = 0; i < 256; i++)
+    {
+        load[i] = recent_ops_[i].load(std::memory_order_relaxed);
+        old_load[owner(i)] += load[i];
+    }
+    // 最重的根桶先分，每次分给当前最轻的分片(LPT)，没有负载的根桶留在原来的分片上，不用挪
+    // 一个根桶不会拆开，一个根桶就占了大部分负载的话再怎么分也没用，这时不改
+    std::vector<int> order;
+    std::vector<uint64_t> new_load(shards, 0);
+    int assignment[256];
+    for (int i = 0; i < 256; i++)
+    {
+        assignment[i] = owner(i);
+        if (load[i] > 0)
+        {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&load](int a, int b)
+              { return load[a] > load[b]; });
+    for (int bucket : order)
+    {
+        int lightest = static_cast<int>(std::min_element(new_load.begin(), new_load.end()) - new_load.begin());
+        if (new_load[assignment[bucket]] == new_load[lightest])
+        {
+            lightest = assignment[bucket]; // 一样轻的话留在原来的分片上
+        }
+        assignment[bucket] = lightest;
+        new_load[lightest] += load[bucket];
+    }
+    // 最重的分片减轻不到十分之一的话不值得挪，挪动的时候转发请求也有代价
+    const uint64_t old_max = *std::max_element(old_load.begin(), old_load.end());
+    const uint64_t new_max = *std::max_element(new_load.begin(), new_load.end());
+    const bool changed = new_max * 10 < old_max * 9;
+    if (changed)
+    {
+        // 先挡住遍历再停worker，搬键的时候没有别的线程读写这几个根桶
+        std::unique_lock<std::shared_mutex> scan_guard(scan_lock_);
+        pause_workers();
+        for (int i = 0; i < 256; i++)
+        {
+            if (assignment[i] != owner(i))
+            {
+                migrate(static_cast<uint8_t>(i), shards_[owner(i)]->tree, shards_[assignment[i]]->tree);
+                owner_[i].store(assignment[i], std::memory_order_release);
+            }
+        }
+        resume_workers();
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        recent_ops_[i].fetch_sub(load[i], std::memory_order_relaxed);
+    }
+    return changed;
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::migrate(uint8_t bucket, Tree &from, Tree &to)
+{
+    std::vector<std::pair<std::string, std::string>> pairs;
+    const std::string low(1, static_cast<char>(bucket));
+    const std::string high = bucket == 255 ? std::string() : std::string(1, static_cast<char>(bucket + 1));
+    from.scan(low, high, [&pairs](std::string_view key, std::string_view value)
+              { pairs.emplace_back(key, value); return true; });
+    if (pairs.empty())
+    {
+        return;
+    }
+    // 已经按key排好序，新主人的树里这个根桶还没有节点的话直接自底向上建好
+    to.bulk_load(pairs.begin(), pairs.end());
+    for (const auto &pair : pairs)
+    {
+        from.erase(pair.first);
+    }
+}
+
+template <typename Config>
+void BasicShardedMERT<Config>::maybe_rebalance()
+{
+    uint64_t load[256];
+    uint64_t total = 0;
+    std::vector<uint64_t> shard_load(shards_.size(), 0);
+    for (int i = 0; i < 256; i++)
+    {
+        load[i] = recent_ops_[i].load(std::memory_order_relaxed);
+        total += load[i];
+        shard_load[owner(i)] += load[i];
+    }
+    if (total < options_.rebalance_min_ops)
+    {
+        return; // 不清零，攒到够多了再看
+    }
+    const uint64_t heaviest = *std::max_element(shard_load.begin(), shard_load.end());
+    if (heaviest > options_.imbalance_threshold * total / shard_load.size())
+    {
+        rebalance();
+        return;
+    }
+    // 已经均衡，只开始下一段统计
+    for (int i = 0; i < 256; i++)
+    {
+        recent_ops_[i].fetch_sub(load[i], std::memory_order_relaxed);
+    }
+}
+
+template <typename Config>
+std::vector<MERTShardLoad> BasicShardedMERT<Config>::shard_loads() const
+{
+    std::vector<MERTShardLoad> loads(shards_.size());
+    for (std::size_t i = 0; i < shards_.size(); i++)
+    {
+        loads[i].shard = static_cast<int>(i);
+        loads[i].ops = shards_[i]->ops.load(std::memory_order_relaxed);
+        loads[i].queued = shards_[i]->queue.size();
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        MERTShardLoad &load = loads[owner(i)];
+        load.buckets++;
+        load.recent_ops += recent_ops_[i].load(std::memory_order_relaxed);
+    }
+    return loads;
+}
+
+template class BasicShardedMERT<MERTConfig>;
+template class BasicShardedMERT<MERTMixedHashConfig>;
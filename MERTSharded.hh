@@ -0,0 +1,259 @@
+#ifndef MERT_SHARDED_H
+#define MERT_SHARDED_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "MERT.hh"
+#include "MERTPeriodicTask.hh"
+
+// 有界的多生产者单消费者队列(Vyukov的环形队列)，每个槽位一个序号，生产者之间只CAS入队的位置
+template <typename T>
+class MERTBoundedQueue
+{
+public:
+    // capacity会向上取到2的幂
+    explicit MERTBoundedQueue(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // 满了返回false
+    bool push(T value)
+    {
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true)
+        {
+            cell = &cells_[pos & mask_];
+            const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 只有消费者调用，空了返回false
+    bool pop(T &value)
+    {
+        // dequeue_pos_只有消费者写，原子变量只是为了size()能从别的线程读
+        const std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Cell *cell = &cells_[pos & mask_];
+        if (cell->sequence.load(std::memory_order_acquire) != pos + 1)
+        {
+            return false;
+        }
+        value = cell->value;
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        dequeue_pos_.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 近似的元素个数，只用来统计
+    std::size_t size() const
+    {
+        const std::size_t enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+        const std::size_t dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t mask_;
+    alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+};
+
+struct MERTShardOptions
+{
+    int shards = 4;
+    std::size_t queue_capacity = 4096;
+    bool pin_threads = true; // worker绑到第shard % 核数个核上
+    // 每隔这么久看一下各个分片最近的负载，最重的比平均值多出imbalance_threshold倍以上就重新分配根桶，0表示不自动做
+    std::chrono::milliseconds rebalance_interval{1000};
+    double imbalance_threshold = 1.25;
+    uint64_t rebalance_min_ops = 10000; // 这段时间里的操作数太少的话不值得挪
+};
+
+// 一个分片的负载
+struct MERTShardLoad
+{
+    int shard = 0;
+    std::size_t buckets = 0;   // 分到的根桶数
+    uint64_t ops = 0;          // 累计执行的操作数
+    uint64_t recent_ops = 0;   // 上一次重新分配以来的操作数
+    std::size_t queued = 0;    // 队列里还在排队的请求数(近似)
+};
+
+/***
+ * 分片模式：根桶(key[0])之间本来就是互不相关的子树，这里把256个根桶分给若干个worker线程，
+ * 每个根桶在同一时刻只归一个worker，插入、查找、删除都通过那个worker的队列提交，由它来执行
+ * 每个分片有自己的一棵树，只放归它的根桶，按MERTSingleWriterConfig实例化，节点锁、目录锁、段锁都是空的；
+ * 内存池、EpochManager、计数器、value日志也都是这棵树自己的，分片之间不共用任何会写的东西
+ * 还剩下的同步：分配和释放时内存池里那个大小等级的锁和活对象计数，只有这个分片的worker拿，
+ * 偶尔有遍历的线程离开临界区时顺手回收；推进epoch只看这棵树上的线程记录(它的worker和遍历过它的线程)
+ * 遍历直接读各个分片的树，按根桶从小到大一段一段地读，读者本来就不加锁
+ *
+ * 根桶的归属记在一张表里，rebalance()按最近各个根桶的操作数重新分配(最重的先分给当前最轻的分片)
+ * 改表之前先让所有worker停在两个请求之间，把要换主的根桶里的键从旧分片的树搬到新分片的树里，
+ * 再改表、放开，所以换主前后不会有两个线程同时写一棵树；搬的时候遍历要等着，搬的代价和根桶里的键数成正比
+ * 客户端按表提交，表改了之后已经排在旧worker队列里的请求，旧worker取出来时转给新的worker，
+ * 新worker的队列满了就先攒在旧worker手里过一会儿再转，无论如何不自己执行
+ * 同一个客户端异步提交的请求只有在同一个根桶、且中间没有重新分配时才保证按提交的顺序执行，要保证先后就等上一个完成
+ */
+template <typename Config>
+class BasicShardedMERT
+{
+    // 在wait里睡着的客户端线程，每个线程一个
+    struct Waiter;
+
+public:
+    using Tree = BasicMERT<MERTSingleWriterConfig<Config>>;
+    enum class OpType : uint8_t
+    {
+        Insert,
+        Search,
+        Erase,
+    };
+    // 一个请求，提交之后到done变成true之前不能释放或修改
+    struct Request
+    {
+        OpType type = OpType::Search;
+        std::string key;
+        std::string value; // 插入的value，查找的结果也放在这里
+        bool found = false; // 查找是否找到，删除时key原来是否存在
+        std::atomic<bool> done{false};
+        // wait里的客户端要睡的话把自己挂在这里，worker做完时换成一个标记，看到挂着客户端就叫醒它
+        mutable std::atomic<Waiter *> waiter{nullptr};
+    };
+
+    explicit BasicShardedMERT(const MERTShardOptions &options = MERTShardOptions());
+    // 会先执行完已经提交的请求
+    ~BasicShardedMERT();
+    BasicShardedMERT(const BasicShardedMERT &) = delete;
+    BasicShardedMERT &operator=(const BasicShardedMERT &) = delete;
+
+    // 异步提交，可以多个线程同时提交，队列满了会睡着等worker腾出位置
+    void submit(Request &request);
+    // 等请求执行完，先看一小会儿done，还没做完就睡着等worker叫醒
+    static void wait(const Request &request);
+
+    // 同步的接口，提交之后等结果
+    void insert(const std::string &key, const std::string &value);
+    bool search(const std::string &key, std::string &value);
+    bool erase(const std::string &key);
+
+    // 遍历不经过队列，直接读各个分片的树(读者本来就不加锁)，范围跨多个分片也没关系，结果按key从小到大
+    // 和重新分配时搬键互斥，callback里不能调用rebalance()
+    std::size_t scan(std::string_view start, std::string_view end, const typename Tree::ScanCallback &callback,
+                     std::size_t limit = SIZE_MAX) const;
+
+    // 按上一次重新分配以来各个根桶的操作数重新分配，新的分配没有明显更均衡的话不改，返回是否改了
+    // 改的时候所有worker都要先停下来，不能在析构开始之后调用
+    bool rebalance();
+    std::vector<MERTShardLoad> shard_loads() const;
+    // 根桶现在归哪个分片
+    int owner(uint8_t root_bucket_index) const { return owner_[root_bucket_index].load(std::memory_order_acquire); }
+    int shard_count() const { return static_cast<int>(shards_.size()); }
+    // 一个分片的树，只有归它的根桶里有键
+    const Tree &tree(int shard) const { return shards_[shard]->tree; }
+
+private:
+    struct Shard
+    {
+        explicit Shard(std::size_t capacity) : queue(capacity) {}
+        MERTBoundedQueue<Request *> queue;
+        std::thread worker;
+        std::atomic<bool> sleeping{false};
+        std::atomic<int> producers_waiting{0}; // 队列满了、睡着等位置的生产者数
+        std::mutex sleep_lock;
+        std::condition_variable wakeup; // worker等请求
+        std::condition_variable space;  // 生产者等队列腾出位置
+        std::vector<Request *> outbox;  // 要转给别的分片、对方队列又满了的请求，只有这个分片的worker碰
+        std::atomic<uint64_t> ops{0};
+        Tree tree; // 只有这个分片的worker写，worker都停下来时由重新分配的线程搬键
+    };
+
+    static uint8_t root_bucket_of(const std::string &key) { return key.empty() ? 0 : static_cast<uint8_t>(key[0]); }
+    // worker做完请求时换进Request::waiter的标记
+    static Waiter *completed();
+    // 放进shard的队列，满了就睡着等，worker睡着的话叫醒它
+    void enqueue(int shard, Request *request);
+    void wake(int shard);
+    // worker把请求转给现在的主人，对方的队列满了就先放进自己的outbox
+    void forward(Shard &from, Request *request);
+    // outbox里的请求重新转一次
+    void flush_outbox(Shard &shard);
+    void run(int shard);
+    // 在key所在根桶现在的主人的树上执行
+    void execute(Request &request);
+    // 执行请求、记到shard的操作数里，再置done并叫醒等着的客户端
+    void complete(Shard &shard, Request *request);
+    // 让所有worker停在两个请求之间/放开，改根桶归属的时候用
+    void pause_workers();
+    void resume_workers();
+    // worker看到pausing_之后在这里等
+    void park();
+    // 把根桶bucket里的键从from的树搬到to的树里，调用时worker都要停着
+    static void migrate(uint8_t bucket, Tree &from, Tree &to);
+    void maybe_rebalance();
+
+    const MERTShardOptions options_;
+    std::atomic<int> owner_[256];
+    std::atomic<uint64_t> recent_ops_[256]; // 每个根桶上一次重新分配以来的操作数，只有它的worker加
+    std::mutex rebalance_lock_;             // 重新分配之间互斥，和请求无关
+    mutable std::shared_mutex scan_lock_;   // 遍历时共享，搬键时独占
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> pausing_{false};
+    std::mutex pause_lock_;
+    std::condition_variable pause_changed_;
+    std::size_t parked_ = 0; // 停下来的worker数，持有pause_lock_时读写
+    MERTPeriodicTask rebalancer_;
+};
+
+using ShardedMERT = BasicShardedMERT<MERTConfig>;
+using ShardedMixedHashMERT = BasicShardedMERT<MERTMixedHashConfig>;
+
+#endif // MERT_SHARDED_H
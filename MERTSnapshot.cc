@@ -0,0 +1,320 @@
+#include "MERTSnapshot.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct MERTSnapshot::Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;            // 键的个数
+    uint64_t entries_offset;   // 条目表在文件里的偏移，8字节对齐
+    uint64_t partitions_offset;
+    uint64_t file_size;        // 用来发现写了一半的文件
+    char padding[16];
+};
+
+struct MERTSnapshot::Entry
+{
+    uint64_t offset; // key在文件里的偏移，value紧跟在key后面
+    uint32_t key_length;
+    uint32_t value_length;
+};
+
+struct MERTSnapshot::Partition
+{
+    uint64_t begin;
+    uint64_t end;
+};
+
+namespace
+{
+    constexpr char kMagic[8] = {'M', 'E', 'R', 'T', 'S', 'N', 'A', 'P'};
+    constexpr uint32_t kVersion = 1;
+    // 攒够这么多字节才write一次
+    constexpr std::size_t kWriteBatch = 1 << 20;
+}
+
+MERTSnapshot::Writer::Writer(const std::string &path) : path_(path), tmp_path_(path + ".tmp")
+{
+    fd_ = ::open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    failed_ = fd_ < 0;
+    // 先空出Header的位置，finish时再回来写
+    Header header{};
+    buffer_.assign(reinterpret_cast<const char *>(&header), sizeof(header));
+    offset_ = sizeof(header);
+}
+
+MERTSnapshot::Writer::~Writer()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        ::unlink(tmp_path_.c_str());
+    }
+}
+
+bool MERTSnapshot::Writer::flush()
+{
+    const char *cursor = buffer_.data();
+    std::size_t left = buffer_.size();
+    while (left > 0)
+    {
+        ssize_t written = ::write(fd_, cursor, left);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            failed_ = true;
+            return false;
+        }
+        cursor += written;
+        left -= written;
+    }
+    buffer_.clear();
+    return true;
+}
+
+bool MERTSnapshot::Writer::write(const void *data, std::size_t size)
+{
+    buffer_.append(static_cast<const char *>(data), size);
+    offset_ += size;
+    return buffer_.size() < kWriteBatch || flush();
+}
+
+bool MERTSnapshot::Writer::add(std::string_view key, std::string_view value)
+{
+    if (failed_ || key.empty() || (!entries_.empty() && key <= last_key_) || key.size() > UINT32_MAX || value.size() > UINT32_MAX)
+    {
+        failed_ = true;
+        return false;
+    }
+    entries_.push_back(offset_);
+    entries_.push_back(static_cast<uint64_t>(key.size()) << 32 | value.size());
+    partition_counts_[static_cast<uint8_t>(key[0])]++;
+    last_key_.assign(key);
+    return write(key.data(), key.size()) && write(value.data(), value.size());
+}
+
+bool MERTSnapshot::Writer::finish()
+{
+    if (failed_)
+    {
+        return false;
+    }
+    // 条目表要8字节对齐，映射进来之后才能直接当数组读
+    static const char zeros[8] = {0};
+    if (!write(zeros, (8 - offset_ % 8) % 8))
+    {
+        return false;
+    }
+    Header header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.count = entries_.size() / 2;
+    header.entries_offset = offset_;
+    for (std::size_t i = 0; i < header.count; i++)
+    {
+        Entry entry{entries_[2 * i], static_cast<uint32_t>(entries_[2 * i + 1] >> 32), static_cast<uint32_t>(entries_[2 * i + 1])};
+        if (!write(&entry, sizeof(entry)))
+        {
+            return false;
+        }
+    }
+    // 键是按顺序add的，key[0]相同的键在条目表里是连续的一段
+    header.partitions_offset = offset_;
+    uint64_t begin = 0;
+    for (uint64_t count : partition_counts_)
+    {
+        Partition partition{begin, begin + count};
+        if (!write(&partition, sizeof(partition)))
+        {
+            return false;
+        }
+        begin += count;
+    }
+    header.file_size = offset_;
+    if (!flush() || ::pwrite(fd_, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) || ::fdatasync(fd_) != 0)
+    {
+        failed_ = true;
+        return false;
+    }
+    ::close(fd_);
+    fd_ = -1;
+    if (::rename(tmp_path_.c_str(), path_.c_str()) != 0)
+    {
+        failed_ = true;
+        ::unlink(tmp_path_.c_str());
+        return false;
+    }
+    // rename本身也要落盘，否则掉电后目录里可能还是原来的文件
+    const std::size_t slash = path_.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path_.substr(0, slash));
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0)
+    {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+    return true;
+}
+
+std::unique_ptr<MERTSnapshot> MERTSnapshot::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(Header))
+    {
+        ::close(fd);
+        return nullptr;
+    }
+    // 私有的只读映射，不用先把整个文件读进缓冲区再反序列化
+    void *mapped = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    std::unique_ptr<MERTSnapshot> snapshot(new MERTSnapshot());
+    snapshot->base_ = static_cast<const char *>(mapped);
+    snapshot->length_ = st.st_size;
+    const Header *header = reinterpret_cast<const Header *>(snapshot->base_);
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kVersion || header->file_size != snapshot->length_ ||
+        header->entries_offset % 8 != 0 || header->entries_offset < sizeof(Header) || header->entries_offset > header->partitions_offset ||
+        (header->partitions_offset - header->entries_offset) % sizeof(Entry) != 0 ||
+        (header->partitions_offset - header->entries_offset) / sizeof(Entry) != header->count ||
+        header->partitions_offset > header->file_size || header->file_size - header->partitions_offset != 256 * sizeof(Partition))
+    {
+        return nullptr;
+    }
+    snapshot->count_ = header->count;
+    snapshot->entries_ = reinterpret_cast<const Entry *>(snapshot->base_ + header->entries_offset);
+    snapshot->partitions_ = reinterpret_cast<const Partition *>(snapshot->base_ + header->partitions_offset);
+    if (!snapshot->valid(header->entries_offset))
+    {
+        return nullptr;
+    }
+    return snapshot;
+}
+
+bool MERTSnapshot::valid(uint64_t heap_end) const
+{
+    // 查找和写时复制都直接拿条目表里的偏移去读，又靠key有序、按key[0]分段来二分，文件坏了会读到映射外面或者找错
+    // 所以打开时把两张表完整地检查一遍：根桶首尾相接铺满[0, count)，每个键都在键值堆里、不为空、归它所在的根桶、比前一个键大
+    uint64_t next = 0;
+    for (int first = 0; first < 256; first++)
+    {
+        if (partitions_[first].begin != next || partitions_[first].end < next || partitions_[first].end > count_)
+        {
+            return false;
+        }
+        for (std::size_t index = next; index < partitions_[first].end; index++)
+        {
+            const Entry &entry = entries_[index];
+            if (entry.key_length == 0 || entry.offset < sizeof(Header) || entry.offset > heap_end ||
+                static_cast<uint64_t>(entry.key_length) + entry.value_length > heap_end - entry.offset ||
+                static_cast<uint8_t>(base_[entry.offset]) != first || (index > 0 && key_at(index) <= key_at(index - 1)))
+            {
+                return false;
+            }
+        }
+        next = partitions_[first].end;
+    }
+    return next == count_;
+}
+
+MERTSnapshot::~MERTSnapshot()
+{
+    if (base_ != nullptr)
+    {
+        ::munmap(const_cast<char *>(base_), length_);
+    }
+}
+
+std::size_t MERTSnapshot::begin(uint8_t first) const
+{
+    return partitions_[first].begin;
+}
+
+std::size_t MERTSnapshot::end(uint8_t first) const
+{
+    return partitions_[first].end;
+}
+
+std::string_view MERTSnapshot::key_at(std::size_t index) const
+{
+    return std::string_view(base_ + entries_[index].offset, entries_[index].key_length);
+}
+
+std::string_view MERTSnapshot::value_at(std::size_t index) const
+{
+    return std::string_view(base_ + entries_[index].offset + entries_[index].key_length, entries_[index].value_length);
+}
+
+std::size_t MERTSnapshot::lower_bound(uint8_t first, std::string_view key) const
+{
+    std::size_t low = begin(first);
+    std::size_t high = end(first);
+    while (low < high)
+    {
+        const std::size_t mid = low + (high - low) / 2;
+        if (key_at(mid) < key)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+std::size_t MERTSnapshot::chunks(uint8_t first) const
+{
+    return (end(first) - begin(first) + kChunkEntries - 1) / kChunkEntries;
+}
+
+std::size_t MERTSnapshot::chunk_begin(uint8_t first, std::size_t chunk) const
+{
+    return std::min(begin(first) + chunk * kChunkEntries, end(first));
+}
+
+std::size_t MERTSnapshot::chunk_of(uint8_t first, std::string_view key, std::size_t &index) const
+{
+    index = lower_bound(first, key);
+    // 快照里没有key的话它在前一个条目所在的块里
+    std::size_t owner = index;
+    if (owner == end(first) || key_at(owner) != key)
+    {
+        owner = owner == begin(first) ? owner : owner - 1;
+    }
+    return (owner - begin(first)) / kChunkEntries;
+}
+
+bool MERTSnapshot::find(std::string_view key, std::string &value) const
+{
+    if (key.empty())
+    {
+        return false;
+    }
+    const uint8_t first = static_cast<uint8_t>(key[0]);
+    const std::size_t index = lower_bound(first, key);
+    if (index == end(first) || key_at(index) != key)
+    {
+        return false;
+    }
+    value.assign(value_at(index));
+    return true;
+}
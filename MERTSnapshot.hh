@@ -0,0 +1,100 @@
+#ifndef MERT_SNAPSHOT_H
+#define MERT_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/***
+ * MERT的快照文件，打开时整个文件mmap进来，不用反序列化，检查一遍条目表就能查
+ *
+ * 文件里只有偏移量，没有指针，映射到哪个地址都能直接用：
+ *   Header | 键值堆 | 条目表 | 根桶表
+ *   键值堆：每个键后面紧跟着它的value
+ *   条目表：每个键一条{在文件里的偏移, key长度, value长度}，按key的无符号字节序从小到大排好
+ *   根桶表：256项，key[0]为i的键是条目表里的[begin, end)，和MERT的根桶一一对应
+ * 文件里的整数都是本机字节序，快照只在同一种机器上用
+ * 查找在根桶对应的那一段条目里二分，遍历直接顺着条目表往后走
+ * 根桶里的条目每kChunkEntries条分成一块(一页大小的一段条目表)，MERT写时复制以块为单位，只把写到的那一块插进树里
+ * 文件和树的形状(MERTConfig)无关，不同配置的MERT可以打开同一个快照
+ */
+class MERTSnapshot
+{
+public:
+    // 按key从小到大依次add，最后finish，先写到path.tmp里，finish时fsync再rename过去，中途失败的话原来的文件不受影响
+    class Writer
+    {
+    public:
+        explicit Writer(const std::string &path);
+        // 没有finish的话删掉临时文件
+        ~Writer();
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        // key不能为空，要比上一个key大，出错的话返回false，之后的调用都会失败
+        bool add(std::string_view key, std::string_view value);
+        bool finish();
+
+    private:
+        bool write(const void *data, std::size_t size);
+        bool flush();
+
+        std::string path_;
+        std::string tmp_path_;
+        int fd_ = -1;
+        bool failed_ = false;
+        uint64_t offset_ = 0;      // 下一个字节写在文件里的位置
+        std::string buffer_;       // 攒够一批再write
+        std::string last_key_;
+        std::vector<uint64_t> entries_; // 每个键两项：偏移，key长度<<32|value长度
+        uint64_t partition_counts_[256] = {0}; // 每个根桶里的键数
+    };
+
+    // 打开并映射path，文件不存在、格式不对或者条目表对不上的话返回nullptr
+    static std::unique_ptr<MERTSnapshot> open(const std::string &path);
+    ~MERTSnapshot();
+    MERTSnapshot(const MERTSnapshot &) = delete;
+    MERTSnapshot &operator=(const MERTSnapshot &) = delete;
+
+    std::size_t size() const { return count_; }
+    std::size_t mapped_bytes() const { return length_; }
+
+    // 根桶first里的键是条目[begin(first), end(first))
+    std::size_t begin(uint8_t first) const;
+    std::size_t end(uint8_t first) const;
+    // 根桶first里第一个>=key的条目
+    std::size_t lower_bound(uint8_t first, std::string_view key) const;
+    std::string_view key_at(std::size_t index) const;
+    std::string_view value_at(std::size_t index) const;
+    bool find(std::string_view key, std::string &value) const;
+
+    // 一块的条目数，每条16字节，一块是4KB
+    static constexpr std::size_t kChunkEntries = 256;
+    // 根桶first的条目分成了几块，没有条目的根桶是0块
+    std::size_t chunks(uint8_t first) const;
+    // 块chunk的条目是[chunk_begin(first, chunk), chunk_begin(first, chunk + 1))，最后一块到end(first)为止
+    std::size_t chunk_begin(uint8_t first, std::size_t chunk) const;
+    // key归根桶first的哪一块：第c块管[第c块第一个键, 第c+1块第一个键)，第0块往前一直管到根桶开头
+    // 根桶要有条目，index返回lower_bound(first, key)
+    std::size_t chunk_of(uint8_t first, std::string_view key, std::size_t &index) const;
+
+private:
+    struct Header;
+    struct Entry;
+    struct Partition;
+
+    MERTSnapshot() = default;
+    // 检查条目表和根桶表，键值堆在文件里是[sizeof(Header), heap_end)
+    bool valid(uint64_t heap_end) const;
+
+    const char *base_ = nullptr;
+    std::size_t length_ = 0;
+    std::size_t count_ = 0;
+    const Entry *entries_ = nullptr;
+    const Partition *partitions_ = nullptr;
+};
+
+#endif // MERT_SNAPSHOT_H
@@ -0,0 +1,196 @@
+#include "MERTValueLog.hh"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+MERTValueLog::MERTValueLog(EpochManager *epoch) : epoch_(epoch), slot_blocks_(new std::atomic<Slot *>[kMaxSlotBlocks])
+{
+    for (std::size_t i = 0; i < kMaxSlotBlocks; i++)
+    {
+        slot_blocks_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+MERTValueLog::~MERTValueLog()
+{
+    for (std::size_t i = 0; i < kMaxSlotBlocks; i++)
+    {
+        delete[] slot_blocks_[i].load(std::memory_order_relaxed);
+    }
+    for (auto &chunk : chunks_)
+    {
+        delete chunk.second;
+    }
+}
+
+std::string MERTValueLog::store(std::string_view value, std::size_t threshold)
+{
+    std::string stored;
+    if (value.size() < threshold)
+    {
+        stored.reserve(value.size() + 1);
+        stored.push_back(kInline);
+        stored.append(value);
+        return stored;
+    }
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        id = allocate_slot();
+        // 记录写完再发布位置，读者拿到槽号时(经过键值对的发布)一定能看到完整的记录
+        slot(id).store(append_locked(id, value), std::memory_order_release);
+    }
+    stored.resize(1 + sizeof(id));
+    stored[0] = kLogged;
+    std::memcpy(&stored[1], &id, sizeof(id));
+    return stored;
+}
+
+std::string_view MERTValueLog::load(const std::string &stored) const
+{
+    if (stored[0] == kInline)
+    {
+        return std::string_view(stored).substr(1);
+    }
+    uint64_t id;
+    std::memcpy(&id, stored.data() + 1, sizeof(id));
+    const char *record = slot(id).load(std::memory_order_acquire);
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    return std::string_view(record + sizeof(header), header.length);
+}
+
+void MERTValueLog::release(const std::string &stored)
+{
+    if (stored[0] == kInline)
+    {
+        return;
+    }
+    uint64_t id;
+    std::memcpy(&id, stored.data() + 1, sizeof(id));
+    epoch_->retire(
+        reinterpret_cast<void *>(static_cast<uintptr_t>(id)), [](void *log, void *p)
+        { static_cast<MERTValueLog *>(log)->free_slot(reinterpret_cast<uintptr_t>(p)); },
+        this);
+}
+
+uint64_t MERTValueLog::allocate_slot()
+{
+    if (!free_slots_.empty())
+    {
+        const uint64_t id = free_slots_.back();
+        free_slots_.pop_back();
+        return id;
+    }
+    const uint64_t id = next_slot_++;
+    const std::size_t block = id >> kSlotBlockBits;
+    if (block >= kMaxSlotBlocks)
+    {
+        throw std::bad_alloc();
+    }
+    if (slot_blocks_[block].load(std::memory_order_relaxed) == nullptr)
+    {
+        Slot *slots = new Slot[kSlotBlockSize];
+        for (std::size_t i = 0; i < kSlotBlockSize; i++)
+        {
+            slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+        slot_blocks_[block].store(slots, std::memory_order_release);
+    }
+    return id;
+}
+
+const char *MERTValueLog::append_locked(uint64_t id, std::string_view value)
+{
+    const std::size_t size = record_size(value.size());
+    if (active_ == nullptr || active_->capacity - active_->used < size)
+    {
+        // 比一块还大的value单独占一块
+        Chunk *chunk = new Chunk;
+        chunk->id = next_chunk_++;
+        chunk->capacity = std::max(kChunkSize, size);
+        chunk->data.reset(new char[chunk->capacity]);
+        chunks_.emplace(chunk->id, chunk);
+        reserved_ += chunk->capacity;
+        active_ = chunk;
+    }
+    char *record = active_->data.get() + active_->used;
+    const RecordHeader header{id, static_cast<uint32_t>(value.size()), active_->id};
+    std::memcpy(record, &header, sizeof(header));
+    std::memcpy(record + sizeof(header), value.data(), value.size());
+    active_->used += size;
+    active_->live += size;
+    live_ += size;
+    return record;
+}
+
+void MERTValueLog::free_slot(uint64_t id)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    Slot &entry = slot(id);
+    const char *record = entry.load(std::memory_order_relaxed);
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    const std::size_t size = record_size(header.length);
+    chunks_[header.chunk]->live -= size;
+    live_ -= size;
+    entry.store(nullptr, std::memory_order_relaxed);
+    free_slots_.push_back(id);
+}
+
+std::size_t MERTValueLog::compact(double min_garbage_ratio)
+{
+    std::vector<Chunk *> victims;
+    std::size_t reclaimed = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (auto &chunk : chunks_)
+        {
+            Chunk *candidate = chunk.second;
+            if (candidate != active_ && candidate->used - candidate->live >= min_garbage_ratio * candidate->used)
+            {
+                victims.push_back(candidate);
+            }
+        }
+        for (Chunk *victim : victims)
+        {
+            // 顺着块往后走，槽位还指向这条记录的就是活着的，搬到当前块，再把槽位改过去
+            for (std::size_t offset = 0; offset < victim->used;)
+            {
+                const char *record = victim->data.get() + offset;
+                RecordHeader header;
+                std::memcpy(&header, record, sizeof(header));
+                offset += record_size(header.length);
+                Slot &entry = slot(header.slot);
+                if (entry.load(std::memory_order_relaxed) != record)
+                {
+                    continue;
+                }
+                victim->live -= record_size(header.length);
+                live_ -= record_size(header.length);
+                entry.store(append_locked(header.slot, std::string_view(record + sizeof(header), header.length)), std::memory_order_release);
+            }
+            chunks_.erase(victim->id);
+            reserved_ -= victim->capacity;
+            reclaimed += victim->capacity;
+        }
+    }
+    // 读者可能还在读搬走之前的位置，等它们离开再释放，retire可能会调回free_slot，不能持有lock_
+    for (Chunk *victim : victims)
+    {
+        epoch_->retire(victim);
+    }
+    return reclaimed;
+}
+
+std::size_t MERTValueLog::reserved_bytes() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return reserved_;
+}
+
+std::size_t MERTValueLog::live_bytes() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return live_;
+}
@@ -0,0 +1,100 @@
+#ifndef MERT_VALUE_LOG_H
+#define MERT_VALUE_LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "EpochManager.hh"
+
+/***
+ * 键值分离：比较长的value不放在键值对里，而是追加到一个只在内存里的value日志中，树里只存一个9字节的句柄
+ *
+ * 树里存的value(键值对的second、total_value)第一个字节是类型：
+ *   kInline：后面直接就是value，短于阈值的value还是跟着键值对走
+ *   kLogged：后面是8字节的槽号，槽号在槽位表里查到记录现在的位置
+ * 日志按块(chunk)追加，每条记录：槽号 | value长度 | 所在块号 | value，按8字节对齐
+ * 树里的句柄只认槽号，后台整理时把块里还活着的记录搬到新的块，只改槽位表里的位置，树完全不用动，
+ * 所以整理和树上的读写之间没有锁，读者在epoch临界区里读到的旧位置要等它离开之后旧块才释放
+ *
+ * value被覆盖或删除时release，槽位和记录占的空间要等可能还拿着旧键值对的读者都离开之后才回收，
+ * 分裂、合并时键值对换了地方但句柄不变，不算覆盖，不用release
+ */
+class MERTValueLog
+{
+public:
+    // retire用树的回收器，要比它后析构
+    explicit MERTValueLog(EpochManager *epoch);
+    ~MERTValueLog();
+    MERTValueLog(const MERTValueLog &) = delete;
+    MERTValueLog &operator=(const MERTValueLog &) = delete;
+
+    // value转成树里存的形式，不短于threshold的追加到日志里
+    std::string store(std::string_view value, std::size_t threshold);
+    // 树里存的形式转回value，要在epoch临界区里调用，返回的string_view在离开临界区之前有效
+    std::string_view load(const std::string &stored) const;
+    // stored被覆盖或删除了，在日志里的话等读者都离开后回收
+    void release(const std::string &stored);
+
+    // 垃圾(已经回收的记录)占已用空间的比例不低于min_garbage_ratio的块，把活着的记录搬走之后整块释放
+    // 正在追加的块不动，返回释放的块的字节数
+    std::size_t compact(double min_garbage_ratio);
+
+    // 向系统要的块的字节数，和其中还活着的记录的字节数
+    std::size_t reserved_bytes() const;
+    std::size_t live_bytes() const;
+
+private:
+    enum : char
+    {
+        kInline = 0,
+        kLogged = 1,
+    };
+    struct RecordHeader
+    {
+        uint64_t slot;
+        uint32_t length;
+        uint32_t chunk;
+    };
+    struct Chunk
+    {
+        uint32_t id;
+        std::size_t capacity;
+        std::size_t used = 0; // 追加到了哪里
+        std::size_t live = 0; // 还被槽位引用的记录的字节数
+        std::unique_ptr<char[]> data;
+    };
+    static constexpr std::size_t kChunkSize = 4 << 20;
+    // 槽位表分两级，第二级按需分配，读者不加锁
+    static constexpr int kSlotBlockBits = 16;
+    static constexpr std::size_t kSlotBlockSize = std::size_t(1) << kSlotBlockBits;
+    static constexpr std::size_t kMaxSlotBlocks = 1 << 14;
+    using Slot = std::atomic<const char *>;
+
+    static std::size_t record_size(std::size_t length) { return (sizeof(RecordHeader) + length + 7) & ~std::size_t(7); }
+    Slot &slot(uint64_t id) const { return slot_blocks_[id >> kSlotBlockBits].load(std::memory_order_acquire)[id & (kSlotBlockSize - 1)]; }
+    // 下面几个都要持有lock_
+    uint64_t allocate_slot();
+    // 在当前块后面追加一条记录，放不下的话换一个新块
+    const char *append_locked(uint64_t slot, std::string_view value);
+    // EpochManager回调：没有读者能再看到这个槽号了
+    void free_slot(uint64_t slot);
+
+    EpochManager *epoch_;
+    mutable std::mutex lock_;
+    std::unique_ptr<std::atomic<Slot *>[]> slot_blocks_;
+    std::vector<uint64_t> free_slots_;
+    uint64_t next_slot_ = 1; // 槽号从1开始，retire时当指针用不能是0
+    std::map<uint32_t, Chunk *> chunks_;
+    Chunk *active_ = nullptr; // 正在追加的块
+    uint32_t next_chunk_ = 0;
+    std::size_t reserved_ = 0;
+    std::size_t live_ = 0;
+};
+
+#endif // MERT_VALUE_LOG_H
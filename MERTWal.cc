@@ -0,0 +1,379 @@
+#include "MERTWal.hh"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    // crc32 | key长度 | value长度 | 类型
+    constexpr std::size_t kHeaderSize = 4 + 4 + 4 + 1;
+
+    // 标准的CRC-32(多项式0xEDB88320)，查表法
+    uint32_t crc32(const char *data, std::size_t size, uint32_t crc = 0)
+    {
+        static const std::vector<uint32_t> table = []()
+        {
+            std::vector<uint32_t> t(256);
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                t[i] = c;
+            }
+            return t;
+        }();
+        crc = ~crc;
+        for (std::size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void put_u32(std::string &out, uint32_t value)
+    {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    uint32_t get_u32(const char *data)
+    {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    // data[pos]开始是不是一条完整、校验对的记录，是的话size为它的字节数
+    bool record_at(const std::string &data, std::size_t pos, std::size_t &size)
+    {
+        if (data.size() - pos < kHeaderSize)
+        {
+            return false;
+        }
+        const uint8_t type = static_cast<uint8_t>(data[pos + 12]);
+        if (type != static_cast<uint8_t>(MERTWal::RecordType::Put) && type != static_cast<uint8_t>(MERTWal::RecordType::Erase))
+        {
+            return false;
+        }
+        size = kHeaderSize + static_cast<std::size_t>(get_u32(data.data() + pos + 4)) + get_u32(data.data() + pos + 8);
+        return data.size() - pos >= size && crc32(data.data() + pos + 4, size - 4) == get_u32(data.data() + pos);
+    }
+
+    bool read_file(const std::string &path, std::string &data)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return errno == ENOENT;
+        }
+        char chunk[1 << 16];
+        while (true)
+        {
+            ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            if (n == 0)
+            {
+                break;
+            }
+            data.append(chunk, n);
+        }
+        ::close(fd);
+        return true;
+    }
+}
+
+// 新建、改名之后目录项也要落盘，否则掉电后可能找不到文件
+void MERTWal::sync_directory(const std::string &path)
+{
+    const std::size_t slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0)
+    {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+bool MERTWal::replay(const std::string &path, const ReplayCallback &callback, std::size_t &records)
+{
+    records = 0;
+    std::string data;
+    if (!read_file(path, data))
+    {
+        return false;
+    }
+    std::size_t pos = 0;
+    std::size_t size = 0;
+    while (record_at(data, pos, size))
+    {
+        const uint32_t key_length = get_u32(data.data() + pos + 4);
+        const uint32_t value_length = get_u32(data.data() + pos + 8);
+        const char *key = data.data() + pos + kHeaderSize;
+        callback(static_cast<RecordType>(static_cast<uint8_t>(data[pos + 12])), std::string_view(key, key_length),
+                 std::string_view(key + key_length, value_length));
+        records++;
+        pos += size;
+    }
+    if (pos != data.size())
+    {
+        // 一组记录是一次write写出去的，掉电时只有最后一组可能写了一半，坏掉的记录后面不会再有完整的记录
+        // 坏记录的长度字段本身可能也坏了，所以从下一个字节开始逐个位置找
+        for (std::size_t next = pos + 1; data.size() - next >= kHeaderSize; next++)
+        {
+            if (record_at(data, next, size))
+            {
+                return false;
+            }
+        }
+        // 截掉坏掉的尾巴，之后追加的记录才能接在完整的记录后面
+        if (::truncate(path.c_str(), pos) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<MERTWal> MERTWal::open(const std::string &path, const MERTWalOptions &options)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+    sync_directory(path);
+    std::unique_ptr<MERTWal> wal(new MERTWal(path, options, fd, st.st_size));
+    if (options.sync_mode == MERTSyncMode::Periodic)
+    {
+        MERTWal *self = wal.get();
+        wal->periodic_.start(options.sync_interval, [self]()
+                             {
+            std::unique_lock<std::mutex> guard(self->lock_);
+            if (!self->flushing_ && self->durable_ != self->appended_)
+            {
+                self->flush_locked(guard, true);
+            } });
+    }
+    return wal;
+}
+
+MERTWal::MERTWal(const std::string &path, const MERTWalOptions &options, int fd, uint64_t size)
+    : path_(path), options_(options), fd_(fd), appended_(size), durable_(size)
+{
+}
+
+MERTWal::~MERTWal()
+{
+    periodic_.stop();
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        flushed_.wait(guard, [this]()
+                      { return !flushing_; });
+        if (!buffer_.empty())
+        {
+            flush_locked(guard, true);
+        }
+    }
+    ::close(fd_);
+}
+
+std::mutex &MERTWal::key_lock(std::string_view key)
+{
+    return key_locks_[std::hash<std::string_view>()(key) % kKeyLocks];
+}
+
+MERTWal::AllKeysLock::AllKeysLock(MERTWal &wal)
+{
+    // 单个key的写者只拿一把，这里总是从小到大拿，和rotate、别的批量导入之间不会死锁
+    for (int i = 0; i < kKeyLocks; i++)
+    {
+        guards_[i] = std::unique_lock<std::mutex>(wal.key_locks_[i]);
+    }
+}
+
+bool MERTWal::write_all(int fd, const std::string &data)
+{
+    const char *cursor = data.data();
+    std::size_t left = data.size();
+    while (left > 0)
+    {
+        ssize_t written = ::write(fd, cursor, left);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        cursor += written;
+        left -= written;
+    }
+    return true;
+}
+
+void MERTWal::flush_locked(std::unique_lock<std::mutex> &guard, bool sync)
+{
+    // 组长把缓冲整个拿走，write和fdatasync的时候不持有lock_，后来的写者可以继续追加
+    flushing_ = true;
+    std::string batch;
+    batch.swap(buffer_);
+    const uint64_t end = appended_;
+    guard.unlock();
+    bool ok = write_all(fd_, batch) && (!sync || ::fdatasync(fd_) == 0);
+    const int saved_errno = errno;
+    guard.lock();
+    flushing_ = false;
+    if (!ok)
+    {
+        error_ = saved_errno;
+    }
+    else if (sync)
+    {
+        durable_ = end;
+    }
+    flushed_.notify_all();
+}
+
+uint64_t MERTWal::append(RecordType type, std::string_view key, std::string_view value)
+{
+    std::string record;
+    record.reserve(kHeaderSize + key.size() + value.size());
+    put_u32(record, 0);
+    put_u32(record, static_cast<uint32_t>(key.size()));
+    put_u32(record, static_cast<uint32_t>(value.size()));
+    record.push_back(static_cast<char>(type));
+    record.append(key);
+    record.append(value);
+    const uint32_t crc = crc32(record.data() + 4, record.size() - 4);
+    std::memcpy(&record[0], &crc, sizeof(crc));
+
+    std::unique_lock<std::mutex> guard(lock_);
+    buffer_ += record;
+    appended_ += record.size();
+    const uint64_t lsn = appended_;
+    if (options_.sync_mode == MERTSyncMode::EveryOp)
+    {
+        // 不攒批，每条记录在持有锁的时候自己写出去并落盘，缓冲里只会有这一条
+        if (error_ == 0)
+        {
+            if (write_all(fd_, buffer_) && ::fdatasync(fd_) == 0)
+            {
+                durable_ = appended_;
+            }
+            else
+            {
+                error_ = errno;
+            }
+        }
+        buffer_.clear();
+    }
+    else if (options_.sync_mode == MERTSyncMode::Periodic && buffer_.size() >= kPeriodicFlushBytes && !flushing_)
+    {
+        flush_locked(guard, false);
+    }
+    return lsn;
+}
+
+void MERTWal::commit(uint64_t lsn)
+{
+    if (options_.sync_mode == MERTSyncMode::Periodic)
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> guard(lock_);
+    while (durable_ < lsn && error_ == 0)
+    {
+        if (flushing_)
+        {
+            // 已经有组长在落盘了，等它做完，自己的记录要么在这一组里，要么在下一组
+            flushed_.wait(guard);
+        }
+        else
+        {
+            flush_locked(guard, true);
+        }
+    }
+}
+
+bool MERTWal::rotate()
+{
+    // 拿到所有的条带锁之后，已经追加了记录的写者都改完树了
+    AllKeysLock key_guards(*this);
+    std::unique_lock<std::mutex> guard(lock_);
+    flushed_.wait(guard, [this]()
+                  { return !flushing_; });
+    if (!buffer_.empty() || durable_ != appended_)
+    {
+        flush_locked(guard, true);
+    }
+    if (error_ != 0)
+    {
+        return false;
+    }
+    const std::string previous = previous_path();
+    struct stat st;
+    if (::stat(previous.c_str(), &st) == 0)
+    {
+        // 上一次checkpoint没做完，path.prev还要留着，把当前日志接到它后面
+        std::string data;
+        int fd = ::open(previous.c_str(), O_WRONLY | O_APPEND);
+        bool ok = fd >= 0 && read_file(path_, data) && write_all(fd, data) && ::fdatasync(fd) == 0;
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        if (!ok || ::unlink(path_.c_str()) != 0)
+        {
+            error_ = errno;
+            return false;
+        }
+    }
+    else if (::rename(path_.c_str(), previous.c_str()) != 0)
+    {
+        error_ = errno;
+        return false;
+    }
+    int fd = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        error_ = errno;
+        return false;
+    }
+    ::close(fd_);
+    fd_ = fd;
+    sync_directory(path_);
+    // lsn只在进程内比较，换文件之后接着往上加，不用清零
+    return true;
+}
+
+void MERTWal::drop_previous()
+{
+    ::unlink(previous_path().c_str());
+}
+
+int MERTWal::error() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return error_;
+}
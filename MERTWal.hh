@@ -0,0 +1,113 @@
+#ifndef MERT_WAL_H
+#define MERT_WAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include "MERTPeriodicTask.hh"
+
+// 什么时候fdatasync
+enum class MERTSyncMode
+{
+    EveryOp,  // 每个操作自己write+fdatasync一次，返回时已经落盘
+    Group,    // 组提交：同时到达的写者攒成一组，一次write+fdatasync，返回时已经落盘
+    Periodic, // 后台每隔sync_interval落盘一次，写者不等，掉电最多丢这么久的写入
+};
+
+struct MERTWalOptions
+{
+    MERTSyncMode sync_mode = MERTSyncMode::Group;
+    std::chrono::milliseconds sync_interval{10}; // 只对Periodic有用
+};
+
+/***
+ * MERT的预写日志
+ * 每条记录：crc32 | key长度 | value长度 | 类型 | key | value，crc覆盖crc后面的所有字节
+ * 写者先持有key所在的条带锁，追加记录、修改树，再放锁等落盘，同一个key的记录在日志里的先后和修改树的先后一致
+ * 追加只是拷到内存缓冲里，组提交时第一个等落盘的写者当组长，把缓冲一次写出去并fdatasync，
+ * 组长在磁盘上等的时候后来的写者继续往缓冲里攒，成为下一组
+ *
+ * 和快照配合：checkpoint时先rotate，把当前日志改名成path.prev，之后的记录写进新的path，
+ * 快照写好之后删掉path.prev。恢复时在快照上先重放path.prev再重放path，每条记录都是整个覆盖或者删除，
+ * 所以快照是rotate之后哪个时刻的都没关系
+ */
+class MERTWal
+{
+public:
+    enum class RecordType : uint8_t
+    {
+        Put = 1,
+        Erase = 2,
+    };
+    using ReplayCallback = std::function<void(RecordType type, std::string_view key, std::string_view value)>;
+    static constexpr int kKeyLocks = 64;
+
+    // 按顺序重放path里完整的记录，文件不存在不算错，返回是否成功，records为重放的记录数
+    // 遇到写了一半或者校验不对的记录时，后面再也找不到完整的记录的话就是掉电时写了一半的尾巴，把文件截断到那里；
+    // 后面还有完整的记录的话是日志中间坏了，不截断，返回false，截掉的话后面已经落盘的写入就丢了
+    static bool replay(const std::string &path, const ReplayCallback &callback, std::size_t &records);
+
+    // 以追加的方式打开path，失败返回nullptr
+    static std::unique_ptr<MERTWal> open(const std::string &path, const MERTWalOptions &options);
+    ~MERTWal();
+    MERTWal(const MERTWal &) = delete;
+    MERTWal &operator=(const MERTWal &) = delete;
+
+    // 修改同一个key的写者之间的锁，追加记录和修改树都要在锁里做
+    std::mutex &key_lock(std::string_view key);
+    // 按顺序拿到所有的条带锁，析构时放开。拿到之后没有别的写者在追加记录或者修改树，
+    // 批量导入和rotate用它，一次涉及很多key，逐个拿key_lock的话顺序不定会死锁
+    class AllKeysLock
+    {
+    public:
+        explicit AllKeysLock(MERTWal &wal);
+
+    private:
+        std::unique_lock<std::mutex> guards_[kKeyLocks];
+    };
+    // 追加一条记录，返回它在日志里的结束位置，调用时要持有key_lock(key)
+    uint64_t append(RecordType type, std::string_view key, std::string_view value);
+    // 等到lsn之前的记录都落盘(Periodic直接返回)，不能持有key_lock
+    void commit(uint64_t lsn);
+    // 当前日志改名成path.prev，后面的记录写进新的path。会先等所有进行到一半的写者改完树，
+    // path.prev已经存在的话(上一次checkpoint没做完)，当前日志接到它后面
+    bool rotate();
+    // checkpoint的快照写好了，path.prev里的记录都不需要了
+    void drop_previous();
+    // 写文件或者fdatasync失败时的errno，0表示正常。失败之后树照常修改，但不再保证落盘
+    int error() const;
+    const std::string &path() const { return path_; }
+    std::string previous_path() const { return path_ + ".prev"; }
+
+private:
+    // 缓冲超过这么多时Periodic模式的写者自己先write出去，不等后台线程
+    static constexpr std::size_t kPeriodicFlushBytes = 4 << 20;
+
+    MERTWal(const std::string &path, const MERTWalOptions &options, int fd, uint64_t size);
+    // 把buffer_写出去并fdatasync，调用时持有lock_，期间会放开lock_
+    void flush_locked(std::unique_lock<std::mutex> &guard, bool sync);
+    static bool write_all(int fd, const std::string &data);
+    static void sync_directory(const std::string &path);
+
+    const std::string path_;
+    const MERTWalOptions options_;
+    int fd_;
+    std::mutex key_locks_[kKeyLocks];
+
+    mutable std::mutex lock_;
+    std::condition_variable flushed_;
+    std::string buffer_;       // 还没write出去的记录
+    uint64_t appended_ = 0;    // 已经追加的字节数(包括打开时文件里已有的)，记录的lsn就是它的结束位置
+    uint64_t durable_ = 0;     // 已经落盘的位置
+    bool flushing_ = false;    // 有组长正在write+fdatasync
+    int error_ = 0;
+    MERTPeriodicTask periodic_;
+};
+
+#endif // MERT_WAL_H
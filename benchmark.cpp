@@ -0,0 +1,774 @@
+// YCSB风格的基准测试，和main.cpp分开，单独编译成一个程序：
+//   g++ -std=c++17 -O2 -pthread -I.. benchmark.cpp *.cc -o benchmark    (在仓库目录里编译，头文件按extendible_radix_tree/引用，仓库目录要叫这个名字)
+//   ./benchmark --keys 1000000 --ops 1000000 --threads 4 --key-length 16 --dist zipf --workload A,B,C,E --structure all
+//   ./benchmark --keys 1000000 --key-length 128 --dist prefix --structure mert,map    (长键共享很长的prefix)
+// 键集合和每个线程的操作序列都在计时之前用固定的种子生成好，同样的参数每次跑的是完全一样的操作，结果可以跨次比较
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <malloc.h>
+#include "extendible_radix_tree/MERT.hh"
+
+// 统计堆上还活着的字节数，用来算每个键占多少内存(MERT的内存池直接用mmap映射块，不经过operator new，所以另外加上extra_bytes())
+static std::atomic<long long> g_liveBytes{0};
+// 扫描时把读到的值的长度累加到这里，防止编译器把没有副作用的扫描循环删掉
+static std::atomic<std::size_t> g_scanSink{0};
+
+// 计数的malloc/free不内联：operator new/delete内联到调用处之后，编译器会把new出来的指针直接交给free看成不配对(-Wmismatched-new-delete)
+__attribute__((noinline)) static void *counted_malloc(std::size_t size)
+{
+    void *p = std::malloc(size);
+    if (p != nullptr)
+    {
+        g_liveBytes.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+    }
+    return p;
+}
+
+__attribute__((noinline)) static void counted_free(void *p)
+{
+    if (p != nullptr)
+    {
+        g_liveBytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+    }
+    std::free(p);
+}
+
+void *operator new(std::size_t size)
+{
+    if (void *p = counted_malloc(size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    counted_free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    operator delete(p);
+}
+
+namespace
+{
+    // -------------------------
+    // 参数
+    // -------------------------
+    struct Options
+    {
+        std::size_t keys = 1000000;   // 预先载入的键数
+        std::size_t ops = 1000000;    // 每个负载的操作总数，平均分给各个线程
+        int threads = 1;
+        std::size_t key_length = 16;  // 4~256
+        std::size_t value_length = 16;
+        std::string dist = "uniform"; // uniform / zipf / seq / prefix
+        std::vector<std::string> workloads{"A", "B", "C", "E"};
+        std::vector<std::string> structures{"mert", "map", "umap"};
+        uint64_t seed = 42;
+        std::size_t max_scan = 100; // E负载的扫描长度在[1, max_scan]里均匀取
+    };
+
+    std::vector<std::string> split_list(const std::string &text)
+    {
+        std::vector<std::string> items;
+        std::size_t begin = 0;
+        while (begin <= text.size())
+        {
+            std::size_t end = text.find(',', begin);
+            if (end == std::string::npos)
+            {
+                end = text.size();
+            }
+            if (end > begin)
+            {
+                items.push_back(text.substr(begin, end - begin));
+            }
+            begin = end + 1;
+        }
+        return items;
+    }
+
+    void usage()
+    {
+        std::cout << "用法: benchmark [--keys N] [--ops N] [--threads T] [--key-length 4..256] [--value-length N]\n"
+                     "                 [--dist uniform|zipf|seq|prefix] [--workload A,B,C,E] [--seed S] [--max-scan N]\n"
+                     "                 [--structure mert,mert-small,mert-long,mert-hash,map,umap|all]\n";
+    }
+
+    // prefix分布：键按租户分组，同一个租户的键只有最后这么多字节不同，前面是租户共享的一长串(租户号 + URL样子的路径)
+    constexpr std::size_t kPrefixKeyTail = 12;
+    constexpr std::size_t kPrefixTenants = 64;
+
+    bool parse_options(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            if (arg == "--help" || i + 1 >= argc)
+            {
+                return false;
+            }
+            const std::string value = argv[++i];
+            if (arg == "--keys")
+            {
+                options.keys = std::stoull(value);
+            }
+            else if (arg == "--ops")
+            {
+                options.ops = std::stoull(value);
+            }
+            else if (arg == "--threads")
+            {
+                options.threads = std::max(1, std::stoi(value));
+            }
+            else if (arg == "--key-length")
+            {
+                options.key_length = std::stoull(value);
+            }
+            else if (arg == "--value-length")
+            {
+                options.value_length = std::stoull(value);
+            }
+            else if (arg == "--dist")
+            {
+                options.dist = value;
+            }
+            else if (arg == "--workload")
+            {
+                options.workloads = split_list(value);
+            }
+            else if (arg == "--structure")
+            {
+                options.structures = value == "all" ? std::vector<std::string>{"mert", "mert-small", "mert-long", "mert-hash", "map", "umap"}
+                                                    : split_list(value);
+            }
+            else if (arg == "--seed")
+            {
+                options.seed = std::stoull(value);
+            }
+            else if (arg == "--max-scan")
+            {
+                options.max_scan = std::max<std::size_t>(1, std::stoull(value));
+            }
+            else
+            {
+                return false;
+            }
+        }
+        if (options.key_length < 4 || options.key_length > 256)
+        {
+            std::cout << "key长度要在4~256之间" << std::endl;
+            return false;
+        }
+        if (options.dist != "uniform" && options.dist != "zipf" && options.dist != "seq" && options.dist != "prefix")
+        {
+            return false;
+        }
+        if (options.dist == "prefix" && options.key_length < kPrefixKeyTail + 16)
+        {
+            std::cout << "prefix分布的key长度至少要" << kPrefixKeyTail + 16 << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // -------------------------
+    // 键和操作序列
+    // -------------------------
+    uint64_t fnv_hash(uint64_t value)
+    {
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        for (int i = 0; i < 8; i++)
+        {
+            hash ^= value & 0xFF;
+            hash *= 0x100000001B3ULL;
+            value >>= 8;
+        }
+        return hash;
+    }
+
+    // YCSB的ZipfianGenerator(Gray等人的算法)，theta=0.99，返回[0, n)，0最热
+    // 和YCSB一样再把名次哈希一下(scrambled)，热键不会都挤在键集合的开头
+    class ZipfianGenerator
+    {
+    public:
+        explicit ZipfianGenerator(std::size_t n, double theta = 0.99) : n_(n), theta_(theta)
+        {
+            double zeta2 = 0;
+            for (std::size_t i = 1; i <= 2; i++)
+            {
+                zeta2 += 1.0 / std::pow(static_cast<double>(i), theta_);
+            }
+            zetan_ = 0;
+            for (std::size_t i = 1; i <= n_; i++)
+            {
+                zetan_ += 1.0 / std::pow(static_cast<double>(i), theta_);
+            }
+            alpha_ = 1.0 / (1.0 - theta_);
+            eta_ = (1 - std::pow(2.0 / n_, 1 - theta_)) / (1 - zeta2 / zetan_);
+        }
+
+        std::size_t next(std::mt19937_64 &gen) const
+        {
+            const double u = std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+            const double uz = u * zetan_;
+            std::size_t rank = 0;
+            if (uz < 1.0)
+            {
+                rank = 0;
+            }
+            else if (uz < 1.0 + std::pow(0.5, theta_))
+            {
+                rank = 1;
+            }
+            else
+            {
+                rank = static_cast<std::size_t>(n_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+            }
+            return fnv_hash(std::min(rank, n_ - 1)) % n_;
+        }
+
+    private:
+        std::size_t n_;
+        double theta_;
+        double zetan_;
+        double alpha_;
+        double eta_;
+    };
+
+    // 生成count个互不相同、长度为length的键
+    // seq是按顺序递增的序号，按大端序写成key_length字节的二进制(前面补0字节)，插入顺序就是key的无符号字节序；
+    // prefix见kPrefixKeyTail；其余是随机的字母数字
+    std::vector<std::string> generate_keys(const Options &options, std::size_t count)
+    {
+        std::vector<std::string> keys;
+        keys.reserve(count);
+        if (options.dist == "seq")
+        {
+            // 4个字节能放2^32个序号，key_length不小于8时count怎么都放得下
+            if (options.key_length < 8 && (count - 1) >> (8 * options.key_length) != 0)
+            {
+                std::cout << "key长度" << options.key_length << "放不下" << count << "个顺序键" << std::endl;
+                std::exit(1);
+            }
+            for (std::size_t i = 0; i < count; i++)
+            {
+                std::string key(options.key_length, '\0');
+                uint64_t value = i;
+                for (std::size_t j = options.key_length; j > 0 && value != 0; j--, value >>= 8)
+                {
+                    key[j - 1] = static_cast<char>(value & 0xFF);
+                }
+                keys.push_back(std::move(key));
+            }
+            return keys;
+        }
+        static const char charset[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+        std::mt19937_64 gen(options.seed);
+        std::vector<std::string> tenants;
+        if (options.dist == "prefix")
+        {
+            for (std::size_t i = 0; i < kPrefixTenants; i++)
+            {
+                std::string tenant = "tenant-" + std::to_string(1000 + i) + "/https://objects.example.com/";
+                while (tenant.size() < options.key_length - kPrefixKeyTail)
+                {
+                    tenant.push_back(tenant.size() % 9 == 8 ? '/' : charset[10 + gen() % 26]);
+                }
+                tenant.resize(options.key_length - kPrefixKeyTail);
+                tenants.push_back(std::move(tenant));
+            }
+        }
+        std::unordered_set<std::string> seen;
+        seen.reserve(count);
+        while (keys.size() < count)
+        {
+            std::string key(options.key_length, '0');
+            std::size_t begin = 0;
+            if (!tenants.empty())
+            {
+                const std::string &tenant = tenants[gen() % tenants.size()];
+                key.replace(0, tenant.size(), tenant);
+                begin = tenant.size();
+            }
+            for (std::size_t i = begin; i < key.size(); i++)
+            {
+                key[i] = charset[gen() % (sizeof(charset) - 1)];
+            }
+            if (seen.insert(key).second)
+            {
+                keys.push_back(std::move(key));
+            }
+        }
+        return keys;
+    }
+
+    enum class OpType : uint8_t
+    {
+        Read,
+        Update,
+        Insert,
+        Scan
+    };
+
+    struct Op
+    {
+        OpType type;
+        uint32_t scan_length;
+        std::size_t key; // 键集合里的下标
+    };
+
+    struct Workload
+    {
+        std::string name;
+        double read;   // 读的比例
+        double update; // 更新的比例
+        double insert; // 插入新键的比例
+        double scan;   // 扫描的比例
+    };
+
+    bool find_workload(const std::string &name, Workload &workload)
+    {
+        static const Workload workloads[] = {
+            {"A", 0.50, 0.50, 0.00, 0.00},
+            {"B", 0.95, 0.05, 0.00, 0.00},
+            {"C", 1.00, 0.00, 0.00, 0.00},
+            {"E", 0.00, 0.00, 0.05, 0.95},
+        };
+        for (const Workload &candidate : workloads)
+        {
+            if (candidate.name == name)
+            {
+                workload = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 每个线程留给插入的新键数：插入次数是按比例随机抽的，在期望之外再留6个标准差
+    std::size_t insert_quota(std::size_t per, double ratio)
+    {
+        const double expected = per * ratio;
+        return static_cast<std::size_t>(std::ceil(expected + 6 * std::sqrt(expected))) + 1;
+    }
+
+    // 给每个线程生成操作序列，读、更新、扫描的键在已载入的键里按分布取，插入的是载入之外的新键
+    // 插入的新键按线程分好段，不同线程不会插入同一个键
+    std::vector<std::vector<Op>> generate_ops(const Options &options, const Workload &workload, std::size_t loaded)
+    {
+        std::vector<std::vector<Op>> per_thread(options.threads);
+        const std::size_t per = options.ops / options.threads;
+        const std::size_t quota = insert_quota(per, workload.insert);
+        ZipfianGenerator zipf(options.dist == "zipf" ? loaded : 2);
+        for (int t = 0; t < options.threads; t++)
+        {
+            std::mt19937_64 gen(options.seed * 1000003 + t + 1);
+            std::uniform_real_distribution<double> coin(0.0, 1.0);
+            std::size_t next_insert = loaded + t * quota;
+            const std::size_t insert_end = next_insert + quota;
+            std::size_t sequential = loaded / options.threads * t;
+            per_thread[t].reserve(per);
+            for (std::size_t i = 0; i < per; i++)
+            {
+                Op op{OpType::Read, 0, 0};
+                const double r = coin(gen);
+                if (r < workload.read)
+                {
+                    op.type = OpType::Read;
+                }
+                else if (r < workload.read + workload.update)
+                {
+                    op.type = OpType::Update;
+                }
+                else if (r < workload.read + workload.update + workload.insert)
+                {
+                    // 万一新键用完了就改成更新，不能越过这个线程的那一段
+                    op.type = next_insert < insert_end ? OpType::Insert : OpType::Update;
+                }
+                else
+                {
+                    op.type = OpType::Scan;
+                    op.scan_length = 1 + gen() % options.max_scan;
+                }
+                if (op.type == OpType::Insert)
+                {
+                    op.key = next_insert++;
+                }
+                else if (options.dist == "zipf")
+                {
+                    op.key = zipf.next(gen);
+                }
+                else if (options.dist == "seq")
+                {
+                    op.key = sequential++ % loaded;
+                }
+                else
+                {
+                    op.key = gen() % loaded;
+                }
+                per_thread[t].push_back(op);
+            }
+        }
+        return per_thread;
+    }
+
+    std::size_t insert_keys_needed(const Options &options)
+    {
+        // 最多的插入比例是E的5%，按每个线程的份额留够新键
+        const std::size_t per = options.ops / options.threads;
+        return options.threads * insert_quota(per, 0.05);
+    }
+
+    // -------------------------
+    // 延迟直方图：16以下每个值一个桶，之后每个2的幂再分16个桶，相对误差不超过1/16
+    // -------------------------
+    class Histogram
+    {
+    public:
+        void record(uint64_t ns)
+        {
+            counts_[index_of(ns)]++;
+            total_++;
+        }
+
+        void merge(const Histogram &other)
+        {
+            for (std::size_t i = 0; i < kBuckets; i++)
+            {
+                counts_[i] += other.counts_[i];
+            }
+            total_ += other.total_;
+        }
+
+        // 返回第q分位所在桶的下界
+        uint64_t percentile(double q) const
+        {
+            if (total_ == 0)
+            {
+                return 0;
+            }
+            const uint64_t target = static_cast<uint64_t>(std::ceil(q * total_));
+            uint64_t seen = 0;
+            for (std::size_t i = 0; i < kBuckets; i++)
+            {
+                seen += counts_[i];
+                if (seen >= target && counts_[i] != 0)
+                {
+                    return value_of(i);
+                }
+            }
+            return value_of(kBuckets - 1);
+        }
+
+    private:
+        static constexpr std::size_t kBuckets = 1024;
+
+        static std::size_t index_of(uint64_t ns)
+        {
+            if (ns < 16)
+            {
+                return static_cast<std::size_t>(ns);
+            }
+            const int exponent = 63 - __builtin_clzll(ns);
+            const std::size_t sub = (ns >> (exponent - 4)) & 15;
+            return (exponent - 3) * 16 + sub;
+        }
+
+        static uint64_t value_of(std::size_t index)
+        {
+            if (index < 16)
+            {
+                return index;
+            }
+            const int exponent = static_cast<int>(index / 16) + 3;
+            return (16 + index % 16) << (exponent - 4);
+        }
+
+        uint64_t counts_[kBuckets] = {0};
+        uint64_t total_ = 0;
+    };
+
+    // -------------------------
+    // 被测的结构，接口统一成insert/read/scan
+    // -------------------------
+    template <typename Tree>
+    class MERTAdapter
+    {
+    public:
+        void insert(const std::string &key, const std::string &value) { tree_.insert(key, value); }
+        bool read(const std::string &key, std::string &value) const { return tree_.search(key, value); }
+        std::size_t scan(const std::string &start, std::size_t count) const
+        {
+            std::size_t bytes = 0;
+            std::size_t visited = tree_.scan(start, "", [&bytes](std::string_view, std::string_view value)
+                                             {
+                bytes += value.size();
+                return true; },
+                                             count);
+            g_scanSink.fetch_add(bytes, std::memory_order_relaxed);
+            return visited;
+        }
+        bool supports_scan() const { return true; }
+        std::size_t extra_bytes() const { return tree_.memory_usage(); }
+        // 载入之后树的形状：查一个键平均经过几个节点、最深几层、最长的prefix
+        std::string shape() const
+        {
+            const MERTSkewReport report = tree_.skew_report();
+            std::ostringstream out;
+            out << std::fixed << std::setprecision(2) << "平均深度 " << (report.keys ? static_cast<double>(report.key_levels) / report.keys : 0.0)
+                << "，最深 " << report.max_depth << "，节点 " << report.nodes << "，prefix接到节点外的 " << report.long_prefixes
+                << "，最长prefix " << report.max_prefix_length;
+            return out.str();
+        }
+
+    private:
+        Tree tree_;
+    };
+
+    // 标准库的容器本身不是线程安全的，用读写锁包一下：读和扫描拿读锁，写拿写锁
+    template <typename Map, bool Ordered>
+    class LockedMapAdapter
+    {
+    public:
+        void insert(const std::string &key, const std::string &value)
+        {
+            std::unique_lock<std::shared_mutex> guard(lock_);
+            map_[key] = value;
+        }
+        bool read(const std::string &key, std::string &value) const
+        {
+            std::shared_lock<std::shared_mutex> guard(lock_);
+            auto it = map_.find(key);
+            if (it == map_.end())
+            {
+                return false;
+            }
+            value = it->second;
+            return true;
+        }
+        std::size_t scan(const std::string &start, std::size_t count) const
+        {
+            if constexpr (Ordered)
+            {
+                std::shared_lock<std::shared_mutex> guard(lock_);
+                std::size_t visited = 0;
+                std::size_t bytes = 0;
+                for (auto it = map_.lower_bound(start); it != map_.end() && visited < count; ++it)
+                {
+                    bytes += it->second.size(); // 和MERT的回调一样碰一下值，免得整个循环被优化掉
+                    visited++;
+                }
+                g_scanSink.fetch_add(bytes, std::memory_order_relaxed);
+                return visited;
+            }
+            return 0;
+        }
+        bool supports_scan() const { return Ordered; }
+        std::size_t extra_bytes() const { return 0; }
+        std::string shape() const { return ""; }
+
+    private:
+        mutable std::shared_mutex lock_;
+        Map map_;
+    };
+
+    struct Result
+    {
+        double mops = 0;
+        Histogram histogram;
+    };
+
+    // 多个线程同时跑各自的操作序列，每个操作单独计时
+    template <typename Structure>
+    Result run_ops(Structure &structure, const std::vector<std::vector<Op>> &per_thread, const std::vector<std::string> &keys,
+                   const std::string &value)
+    {
+        std::vector<Histogram> histograms(per_thread.size());
+        std::vector<std::thread> threads;
+        std::atomic<int> ready{0};
+        std::atomic<bool> go{false};
+        std::chrono::steady_clock::time_point start;
+        for (std::size_t t = 0; t < per_thread.size(); t++)
+        {
+            threads.emplace_back([&, t]()
+                                 {
+                std::string out;
+                Histogram &histogram = histograms[t];
+                ready.fetch_add(1);
+                while (!go.load(std::memory_order_acquire))
+                {
+                    std::this_thread::yield();
+                }
+                for (const Op &op : per_thread[t])
+                {
+                    const std::string &key = keys[op.key];
+                    auto begin = std::chrono::steady_clock::now();
+                    switch (op.type)
+                    {
+                    case OpType::Read:
+                        structure.read(key, out);
+                        break;
+                    case OpType::Update:
+                    case OpType::Insert:
+                        structure.insert(key, value);
+                        break;
+                    case OpType::Scan:
+                        structure.scan(key, op.scan_length);
+                        break;
+                    }
+                    auto end = std::chrono::steady_clock::now();
+                    histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+                } });
+        }
+        while (ready.load() != static_cast<int>(per_thread.size()))
+        {
+            std::this_thread::yield();
+        }
+        start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        auto end = std::chrono::steady_clock::now();
+        Result result;
+        std::size_t total = 0;
+        for (std::size_t t = 0; t < per_thread.size(); t++)
+        {
+            result.histogram.merge(histograms[t]);
+            total += per_thread[t].size();
+        }
+        const double seconds = std::chrono::duration<double>(end - start).count();
+        result.mops = total / (seconds > 0 ? seconds : 1e-9) / 1e6;
+        return result;
+    }
+
+    void print_row(const std::string &structure, const std::string &phase, const Result &result, double bytes_per_key)
+    {
+        std::cout << std::left << std::setw(12) << structure << std::setw(8) << phase << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(10) << result.mops << std::setw(10) << result.histogram.percentile(0.50) << std::setw(10)
+                  << result.histogram.percentile(0.99) << std::setw(10) << result.histogram.percentile(0.999);
+        if (bytes_per_key > 0)
+        {
+            std::cout << std::setw(12) << std::setprecision(1) << bytes_per_key;
+        }
+        std::cout << std::endl;
+    }
+
+    // 载入(多线程平分键集合，每个线程按顺序插入自己那一段)，然后依次跑各个负载
+    template <typename Structure>
+    void run_structure(const std::string &name, const Options &options, const std::vector<std::string> &keys,
+                       const std::vector<std::pair<Workload, std::vector<std::vector<Op>>>> &workloads, const std::string &value)
+    {
+        const long long heap_before = g_liveBytes.load();
+        auto structure = std::make_unique<Structure>();
+        std::vector<std::vector<Op>> load(options.threads);
+        for (std::size_t i = 0; i < options.keys; i++)
+        {
+            load[i * options.threads / options.keys].push_back({OpType::Insert, 0, i});
+        }
+        Result loaded = run_ops(*structure, load, keys, value);
+        const double bytes_per_key = static_cast<double>(g_liveBytes.load() - heap_before + structure->extra_bytes()) / options.keys;
+        print_row(name, "load", loaded, bytes_per_key);
+        const std::string shape = structure->shape();
+        if (!shape.empty())
+        {
+            std::cout << std::left << std::setw(12) << name << std::setw(8) << "shape" << "  " << shape << std::endl;
+        }
+        for (const auto &workload : workloads)
+        {
+            if (workload.first.scan > 0 && !structure->supports_scan())
+            {
+                std::cout << std::left << std::setw(12) << name << std::setw(8) << workload.first.name << "  不支持有序扫描，跳过" << std::endl;
+                continue;
+            }
+            print_row(name, workload.first.name, run_ops(*structure, workload.second, keys, value), 0);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse_options(argc, argv, options))
+    {
+        usage();
+        return 1;
+    }
+    options.keys = std::max<std::size_t>(options.keys, 1);
+
+    // 计时之前把键、值和所有的操作序列都生成好
+    const std::vector<std::string> keys = generate_keys(options, options.keys + insert_keys_needed(options));
+    const std::string value(options.value_length, 'v');
+    std::vector<std::pair<Workload, std::vector<std::vector<Op>>>> workloads;
+    for (const std::string &name : options.workloads)
+    {
+        Workload workload;
+        if (!find_workload(name, workload))
+        {
+            std::cout << "未知的负载 " << name << std::endl;
+            return 1;
+        }
+        workloads.emplace_back(workload, generate_ops(options, workload, options.keys));
+    }
+
+    std::cout << "键 " << options.keys << " 个，长度 " << options.key_length << "，分布 " << options.dist << "，每个负载 " << options.ops
+              << " 次操作，" << options.threads << " 个线程，种子 " << options.seed << std::endl;
+    std::cout << "A: 50%读/50%更新  B: 95%读/5%更新  C: 100%读  E: 95%扫描(长度1~" << options.max_scan << ")/5%插入" << std::endl;
+    std::cout << "map和umap外面包了一把读写锁" << std::endl;
+    std::cout << std::left << std::setw(12) << "结构" << std::setw(8) << "阶段" << std::right << std::setw(10) << "Mops/s" << std::setw(10)
+              << "p50(ns)" << std::setw(10) << "p99(ns)" << std::setw(10) << "p999(ns)" << std::setw(12) << "字节/键" << std::endl;
+    for (const std::string &structure : options.structures)
+    {
+        if (structure == "mert")
+        {
+            run_structure<MERTAdapter<MERT>>(structure, options, keys, workloads, value);
+        }
+        else if (structure == "mert-small")
+        {
+            run_structure<MERTAdapter<SmallKeyMERT>>(structure, options, keys, workloads, value);
+        }
+        else if (structure == "mert-long")
+        {
+            run_structure<MERTAdapter<LongKeyMERT>>(structure, options, keys, workloads, value);
+        }
+        else if (structure == "mert-hash")
+        {
+            run_structure<MERTAdapter<MixedHashMERT>>(structure, options, keys, workloads, value);
+        }
+        else if (structure == "map")
+        {
+            run_structure<LockedMapAdapter<std::map<std::string, std::string>, true>>(structure, options, keys, workloads, value);
+        }
+        else if (structure == "umap")
+        {
+            run_structure<LockedMapAdapter<std::unordered_map<std::string, std::string>, false>>(structure, options, keys, workloads, value);
+        }
+        else
+        {
+            std::cout << "未知的结构 " << structure << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
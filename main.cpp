@@ -1,15 +1,60 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <chrono>
 #include <random>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <unistd.h>
 #include "extendible_radix_tree/MERT.hh"
+#include "extendible_radix_tree/MERTSharded.hh"
+
+// 统计堆分配次数，用来观察MERT本身的内存分配情况(4字节key和10字节value都在SSO里，不会分配)
+static std::atomic<long long> g_allocCount{0};
+
+void *operator new(std::size_t size)
+{
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+// 当前进程的常驻内存(RSS)，单位MB
+double currentRssMB()
+{
+    long pages = 0;
+    long residentPages = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> residentPages;
+    return residentPages * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+}
 
 // 生成随机字符串
 std::string generateRandomString(size_t length)
 {
     static const std::string charset = "0123456789";
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
+    // 固定种子，每次运行生成同样的键，结果才能跨次比较
+    static std::mt19937 gen(42);
     static std::uniform_int_distribution<> dis(0, charset.size() - 1);
 
     std::string result;
@@ -21,14 +66,816 @@ std::string generateRandomString(size_t length)
     return result;
 }
 
-int main()
+// 多线程插入：每个线程插入自己预先生成好的key，线程数从1翻倍到硬件线程数
+void concurrentInsertBenchmark(int numInsertions, size_t keyLength, size_t valueLength)
+{
+    std::vector<std::string> keys;
+    keys.reserve(numInsertions);
+    for (int i = 0; i < numInsertions; ++i)
+    {
+        keys.push_back(generateRandomString(keyLength));
+    }
+    const std::string value = generateRandomString(valueLength);
+    const unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned numThreads = 1;; numThreads = std::min(numThreads * 2, maxThreads))
+    {
+        MERT mert;
+        std::vector<std::thread> workers;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (unsigned t = 0; t < numThreads; ++t)
+        {
+            workers.emplace_back([&, t]()
+                                 {
+                // 每个线程负责keys里面连续的一段
+                size_t begin = keys.size() * t / numThreads;
+                size_t end = keys.size() * (t + 1) / numThreads;
+                for (size_t i = begin; i < end; ++i)
+                {
+                    mert.insert(keys[i], value);
+                } });
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        auto durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        std::cout << numThreads << " 个线程插入 " << numInsertions << " 个键值对花费了 " << durationNs / 1000000 << " 毫秒，吞吐 "
+                  << static_cast<long long>(numInsertions * 1e9 / (durationNs > 0 ? durationNs : 1)) << " ops/s。" << std::endl;
+        if (numThreads == maxThreads)
+        {
+            break;
+        }
+    }
+}
+
+// 单线程逐个插入，统计每次插入的耗时分布，段分裂、生成子节点、回收退休对象都落在碰上的那次插入里，看的是尾延迟
+void insertLatencyBenchmark(int numInsertions, size_t keyLength, size_t valueLength)
 {
+    MERT mert;
+    std::vector<std::string> keys;
+    keys.reserve(numInsertions);
+    for (int i = 0; i < numInsertions; ++i)
+    {
+        keys.push_back(generateRandomString(keyLength));
+    }
+    const std::string value = generateRandomString(valueLength);
+    std::vector<long long> latencies(numInsertions);
+    for (int i = 0; i < numInsertions; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        mert.insert(keys[i], value);
+        latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p)
+    {
+        return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+    };
+    std::cout << "插入延迟(ns): p50 " << percentile(0.5) << "，p99 " << percentile(0.99) << "，p999 " << percentile(0.999)
+              << "，p9999 " << percentile(0.9999) << "，最大 " << latencies.back() << std::endl;
+}
+
+// 批量导入和逐个插入对比，键值对预先生成好，bulk_load的时间包括排序
+void bulkLoadBenchmark(int numKeys, size_t keyLength, size_t valueLength)
+{
+    std::vector<std::pair<std::string, std::string>> pairs;
+    pairs.reserve(numKeys);
+    for (int i = 0; i < numKeys; ++i)
+    {
+        pairs.emplace_back(generateRandomString(keyLength), generateRandomString(valueLength));
+    }
+
+    long long insertMs = 0;
+    {
+        MERT mert;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const auto &pair : pairs)
+        {
+            mert.insert(pair.first, pair.second);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        insertMs = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    }
+    long long bulkMs = 0;
+    {
+        MERT mert;
+        auto start = std::chrono::high_resolution_clock::now();
+        mert.bulk_load(pairs.begin(), pairs.end());
+        auto end = std::chrono::high_resolution_clock::now();
+        bulkMs = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    }
+    std::cout << numKeys << " 个" << keyLength << "字节的键：逐个插入 " << insertMs << " 毫秒，bulk_load " << bulkMs << " 毫秒。" << std::endl;
+}
+
+// 同一批键分别插入不同形状的树，比较插入、查找的耗时和内存池占用
+template <typename Tree>
+void shapeBenchmark(const char *name, const std::vector<std::string> &keys, const std::string &value)
+{
+    Tree tree;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const std::string &key : keys)
+    {
+        tree.insert(key, value);
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    std::string found;
+    int hits = 0;
+    for (const std::string &key : keys)
+    {
+        if (tree.search(key, found))
+        {
+            ++hits;
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "  " << name << "：插入 " << std::chrono::duration_cast<std::chrono::milliseconds>(mid - start).count()
+              << " 毫秒，查找 " << std::chrono::duration_cast<std::chrono::milliseconds>(end - mid).count() << " 毫秒(命中 " << hits
+              << ")，内存池 " << tree.memory_usage() / (1024 * 1024) << " MB。" << std::endl;
+}
+
+void shapeBenchmarks(int numKeys, size_t valueLength)
+{
+    const std::string value = generateRandomString(valueLength);
+    std::vector<std::string> shortKeys;
+    std::vector<std::string> longKeys;
+    shortKeys.reserve(numKeys);
+    longKeys.reserve(numKeys);
+    for (int i = 0; i < numKeys; ++i)
+    {
+        shortKeys.push_back(generateRandomString(8));
+        // 长key带一段公共前缀，像路径或者带租户的业务key
+        longKeys.push_back("tenant/" + generateRandomString(2) + "/user/" + generateRandomString(20));
+    }
+    std::cout << numKeys << " 个8字节的键：" << std::endl;
+    shapeBenchmark<MERT>("MERT", shortKeys, value);
+    shapeBenchmark<SmallKeyMERT>("SmallKeyMERT", shortKeys, value);
+    shapeBenchmark<LongKeyMERT>("LongKeyMERT", shortKeys, value);
+    std::cout << numKeys << " 个" << longKeys[0].size() << "字节的键：" << std::endl;
+    shapeBenchmark<MERT>("MERT", longKeys, value);
+    shapeBenchmark<SmallKeyMERT>("SmallKeyMERT", longKeys, value);
+    shapeBenchmark<LongKeyMERT>("LongKeyMERT", longKeys, value);
+}
+
+// 按段索引、段深度、桶的填充数打印键的分布
+void printSkewReport(const MERTSkewReport &report)
+{
+    std::size_t used = 0;
+    std::size_t most = 0;
+    for (std::size_t count : report.keys_per_slot)
+    {
+        used += count != 0;
+        most = std::max(most, count);
+    }
+    std::size_t filled = 0;
+    for (std::size_t i = 0; i < report.bucket_fill.size(); ++i)
+    {
+        filled += i * report.bucket_fill[i];
+    }
+    std::cout << "    节点 " << report.nodes << "(紧凑节点 " << report.compact_nodes << "，prefix接到节点外的 " << report.long_prefixes << ")，段 " << report.segments << "，桶 " << report.buckets << "(溢出桶 " << report.overflow_buckets
+              << ")，平均每个桶 " << (report.buckets ? static_cast<double>(filled) / report.buckets : 0.0) << " 个条目" << std::endl;
+    std::cout << "    段索引用到 " << used << "/" << report.keys_per_slot.size() << " 个，最多的一个占了 "
+              << (report.keys ? 100.0 * most / report.keys : 0.0) << "% 的键；各段索引的键数：";
+    for (std::size_t count : report.keys_per_slot)
+    {
+        std::cout << count << " ";
+    }
+    std::cout << std::endl
+              << "    各local_depth的段数：";
+    for (std::size_t count : report.segments_by_depth)
+    {
+        std::cout << count << " ";
+    }
+    std::cout << std::endl;
+}
+
+// 十进制数字ID的键分别用两种索引取法插入，比较耗时、内存和分布
+template <typename Tree>
+void skewBenchmark(const char *name, const std::vector<std::string> &keys, const std::string &value)
+{
+    Tree tree;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const std::string &key : keys)
+    {
+        tree.insert(key, value);
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    std::string found;
+    for (const std::string &key : keys)
+    {
+        tree.search(key, found);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "  " << name << "：插入 " << std::chrono::duration_cast<std::chrono::milliseconds>(mid - start).count()
+              << " 毫秒，查找 " << std::chrono::duration_cast<std::chrono::milliseconds>(end - mid).count() << " 毫秒，内存池 "
+              << tree.memory_usage() / (1024 * 1024) << " MB。" << std::endl;
+    printSkewReport(tree.skew_report());
+}
+
+void skewBenchmarks(int numKeys, size_t valueLength)
+{
+    const std::string value = generateRandomString(valueLength);
+    std::vector<std::string> keys;
+    keys.reserve(numKeys);
+    std::mt19937_64 gen(42);
+    for (int i = 0; i < numKeys; ++i)
+    {
+        keys.push_back(std::to_string(1000000000000ULL + gen() % 1000000000000ULL));
+    }
+    std::cout << numKeys << " 个13位十进制ID：" << std::endl;
+    skewBenchmark<MERT>("原始位(MERT)", keys, value);
+    skewBenchmark<MixedHashMERT>("打散(MixedHashMERT)", keys, value);
+}
+
+// 键的换手：每一轮删掉全部旧键再插入同样多的新键，活跃键数不变，常驻内存应该稳定下来而不是一直涨
+void churnBenchmark(int numKeys, size_t keyLength, size_t valueLength, int rounds)
+{
+    MERT mert;
+    std::vector<std::string> keys;
+    keys.reserve(numKeys);
+    for (int i = 0; i < numKeys; ++i)
+    {
+        keys.push_back(generateRandomString(keyLength));
+        mert.insert(keys.back(), generateRandomString(valueLength));
+    }
+    std::cout << "换手前 " << numKeys << " 个键，常驻内存 " << currentRssMB() << " MB。" << std::endl;
+    // 换手期间每隔两秒输出一次树的统计信息，看段合并、子节点合并是不是跟得上
+    mert.start_stats_dump(std::chrono::milliseconds(2000), [](const MERTStats &stats)
+                          {
+        std::cout << "[定期统计]" << std::endl;
+        stats.dump(std::cout); });
+    for (int round = 1; round <= rounds; ++round)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        int erased = 0;
+        for (const std::string &key : keys)
+        {
+            if (mert.erase(key))
+            {
+                ++erased;
+            }
+        }
+        auto mid = std::chrono::high_resolution_clock::now();
+        for (std::string &key : keys)
+        {
+            key = generateRandomString(keyLength);
+            mert.insert(key, generateRandomString(valueLength));
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "第 " << round << " 轮：删除 " << erased << " 个键 "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(mid - start).count() << " 毫秒，重新插入 "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - mid).count() << " 毫秒，常驻内存 "
+                  << currentRssMB() << " MB。" << std::endl;
+    }
+    mert.stop_stats_dump();
+}
+
+// 活跃键数变少：插入之后删掉九成，看常驻内存和内存池是不是跟着降下来
+void shrinkBenchmark(int numKeys, size_t keyLength, size_t valueLength)
+{
+    double rssBefore;
+    {
+        MERT mert;
+        std::vector<std::string> keys;
+        keys.reserve(numKeys);
+        for (int i = 0; i < numKeys; ++i)
+        {
+            keys.push_back(generateRandomString(keyLength));
+            mert.insert(keys.back(), generateRandomString(valueLength));
+        }
+        rssBefore = currentRssMB();
+        std::cout << "删除前 " << numKeys << " 个键，常驻内存 " << rssBefore << " MB，内存池 " << mert.memory_usage() / (1024 * 1024)
+                  << " MB。" << std::endl;
+        auto start = std::chrono::high_resolution_clock::now();
+        int erased = 0;
+        for (int i = 0; i < numKeys; ++i)
+        {
+            if (i % 10 != 0 && mert.erase(keys[i]))
+            {
+                ++erased;
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        const MERTStats stats = mert.stats();
+        std::cout << "删除 " << erased << " 个键花费了 " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+                  << " 毫秒，剩下 " << stats.shape.keys << " 个键、" << stats.shape.nodes << " 个节点，常驻内存 " << currentRssMB()
+                  << " MB，内存池 " << mert.memory_usage() / (1024 * 1024) << " MB。" << std::endl;
+    }
+    std::cout << "树析构之后常驻内存 " << currentRssMB() << " MB(删除前 " << rssBefore << " MB)。" << std::endl;
+}
+
+// 重启：逐个插入重建和打开快照对比，打开之后的第一轮查找要从文件里把页读进来
+void snapshotBenchmark(int numKeys, size_t keyLength, size_t valueLength)
+{
+    const std::string path = "mert_benchmark.snap";
+    std::vector<std::pair<std::string, std::string>> pairs;
+    pairs.reserve(numKeys);
+    for (int i = 0; i < numKeys; ++i)
+    {
+        pairs.emplace_back(generateRandomString(keyLength), generateRandomString(valueLength));
+    }
+    {
+        MERT mert;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const auto &pair : pairs)
+        {
+            mert.insert(pair.first, pair.second);
+        }
+        auto mid = std::chrono::high_resolution_clock::now();
+        if (!mert.save_snapshot(path))
+        {
+            std::cout << "写快照失败。" << std::endl;
+            return;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "逐个插入重建 " << numKeys << " 个键花费了 " << std::chrono::duration_cast<std::chrono::milliseconds>(mid - start).count()
+                  << " 毫秒，写快照花费了 " << std::chrono::duration_cast<std::chrono::milliseconds>(end - mid).count() << " 毫秒。" << std::endl;
+    }
+    MERT mert;
+    auto start = std::chrono::high_resolution_clock::now();
+    if (!mert.open_snapshot(path))
+    {
+        std::cout << "打开快照失败。" << std::endl;
+        return;
+    }
+    auto opened = std::chrono::high_resolution_clock::now();
+    std::string value;
+    int hits = 0;
+    for (const auto &pair : pairs)
+    {
+        hits += mert.search(pair.first, value);
+    }
+    auto searched = std::chrono::high_resolution_clock::now();
+    // 每个根桶写一次，每次只把写到的那一块条目插进树里
+    for (int c = 0; c < 256; ++c)
+    {
+        mert.insert(std::string(1, static_cast<char>(c)) + "~", "");
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "打开快照花费了 " << std::chrono::duration_cast<std::chrono::microseconds>(opened - start).count()
+              << " 微秒，之后查找全部键 " << std::chrono::duration_cast<std::chrono::milliseconds>(searched - opened).count()
+              << " 毫秒(命中 " << hits << ")，所有根桶都写一次 "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - searched).count() << " 毫秒。" << std::endl;
+    std::remove(path.c_str());
+}
+
+// key[0]全相同的快照：2^56以下的64位ID都落在第0个根桶里，打开之后第一次写只应该拷贝写到的那一块，
+// 看第一次写的耗时、内存池涨了多少，再和快照比对所有键，确认读快照和读树的块拼起来是对的
+void snapshotSkewBenchmark(int numKeys, size_t valueLength)
+{
+    const std::string path = "mert_skew.snap";
+    const std::string value = generateRandomString(valueLength);
+    std::mt19937_64 rng(17);
+    std::vector<uint64_t> ids(numKeys);
+    for (auto &id : ids)
+    {
+        id = rng() >> 8;
+    }
+    {
+        U64MERT tree;
+        for (uint64_t id : ids)
+        {
+            tree.insert_u64(id, value);
+        }
+        if (!tree.save_snapshot(path))
+        {
+            std::cout << "写快照失败。" << std::endl;
+            return;
+        }
+    }
+    U64MERT tree;
+    if (!tree.open_snapshot(path))
+    {
+        std::cout << "打开快照失败。" << std::endl;
+        return;
+    }
+    const MERTStats opened = tree.stats();
+    auto start = std::chrono::high_resolution_clock::now();
+    tree.insert_u64(ids[0] + 1, value);
+    auto end = std::chrono::high_resolution_clock::now();
+    const MERTStats written = tree.stats();
+    std::cout << "key[0]全为0的快照(" << numKeys << " 个64位ID，" << opened.snapshot_chunks << " 块): 第一次insert_u64花费了 "
+              << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " 微秒，内存池涨了 "
+              << (written.memory_bytes - opened.memory_bytes) / 1024 << "KB，还有 " << written.snapshot_chunks << " 块直接读快照" << std::endl;
+    // 再随机写1000次，之后所有键都要还在，值是最后写的那个
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < 1000; ++i)
+    {
+        tree.insert_u64(ids[rng() % ids.size()], "updated");
+    }
+    end = std::chrono::high_resolution_clock::now();
+    size_t found = 0;
+    std::string result;
+    for (uint64_t id : ids)
+    {
+        found += tree.search_u64(id, result);
+    }
+    size_t scanned = tree.scan("", "", [](std::string_view, std::string_view)
+                               { return true; });
+    std::cout << "再随机写1000次花费了 " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+              << " 毫秒，内存池 " << tree.memory_usage() / (1024 * 1024) << "MB，还有 " << tree.stats().snapshot_chunks
+              << " 块直接读快照，查找找到 " << found << " 个，遍历 " << scanned << " 个键" << std::endl;
+    std::remove(path.c_str());
+}
+
+// 预写日志三种同步方式的插入吞吐，日志写在当前目录下，fdatasync的开销取决于所在的盘
+void walBenchmark(int numInsertions, size_t keyLength, size_t valueLength)
+{
+    const std::string path = "mert_benchmark.wal";
+    std::vector<std::string> keys;
+    keys.reserve(numInsertions);
+    for (int i = 0; i < numInsertions; ++i)
+    {
+        keys.push_back(generateRandomString(keyLength));
+    }
+    const std::string value = generateRandomString(valueLength);
+    const std::pair<MERTSyncMode, const char *> modes[] = {
+        {MERTSyncMode::EveryOp, "每个操作落盘"},
+        {MERTSyncMode::Group, "组提交"},
+        {MERTSyncMode::Periodic, "每10毫秒落盘"},
+    };
+    for (const auto &mode : modes)
+    {
+        for (unsigned numThreads : {1u, 4u, 16u})
+        {
+            std::remove(path.c_str());
+            MERTWalOptions options;
+            options.sync_mode = mode.first;
+            MERT mert;
+            if (!mert.open_wal(path, options))
+            {
+                std::cout << "打开预写日志失败。" << std::endl;
+                return;
+            }
+            std::vector<std::thread> workers;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (unsigned t = 0; t < numThreads; ++t)
+            {
+                workers.emplace_back([&, t]()
+                                     {
+                    size_t begin = keys.size() * t / numThreads;
+                    size_t end = keys.size() * (t + 1) / numThreads;
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        mert.insert(keys[i], value);
+                    } });
+            }
+            for (auto &worker : workers)
+            {
+                worker.join();
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            auto durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            std::cout << mode.second << "，" << numThreads << " 个线程插入 " << numInsertions << " 个键值对花费了 " << durationNs / 1000000
+                      << " 毫秒，吞吐 " << static_cast<long long>(numInsertions * 1e9 / (durationNs > 0 ? durationNs : 1)) << " ops/s。" << std::endl;
+        }
+    }
+    std::remove(path.c_str());
+}
+
+// 随机顺序查一遍所有的键，逐个search和每256个一批multi_get比较
+void multiGetBenchmark(int numKeys, size_t keyLength, size_t valueLength)
+{
+    MERT mert;
+    std::vector<std::string> keys;
+    keys.reserve(numKeys);
+    const std::string value = generateRandomString(valueLength);
+    for (int i = 0; i < numKeys; ++i)
+    {
+        keys.push_back(generateRandomString(keyLength));
+        mert.insert(keys.back(), value);
+    }
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+    std::string result;
+    size_t found = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto &key : keys)
+    {
+        found += mert.search(key, result);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "逐个查找 " << numKeys << " 个键花费了 " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+              << " 毫秒，找到 " << found << " 个。" << std::endl;
+    const size_t batchSize = 256;
+    std::vector<std::string_view> batch(batchSize);
+    std::vector<std::string> values(batchSize);
+    std::unique_ptr<bool[]> hits(new bool[batchSize]);
+    found = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < keys.size(); i += batchSize)
+    {
+        size_t n = std::min(batchSize, keys.size() - i);
+        for (size_t j = 0; j < n; ++j)
+        {
+            batch[j] = keys[i + j];
+        }
+        found += mert.multi_get(batch.data(), n, values.data(), hits.get());
+    }
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "每 " << batchSize << " 个一批multi_get花费了 " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+              << " 毫秒，找到 " << found << " 个。" << std::endl;
+}
+
+// value从几十字节到几KB不等，反复覆盖，比较value放在键值对里和放进value日志时的耗时和内存
+template <typename Tree>
+void valueLogRun(const char *name, const std::vector<std::string> &keys, const std::vector<std::string> &values, int rounds)
+{
+    Tree mert;
+    std::mt19937 rng(11);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (const auto &key : keys)
+        {
+            mert.insert(key, values[rng() % values.size()]);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    mert.compact_value_log();
+    MERTStats stats = mert.stats();
+    std::cout << name << ": " << keys.size() << " 个键覆盖写 " << rounds << " 轮花费了 "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " 毫秒，内存池 "
+              << stats.memory_bytes / (1024 * 1024) << "MB，value日志 " << stats.value_log_bytes / (1024 * 1024) << "MB(活着的 "
+              << stats.value_log_live_bytes / (1024 * 1024) << "MB)" << std::endl;
+}
+
+void valueLogBenchmark(int numKeys, size_t keyLength, int rounds)
+{
+    std::vector<std::string> keys;
+    keys.reserve(numKeys);
+    for (int i = 0; i < numKeys; ++i)
+    {
+        keys.push_back(generateRandomString(keyLength));
+    }
+    // 四分之三是短value，其余的到4KB
+    std::vector<std::string> values;
+    std::mt19937 rng(5);
+    for (int i = 0; i < 64; ++i)
+    {
+        values.push_back(generateRandomString(i % 4 == 0 ? 128 + rng() % 4000 : 10 + rng() % 100));
+    }
+    valueLogRun<MERT>("value放在键值对里", keys, values, rounds);
+    valueLogRun<ValueLogMERT>("长value放进value日志", keys, values, rounds);
+}
+
+// 64位ID：转成十进制字符串走字符串接口，和insert_u64直接用大端序的8个字节比较
+void u64Run(const char *name, const std::vector<uint64_t> &ids, const std::vector<uint64_t> &lookups, const std::string &value)
+{
+    MERT stringTree;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint64_t id : ids)
+    {
+        stringTree.insert(std::to_string(id), value);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto stringInsert = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::string result;
+    size_t found = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (uint64_t id : lookups)
+    {
+        found += stringTree.search(std::to_string(id), result);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    auto stringSearch = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::cout << name << " 十进制字符串: 插入 " << stringInsert << " 毫秒，查找 " << stringSearch << " 毫秒，找到 " << found
+              << " 个，内存池 " << stringTree.memory_usage() / (1024 * 1024) << "MB" << std::endl;
+
+    U64MERT u64Tree;
+    start = std::chrono::high_resolution_clock::now();
+    for (uint64_t id : ids)
+    {
+        u64Tree.insert_u64(id, value);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    auto u64Insert = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    found = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (uint64_t id : lookups)
+    {
+        found += u64Tree.search_u64(id, result);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    auto u64Search = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    std::cout << name << " insert_u64: 插入 " << u64Insert << " 毫秒，查找 " << u64Search << " 毫秒，找到 " << found
+              << " 个，内存池 " << u64Tree.memory_usage() / (1024 * 1024) << "MB" << std::endl;
+}
+
+void u64Benchmark(int numKeys, size_t valueLength)
+{
+    const std::string value = generateRandomString(valueLength);
+    std::mt19937_64 rng(13);
+    std::vector<uint64_t> ids(numKeys);
+    for (auto &id : ids)
+    {
+        id = rng();
+    }
+    std::vector<uint64_t> lookups(ids);
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937(3));
+    u64Run("随机ID", ids, lookups, value);
+    // 连续分配的ID，高位的字节都是0
+    for (int i = 0; i < numKeys; ++i)
+    {
+        ids[i] = 1000000 + i;
+    }
+    lookups = ids;
+    std::shuffle(lookups.begin(), lookups.end(), std::mt19937(3));
+    u64Run("连续ID", ids, lookups, value);
+}
+
+// 倾斜的键：租户按Zipf分布，热的租户下面的键多，比较段分满之后目录翻倍和直接生成子节点两种做法查找平均经过的节点数
+template <typename Tree>
+void directoryRun(const char *name, const std::vector<std::string> &keys, const std::vector<std::string> &lookups, const std::string &value)
+{
+    Tree tree;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const std::string &key : keys)
+    {
+        tree.insert(key, value);
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    std::string found;
+    for (const std::string &key : lookups)
+    {
+        tree.search(key, found);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    const MERTStats stats = tree.stats();
+    std::cout << "  " << name << "：插入 " << std::chrono::duration_cast<std::chrono::milliseconds>(mid - start).count()
+              << " 毫秒，查找 " << std::chrono::duration_cast<std::chrono::milliseconds>(end - mid).count() << " 毫秒，查找平均经过 "
+              << (stats.searches ? static_cast<double>(stats.search_levels) / stats.searches : 0.0) << " 个节点，最大深度 "
+              << stats.shape.max_depth << "，节点 " << stats.shape.nodes << "，目录翻倍 " << stats.directory_doublings << " 次，内存池 "
+              << tree.memory_usage() / (1024 * 1024) << " MB。" << std::endl;
+}
+
+void directoryBenchmark(int numKeys, int tenants, size_t valueLength)
+{
+    static const std::string charset = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    std::mt19937 gen(42);
+    auto randomName = [&gen](size_t length)
+    {
+        std::string name;
+        for (size_t i = 0; i < length; ++i)
+        {
+            name += charset[gen() % charset.size()];
+        }
+        return name;
+    };
+    // 第i个租户的权重是1/(i+1)
+    std::vector<std::string> names;
+    std::vector<double> weights;
+    for (int i = 0; i < tenants; ++i)
+    {
+        names.push_back(randomName(6));
+        weights.push_back(1.0 / (i + 1));
+    }
+    std::discrete_distribution<int> zipf(weights.begin(), weights.end());
+    std::vector<std::string> keys;
+    keys.reserve(numKeys);
+    for (int i = 0; i < numKeys; ++i)
+    {
+        keys.push_back("t/" + names[zipf(gen)] + "/" + randomName(10));
+    }
+    // 按插入的键随机查一遍，热租户的键查得也多
+    std::vector<std::string> lookups(keys);
+    std::shuffle(lookups.begin(), lookups.end(), gen);
+    const std::string value = generateRandomString(valueLength);
+    std::cout << numKeys << " 个键，" << tenants << " 个租户按Zipf分布：" << std::endl;
+    directoryRun<MERT>("目录固定4位(MERT)", keys, lookups, value);
+    directoryRun<GrowingDirectoryMERT>("目录翻倍到8位(GrowingDirectoryMERT)", keys, lookups, value);
+}
+
+void printShardLoads(const ShardedMERT &sharded)
+{
+    for (const MERTShardLoad &load : sharded.shard_loads())
+    {
+        std::cout << "  分片 " << load.shard << "：根桶 " << load.buckets << " 个，累计 " << load.ops << " 个操作，最近 " << load.recent_ops
+                  << " 个，排队 " << load.queued << " 个" << std::endl;
+    }
+}
+
+// 80%的键以'a'、'e'、'i'、'm'开头，一开始这四个根桶都在同一个分片上，看重新分配前后负载的分布和吞吐
+void shardedBenchmark(int numInsertions, size_t keyLength, size_t valueLength)
+{
+    std::vector<std::string> keys;
+    keys.reserve(numInsertions);
+    for (int i = 0; i < numInsertions; ++i)
+    {
+        std::string key = generateRandomString(keyLength);
+        if (i % 5 != 0)
+        {
+            key[0] = "aeim"[i % 4];
+        }
+        keys.push_back(key);
+    }
+    const std::string value = generateRandomString(valueLength);
+    const unsigned numThreads = 4;
+    const size_t batchSize = 64;
+    MERTShardOptions options;
+    options.shards = 4;
+    options.rebalance_interval = std::chrono::milliseconds(0); // 下面手动重新分配
+    ShardedMERT sharded(options);
+    // 每个客户端线程一次异步提交一批，再一起等
+    auto run = [&](size_t from, size_t to)
+    {
+        std::vector<std::thread> workers;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (unsigned t = 0; t < numThreads; ++t)
+        {
+            workers.emplace_back([&, t]()
+                                 {
+                std::vector<ShardedMERT::Request> batch(batchSize);
+                size_t begin = from + (to - from) * t / numThreads;
+                size_t end = from + (to - from) * (t + 1) / numThreads;
+                for (size_t i = begin; i < end; i += batchSize)
+                {
+                    size_t n = std::min(batchSize, end - i);
+                    for (size_t j = 0; j < n; ++j)
+                    {
+                        batch[j].type = ShardedMERT::OpType::Insert;
+                        batch[j].key = keys[i + j];
+                        batch[j].value = value;
+                        sharded.submit(batch[j]);
+                    }
+                    for (size_t j = 0; j < n; ++j)
+                    {
+                        ShardedMERT::wait(batch[j]);
+                    }
+                } });
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    };
+    const size_t half = keys.size() / 2;
+    auto before = run(0, half);
+    std::cout << "分片模式，" << numThreads << " 个客户端线程插入前一半 " << half << " 个键值对花费了 " << before / 1000000 << " 毫秒。" << std::endl;
+    printShardLoads(sharded);
+    std::cout << "重新分配" << (sharded.rebalance() ? "改变了" : "没有改变") << "根桶的归属。" << std::endl;
+    auto after = run(half, keys.size());
+    std::cout << "重新分配之后插入后一半 " << keys.size() - half << " 个键值对花费了 " << after / 1000000 << " 毫秒。" << std::endl;
+    printShardLoads(sharded);
+}
+
+// 提交一大批异步请求之后马上重新分配根桶再析构：排在旧主人队列里的请求要转手，析构函数返回之前它们都要执行完(done置上)
+void shardedShutdownCheck(int rounds, int numRequests, size_t keyLength)
+{
+    int unfinished = 0;
+    for (int round = 0; round < rounds; ++round)
+    {
+        std::vector<ShardedMERT::Request> requests(numRequests);
+        for (int i = 0; i < numRequests; ++i)
+        {
+            requests[i].type = ShardedMERT::OpType::Insert;
+            requests[i].key = generateRandomString(keyLength);
+            requests[i].key[0] = "aeim"[i % 4]; // 一开始这四个根桶都在分片0上，重新分配时一定会挪走几个
+            requests[i].value = requests[i].key;
+        }
+        {
+            MERTShardOptions options;
+            options.shards = 4;
+            options.queue_capacity = numRequests;
+            options.rebalance_interval = std::chrono::milliseconds(0);
+            ShardedMERT sharded(options);
+            for (auto &request : requests)
+            {
+                sharded.submit(request);
+            }
+            sharded.rebalance();
+            // 析构时分片0的队列里还排着很多请求，其中一部分的根桶已经归了别的分片
+        }
+        for (const auto &request : requests)
+        {
+            if (!request.done.load(std::memory_order_acquire))
+            {
+                ++unfinished;
+            }
+        }
+    }
+    std::cout << "分片模式析构：" << rounds << " 轮，每轮提交 " << numRequests << " 个请求后立即重新分配并析构，没有执行的请求 " << unfinished
+              << " 个。" << std::endl;
+}
+
+// 默认只跑开头插入、查找、遍历的一小段当冒烟测试，加--all才跑后面各项基准测试(要好几分钟)
+int main(int argc, char **argv)
+{
+    const bool runAll = argc > 1 && std::string(argv[1]) == "--all";
+    if (argc > 2 || (argc > 1 && !runAll))
+    {
+        std::cout << "用法: main [--all]" << std::endl;
+        return 1;
+    }
     //std::cout << "this is my first try" << std::endl;
     MERT mert;
     const int numInsertions = 400000; // 插入操作的次数
     const size_t keyLength = 4;      // 键的长度
     const size_t valueLength = 10;    // 值的长度
 
+    const long long allocsBefore = g_allocCount.load();
     auto start = std::chrono::high_resolution_clock::now();
 
     for (int i = 0; i < numInsertions; ++i)
@@ -42,6 +889,84 @@ int main()
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 
     std::cout << "插入 " << numInsertions << " 个键值对花费了 " << duration << " 毫秒。" << std::endl;
+    std::cout << "插入期间堆分配 " << g_allocCount.load() - allocsBefore << " 次，常驻内存 " << currentRssMB() << " MB。" << std::endl;
+
+    // 查找：先把要查的key生成好，计时只算search本身
+    const int numLookups = 400000;
+    std::vector<std::string> lookupKeys;
+    lookupKeys.reserve(numLookups);
+    for (int i = 0; i < numLookups; ++i)
+    {
+        lookupKeys.push_back(generateRandomString(keyLength));
+    }
+    std::string value;
+    value.reserve(valueLength);
+    int hits = 0;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (const std::string &key : lookupKeys)
+    {
+        if (mert.search(key, value))
+        {
+            ++hits;
+        }
+    }
+    end = std::chrono::high_resolution_clock::now();
+    auto lookupNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    std::cout << "查找 " << numLookups << " 个键花费了 " << lookupNs / 1000000 << " 毫秒，命中 " << hits
+              << " 个，吞吐 " << static_cast<long long>(numLookups * 1e9 / (lookupNs > 0 ? lookupNs : 1)) << " ops/s。" << std::endl;
+
+    // 全量遍历和前缀遍历，回调里只计数
+    std::size_t scanned = 0;
+    start = std::chrono::high_resolution_clock::now();
+    mert.scan("", "", [&scanned](std::string_view, std::string_view)
+              { ++scanned; return true; });
+    std::size_t prefixed = mert.prefix_scan("12", [](std::string_view, std::string_view)
+                                            { return true; });
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << "遍历全部 " << scanned << " 个键、前缀\"12\"的 " << prefixed << " 个键共花费了 "
+              << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " 微秒。" << std::endl;
+
+    // 插入和查找之后树的形状和热路径上的计数
+    mert.stats().dump(std::cout);
+
+    if (!runAll)
+    {
+        std::cout << "加--all跑全部的基准测试。" << std::endl;
+        return 0;
+    }
+
+    // 多线程插入用长一点的key，不然大部分都是覆盖写
+    concurrentInsertBenchmark(numInsertions, 8, valueLength);
+
+    insertLatencyBenchmark(2000000, 12, valueLength);
+
+    bulkLoadBenchmark(2000000, 12, valueLength);
+
+    shapeBenchmarks(1000000, valueLength);
+
+    skewBenchmarks(1000000, valueLength);
+
+    churnBenchmark(1000000, 12, valueLength, 5);
+    shrinkBenchmark(1000000, 12, valueLength);
+
+    snapshotBenchmark(1000000, 12, valueLength);
+    snapshotSkewBenchmark(1000000, valueLength);
+
+    walBenchmark(20000, 12, valueLength);
+
+    shardedBenchmark(1000000, 12, valueLength);
+
+    shardedShutdownCheck(20, 200000, 12);
+
+    multiGetBenchmark(2000000, 12, valueLength);
+
+    valueLogBenchmark(200000, 12, 5);
+
+    u64Benchmark(2000000, valueLength);
+
+    directoryBenchmark(1000000, 1000, valueLength);
 
     return 0;
 }